@@ -0,0 +1,135 @@
+#include "cal_table.h"
+#include "esp_log.h"
+#include <inttypes.h>
+
+static const char *TAG = "cal_table";
+
+// Q16 x / d. By the reciprocal inv = CAL_STEP_INV(d) if there is one (less than 1 LSB over for x < 2^15), else
+// divided, without the 64-bit division (a libgcc call on the ESP32) when x is small enough to shift in 32 bits
+static inline uint32_t cal_div_q16(uint32_t x, uint32_t d, uint32_t inv) {
+    if (x < (1UL << (31 - CAL_FRAC_SHIFT)) && inv) {
+        return (uint32_t)(((uint64_t)(x << CAL_FRAC_SHIFT) * inv) >> 31);
+    }
+    if (x < (1UL << (32 - CAL_FRAC_SHIFT))) {
+        return (x << CAL_FRAC_SHIFT) / d;
+    }
+    return (uint32_t)(((uint64_t)x << CAL_FRAC_SHIFT) / d);
+}
+
+// Cell index (0 .. n - 2) and Q16 position within it (forced inline: gcc keeps it out of line for three callers)
+static inline __attribute__((always_inline)) void cal_axis_locate(const cal_axis_t *axis, int32_t x, uint32_t *idx, int32_t *frac) {
+    if (axis->bp == NULL) {
+        int32_t max = axis->min + axis->step * (axis->n - 1);
+        if (x <= axis->min) {x = axis->min;}
+        if (x >= max) {x = max;}
+        // The Q16 position's integer part is the cell, its fraction the position in it (fits 32 bits, the cell count
+        // is well below 2^16)
+        uint32_t pos = cal_div_q16((uint32_t)(x - axis->min), (uint32_t)axis->step, axis->step_inv);
+        uint32_t i = pos >> CAL_FRAC_SHIFT;
+        if (i > (uint32_t)axis->n - 2) { // x == max lands at the end of the last cell
+            *idx = axis->n - 2;
+            *frac = 1 << CAL_FRAC_SHIFT;
+        } else {
+            *idx = i;
+            *frac = (int32_t)(pos & ((1UL << CAL_FRAC_SHIFT) - 1));
+        }
+        return;
+    }
+    if (x <= axis->bp[0]) {x = axis->bp[0];}
+    if (x >= axis->bp[axis->n - 1]) {x = axis->bp[axis->n - 1];}
+    // Last breakpoint <= x, kept within 0 .. n - 2
+    uint32_t i = 0;
+    if (axis->n <= CAL_SCAN_MAX_BP) {
+        while (i < (uint32_t)axis->n - 2 && axis->bp[i + 1] <= x) {i++;}
+    } else {
+        uint32_t right = axis->n - 2;
+        while (i < right) {
+            uint32_t mid = (i + right + 1) / 2;
+            if (axis->bp[mid] <= x) {
+                i = mid;
+            } else {
+                right = mid - 1;
+            }
+        }
+    }
+    *idx = i;
+    *frac = (int32_t)cal_div_q16((uint32_t)(x - axis->bp[i]), (uint32_t)(axis->bp[i + 1] - axis->bp[i]),
+                                 axis->bp_inv ? axis->bp_inv[i] : 0);
+}
+
+uint16_t cal_axis_bin(const cal_axis_t *axis, int32_t x) {
+    if (axis->bp == NULL) {
+        if (x <= axis->min) {return 0;}
+        uint32_t i = (uint32_t)(x - axis->min) / (uint32_t)axis->step;
+        return i < axis->n ? i : axis->n - 1;
+    }
+    if (x <= axis->bp[0]) {return 0;}
+    // Last breakpoint <= x
+    uint32_t left = 0, right = axis->n - 1;
+    while (left < right) {
+        uint32_t mid = (left + right + 1) / 2;
+        if (axis->bp[mid] <= x) {
+            left = mid;
+        } else {
+            right = mid - 1;
+        }
+    }
+    return left;
+}
+
+static inline int32_t lerp(int32_t a, int32_t b, int32_t frac) {
+    return a + (int32_t)(((int64_t)(b - a) * frac + (1 << (CAL_FRAC_SHIFT - 1))) >> CAL_FRAC_SHIFT); // Rounded
+}
+
+int32_t cal_table_1d(const cal_table_t *table, int32_t x0) {
+    uint32_t i0;
+    int32_t f0;
+    cal_axis_locate(table->axes[0], x0, &i0, &f0);
+    return lerp(table->data[i0], table->data[i0 + 1], f0);
+}
+
+int32_t cal_table_2d(const cal_table_t *table, int32_t x0, int32_t x1) {
+    uint32_t i0, i1;
+    int32_t f0, f1;
+    cal_axis_locate(table->axes[0], x0, &i0, &f0);
+    cal_axis_locate(table->axes[1], x1, &i1, &f1);
+    const uint32_t n1 = table->axes[1]->n;
+    const int32_t *row0 = &table->data[i0 * n1 + i1];
+    const int32_t *row1 = row0 + n1;
+    return lerp(lerp(row0[0], row0[1], f1), lerp(row1[0], row1[1], f1), f0);
+}
+
+int32_t cal_table_3d(const cal_table_t *table, int32_t x0, int32_t x1, int32_t x2) {
+    uint32_t i0, i1, i2;
+    int32_t f0, f1, f2;
+    cal_axis_locate(table->axes[0], x0, &i0, &f0);
+    cal_axis_locate(table->axes[1], x1, &i1, &f1);
+    cal_axis_locate(table->axes[2], x2, &i2, &f2);
+    const uint32_t n1 = table->axes[1]->n, n2 = table->axes[2]->n;
+    const int32_t *p00 = &table->data[(i0 * n1 + i1) * n2 + i2];
+    const int32_t *p01 = p00 + n2;              // i1 + 1
+    const int32_t *p10 = p00 + n1 * n2;         // i0 + 1
+    const int32_t *p11 = p10 + n2;
+    int32_t v0 = lerp(lerp(p00[0], p00[1], f2), lerp(p01[0], p01[1], f2), f1);
+    int32_t v1 = lerp(lerp(p10[0], p10[1], f2), lerp(p11[0], p11[1], f2), f1);
+    return lerp(v0, v1, f0);
+}
+
+bool cal_table_validate(const cal_table_t *table) {
+    bool ok = true;
+    for (uint8_t d = 0; d < table->dims; d++) {
+        const cal_axis_t *axis = table->axes[d];
+        if (axis->bp == NULL) {
+            continue; // Uniform, step > 0 checked when the axis is made (compile time or calib_parse())
+        }
+        for (uint16_t i = 1; i < axis->n; i++) {
+            if (axis->bp[i] <= axis->bp[i - 1]) {
+                ESP_LOGE(TAG, "Table %s axis %d: breakpoint %d (%" PRId32 ") not above the previous one (%" PRId32 ")",
+                         table->name, d, i, axis->bp[i], axis->bp[i - 1]);
+                ok = false;
+                break;
+            }
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,130 @@
+#ifndef __CAL_TABLE_H
+#define __CAL_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Calibration tables (1-D, 2-D, 3-D) with integer linear/bilinear/trilinear interpolation.
+// Inputs are clamped to the axis range. Uniform axes find their cell with index arithmetic;
+// axes with arbitrary breakpoints fall back to a linear scan up to CAL_SCAN_MAX_BP breakpoints (cheaper than
+// the search's bookkeeping at that size) and a binary search above, so lookup cost doesn't grow
+// (or grows logarithmically) with table resolution.
+//
+// Declare everything through the macros below; dimensions are checked at compile time:
+//   CAL_AXIS_UNIFORM(load, 0, 20, 6);                  // 0, 20, ..., 100
+//   CAL_AXIS_BP(rpm, 500, 1000, 2000, 3000);          // Breakpoints, strictly increasing
+//   CAL_TABLE_2D(map, rpm, load, { ... 4 x 6 values, row-major ... });
+// Each axis defines <name>_axis and the constant <name>_n; breakpoint axes also <name>_bp[].
+// Each table defines <name>_table. Breakpoint order is checked at compile time too (up to CAL_BP_MAX breakpoints
+// per axis); cal_table_validate() checks it at run time for tables that come from elsewhere (uploads).
+
+#define CAL_FRAC_SHIFT  16  // Cell fractions are Q16
+#define CAL_SCAN_MAX_BP 8   // Breakpoint axes up to this size are scanned linearly, larger ones binary-searched
+#define CAL_BP_MAX      16  // Breakpoints a CAL_AXIS_BP() axis can have
+
+// Over the CAL_AXIS_BP() arguments themselves (array elements aren't constant expressions): compile-time
+// "strictly increasing", and the cell widths' reciprocals
+#define CAL_BP_INC_2(a, b)       ((a) < (b))
+#define CAL_BP_INC_3(a, b, ...)  ((a) < (b) && CAL_BP_INC_2(b, __VA_ARGS__))
+#define CAL_BP_INC_4(a, b, ...)  ((a) < (b) && CAL_BP_INC_3(b, __VA_ARGS__))
+#define CAL_BP_INC_5(a, b, ...)  ((a) < (b) && CAL_BP_INC_4(b, __VA_ARGS__))
+#define CAL_BP_INC_6(a, b, ...)  ((a) < (b) && CAL_BP_INC_5(b, __VA_ARGS__))
+#define CAL_BP_INC_7(a, b, ...)  ((a) < (b) && CAL_BP_INC_6(b, __VA_ARGS__))
+#define CAL_BP_INC_8(a, b, ...)  ((a) < (b) && CAL_BP_INC_7(b, __VA_ARGS__))
+#define CAL_BP_INC_9(a, b, ...)  ((a) < (b) && CAL_BP_INC_8(b, __VA_ARGS__))
+#define CAL_BP_INC_10(a, b, ...) ((a) < (b) && CAL_BP_INC_9(b, __VA_ARGS__))
+#define CAL_BP_INC_11(a, b, ...) ((a) < (b) && CAL_BP_INC_10(b, __VA_ARGS__))
+#define CAL_BP_INC_12(a, b, ...) ((a) < (b) && CAL_BP_INC_11(b, __VA_ARGS__))
+#define CAL_BP_INC_13(a, b, ...) ((a) < (b) && CAL_BP_INC_12(b, __VA_ARGS__))
+#define CAL_BP_INC_14(a, b, ...) ((a) < (b) && CAL_BP_INC_13(b, __VA_ARGS__))
+#define CAL_BP_INC_15(a, b, ...) ((a) < (b) && CAL_BP_INC_14(b, __VA_ARGS__))
+#define CAL_BP_INC_16(a, b, ...) ((a) < (b) && CAL_BP_INC_15(b, __VA_ARGS__))
+#define CAL_BP_INV_2(a, b)       CAL_STEP_INV((b) - (a))
+#define CAL_BP_INV_3(a, b, ...)  CAL_STEP_INV((b) - (a)), CAL_BP_INV_2(b, __VA_ARGS__)
+#define CAL_BP_INV_4(a, b, ...)  CAL_STEP_INV((b) - (a)), CAL_BP_INV_3(b, __VA_ARGS__)
+#define CAL_BP_INV_5(a, b, ...)  CAL_STEP_INV((b) - (a)), CAL_BP_INV_4(b, __VA_ARGS__)
+#define CAL_BP_INV_6(a, b, ...)  CAL_STEP_INV((b) - (a)), CAL_BP_INV_5(b, __VA_ARGS__)
+#define CAL_BP_INV_7(a, b, ...)  CAL_STEP_INV((b) - (a)), CAL_BP_INV_6(b, __VA_ARGS__)
+#define CAL_BP_INV_8(a, b, ...)  CAL_STEP_INV((b) - (a)), CAL_BP_INV_7(b, __VA_ARGS__)
+#define CAL_BP_INV_9(a, b, ...)  CAL_STEP_INV((b) - (a)), CAL_BP_INV_8(b, __VA_ARGS__)
+#define CAL_BP_INV_10(a, b, ...) CAL_STEP_INV((b) - (a)), CAL_BP_INV_9(b, __VA_ARGS__)
+#define CAL_BP_INV_11(a, b, ...) CAL_STEP_INV((b) - (a)), CAL_BP_INV_10(b, __VA_ARGS__)
+#define CAL_BP_INV_12(a, b, ...) CAL_STEP_INV((b) - (a)), CAL_BP_INV_11(b, __VA_ARGS__)
+#define CAL_BP_INV_13(a, b, ...) CAL_STEP_INV((b) - (a)), CAL_BP_INV_12(b, __VA_ARGS__)
+#define CAL_BP_INV_14(a, b, ...) CAL_STEP_INV((b) - (a)), CAL_BP_INV_13(b, __VA_ARGS__)
+#define CAL_BP_INV_15(a, b, ...) CAL_STEP_INV((b) - (a)), CAL_BP_INV_14(b, __VA_ARGS__)
+#define CAL_BP_INV_16(a, b, ...) CAL_STEP_INV((b) - (a)), CAL_BP_INV_15(b, __VA_ARGS__)
+#define CAL_BP_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, n, ...) n
+#define CAL_BP_NARGS(...) CAL_BP_NARGS_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define CAL_BP_CAT_(a, b) a##b
+#define CAL_BP_CAT(a, b) CAL_BP_CAT_(a, b)
+#define CAL_BP_INCREASING(...) CAL_BP_CAT(CAL_BP_INC_, CAL_BP_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define CAL_BP_INVS(...) CAL_BP_CAT(CAL_BP_INV_, CAL_BP_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+typedef struct cal_axis_t {
+    const int32_t *bp;      // Breakpoints, NULL for a uniform axis
+    uint16_t n;             // Number of breakpoints (>= 2)
+    int32_t min;            // First breakpoint
+    int32_t step;           // Uniform axes only
+    uint32_t step_inv;      // Uniform axes only, CAL_STEP_INV(step): the lookup multiplies instead of dividing
+    const uint32_t *bp_inv; // Breakpoint axes, CAL_STEP_INV() of each cell's width; NULL (uploaded tables) = divide
+} cal_axis_t;
+
+// ceil(2^31 / step), 0 (divide) for a step that isn't positive
+#define CAL_STEP_INV(step) ((step) > 0 ? (uint32_t)(((1ULL << 31) + (uint32_t)(step) - 1) / (uint32_t)(step)) : 0)
+
+typedef struct cal_table_t {
+    const char *name;
+    uint8_t dims;
+    const cal_axis_t *axes[3];  // Outermost first: data index is ((i0 * n1) + i1) * n2 + i2
+    const int32_t *data;
+} cal_table_t;
+
+#define CAL_AXIS_UNIFORM(name, min_, step_, n_)                                                     \
+    enum { name##_n = (n_) };                                                                       \
+    _Static_assert((n_) >= 2 && (step_) > 0, "cal axis " #name ": needs >= 2 points and step > 0");  \
+    static const cal_axis_t name##_axis = {.bp = NULL, .n = (n_), .min = (min_), .step = (step_), \
+                                          .step_inv = CAL_STEP_INV(step_)}
+
+#define CAL_AXIS_BP(name, ...)                                                                      \
+    static const int32_t name##_bp[] = {__VA_ARGS__};                                               \
+    enum { name##_n = sizeof(name##_bp) / sizeof(name##_bp[0]) };                                   \
+    _Static_assert(name##_n >= 2 && name##_n <= CAL_BP_MAX, "cal axis " #name ": needs 2-16 breakpoints"); \
+    _Static_assert(CAL_BP_INCREASING(__VA_ARGS__), "cal axis " #name ": breakpoints not strictly increasing"); \
+    static const uint32_t name##_bp_inv[] = {CAL_BP_INVS(__VA_ARGS__)};                             \
+    static const cal_axis_t name##_axis = {.bp = name##_bp, .n = name##_n, .min = 0, .step = 0,     \
+                                           .step_inv = 0, .bp_inv = name##_bp_inv}
+
+#define CAL_TABLE_1D(name, a0, ...)                                                                 \
+    static const int32_t name##_data[] = __VA_ARGS__;                                               \
+    _Static_assert(sizeof(name##_data) / sizeof(int32_t) == a0##_n,                                 \
+                   "cal table " #name ": size doesn't match " #a0);                                 \
+    static const cal_table_t name##_table = {#name, 1, {&a0##_axis, NULL, NULL}, name##_data}
+
+#define CAL_TABLE_2D(name, a0, a1, ...)                                                             \
+    static const int32_t name##_data[] = __VA_ARGS__;                                               \
+    _Static_assert(sizeof(name##_data) / sizeof(int32_t) == a0##_n * a1##_n,                        \
+                   "cal table " #name ": size doesn't match " #a0 " x " #a1);                       \
+    static const cal_table_t name##_table = {#name, 2, {&a0##_axis, &a1##_axis, NULL}, name##_data}
+
+#define CAL_TABLE_3D(name, a0, a1, a2, ...)                                                         \
+    static const int32_t name##_data[] = __VA_ARGS__;                                               \
+    _Static_assert(sizeof(name##_data) / sizeof(int32_t) == a0##_n * a1##_n * a2##_n,               \
+                   "cal table " #name ": size doesn't match " #a0 " x " #a1 " x " #a2);             \
+    static const cal_table_t name##_table = {#name, 3, {&a0##_axis, &a1##_axis, &a2##_axis}, name##_data}
+
+int32_t cal_table_1d(const cal_table_t *table, int32_t x0);
+
+int32_t cal_table_2d(const cal_table_t *table, int32_t x0, int32_t x1);
+
+int32_t cal_table_3d(const cal_table_t *table, int32_t x0, int32_t x1, int32_t x2);
+
+// Bin of x when the axis is used for binning rather than interpolation: bin i covers [bp[i], bp[i + 1]),
+// the first one also everything below and the last one everything from bp[n - 1] up (0 .. n - 1)
+uint16_t cal_axis_bin(const cal_axis_t *axis, int32_t x);
+
+// Checks the breakpoints are strictly increasing, logs and returns false if not
+bool cal_table_validate(const cal_table_t *table);
+
+#endif
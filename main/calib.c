@@ -0,0 +1,312 @@
+#include "calib.h"
+#include "phys_const.h"
+#include "flash_guard.h"
+
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "calib";
+
+static const char *const calib_names[CALIB_N_IDS] = {
+    [CALIB_MAP] = "map",
+};
+static const uint8_t calib_dims[CALIB_N_IDS] = {
+    [CALIB_MAP] = 2,
+};
+
+typedef struct calib_set_t {
+    int8_t half;                                // -1 = built-in
+    uint32_t seq;
+    const void *base;                           // Mapped half
+    esp_partition_mmap_handle_t mmap_handle;
+    bool mapped;
+    uint16_t n_tables;
+    cal_axis_t axes[CALIB_MAX_TABLES][3];       // Point into the mapping, only these descriptors live in DRAM
+    cal_table_t tables[CALIB_MAX_TABLES];
+    char names[CALIB_MAX_TABLES][CALIB_NAME_LEN + 1];
+    const cal_table_t *by_id[CALIB_N_IDS];
+} calib_set_t;
+
+static const esp_partition_t *calib_part = NULL;
+static size_t half_size = 0;
+static calib_set_t builtin_set;
+static calib_set_t flash_sets[2];
+static _Atomic(calib_set_t *) active_set = NULL;
+static _Atomic uint32_t readers = 0;            // Lookups in progress, the writer waits for 0 before unmapping
+
+// Update in progress (HTTP server task only)
+static struct {
+    bool open;
+    int8_t half;
+    size_t length;
+    size_t written;
+    calib_hdr_t hdr;
+} update;
+
+/* Parsing */
+
+// Builds the table descriptors of a mapped set, all pointers go into the mapping
+static bool calib_parse(calib_set_t *set, const uint8_t *base, size_t size, char *msg, size_t msg_len) {
+    const calib_hdr_t *hdr = (const calib_hdr_t *)base;
+    if (hdr->magic != CALIB_MAGIC || hdr->version != CALIB_VERSION) {
+        snprintf(msg, msg_len, "bad magic/version"); return false;
+    }
+    if (hdr->length < sizeof(calib_hdr_t) || hdr->length > size || hdr->n_tables == 0 || hdr->n_tables > CALIB_MAX_TABLES) {
+        snprintf(msg, msg_len, "bad length/table count"); return false;
+    }
+    if (esp_rom_crc32_le(0, base + sizeof(calib_hdr_t), hdr->length - sizeof(calib_hdr_t)) != hdr->crc32) {
+        snprintf(msg, msg_len, "CRC mismatch"); return false;
+    }
+
+    size_t off = sizeof(calib_hdr_t);
+    for (uint16_t t = 0; t < hdr->n_tables; t++) {
+        if (off + sizeof(calib_rec_t) > hdr->length) {
+            snprintf(msg, msg_len, "table %d truncated", t); return false;
+        }
+        const calib_rec_t *rec = (const calib_rec_t *)(base + off);
+        off += sizeof(calib_rec_t);
+        if (rec->dims < 1 || rec->dims > 3) {
+            snprintf(msg, msg_len, "table %d: bad dims", t); return false;
+        }
+        // uint64_t: three uint16_t axes overflow the 32-bit size_t, and a wrapped size would pass the bounds check
+        uint64_t cells = 1;
+        for (uint8_t d = 0; d < rec->dims; d++) {
+            cal_axis_t *axis = &set->axes[t][d];
+            if (rec->n[d] < 2 || rec->n[d] > CALIB_MAX_AXIS_POINTS) {
+                snprintf(msg, msg_len, "table %d axis %d: must have 2-%d points", t, d, CALIB_MAX_AXIS_POINTS); return false;
+            }
+            axis->n = rec->n[d];
+            size_t axis_len = (rec->uniform_mask & (1 << d)) ? 2 * sizeof(int32_t) : rec->n[d] * sizeof(int32_t);
+            if (off + axis_len > hdr->length) {
+                snprintf(msg, msg_len, "table %d axis %d truncated", t, d); return false;
+            }
+            const int32_t *p = (const int32_t *)(base + off);
+            if (rec->uniform_mask & (1 << d)) {
+                axis->bp = NULL;
+                axis->min = p[0];
+                axis->step = p[1];
+                if (axis->step <= 0) {
+                    snprintf(msg, msg_len, "table %d axis %d: step <= 0", t, d); return false;
+                }
+                if ((int64_t)axis->min + (int64_t)axis->step * (rec->n[d] - 1) > INT32_MAX) { // The lookup's last breakpoint
+                    snprintf(msg, msg_len, "table %d axis %d: last point beyond int32", t, d); return false;
+                }
+                axis->step_inv = CAL_STEP_INV(axis->step);
+                axis->bp_inv = NULL;
+            } else {
+                axis->bp = p;
+                axis->min = 0;
+                axis->step = 0;
+                axis->step_inv = 0;
+                axis->bp_inv = NULL; // Would need DRAM per cell, uploaded breakpoint axes divide
+            }
+            off += axis_len;
+            cells *= rec->n[d];
+        }
+        if (cells > (hdr->length - off) / sizeof(int32_t)) {
+            snprintf(msg, msg_len, "table %d data truncated", t); return false;
+        }
+        memcpy(set->names[t], rec->name, CALIB_NAME_LEN);
+        set->names[t][CALIB_NAME_LEN] = '\0';
+        set->tables[t] = (cal_table_t){
+            .name = set->names[t],
+            .dims = rec->dims,
+            .axes = {&set->axes[t][0], rec->dims > 1 ? &set->axes[t][1] : NULL, rec->dims > 2 ? &set->axes[t][2] : NULL},
+            .data = (const int32_t *)(base + off)
+        };
+        off += (size_t)cells * sizeof(int32_t);
+        if (!cal_table_validate(&set->tables[t])) {
+            snprintf(msg, msg_len, "table %s: breakpoints not increasing", set->names[t]); return false;
+        }
+    }
+    set->n_tables = hdr->n_tables;
+    set->seq = hdr->seq;
+
+    // Tables the firmware knows about, anything not in the set keeps using the built-in one
+    for (size_t id = 0; id < CALIB_N_IDS; id++) {
+        set->by_id[id] = builtin_set.by_id[id];
+        for (uint16_t t = 0; t < set->n_tables; t++) {
+            if (strcmp(set->names[t], calib_names[id]) == 0) {
+                if (set->tables[t].dims != calib_dims[id]) {
+                    snprintf(msg, msg_len, "table %s must be %d-D", calib_names[id], calib_dims[id]); return false;
+                }
+                set->by_id[id] = &set->tables[t];
+            }
+        }
+    }
+    return true;
+}
+
+static void calib_unmap(calib_set_t *set) {
+    if (set->mapped) {
+        esp_partition_munmap(set->mmap_handle);
+        set->mapped = false;
+    }
+}
+
+static bool calib_map_half(int8_t half, char *msg, size_t msg_len) {
+    calib_set_t *set = &flash_sets[half];
+    calib_unmap(set);
+    set->half = half;
+    esp_err_t err = esp_partition_mmap(calib_part, half * half_size, half_size, ESP_PARTITION_MMAP_DATA, &set->base, &set->mmap_handle);
+    if (err != ESP_OK) {
+        snprintf(msg, msg_len, "mmap failed (%s)", esp_err_to_name(err));
+        return false;
+    }
+    set->mapped = true;
+    if (!calib_parse(set, set->base, half_size, msg, msg_len)) {
+        calib_unmap(set);
+        return false;
+    }
+    return true;
+}
+
+// Publishes a set; the old one is unmapped once no lookup can still be using it
+static void calib_swap(calib_set_t *set) {
+    calib_set_t *old = atomic_exchange(&active_set, set);
+    while (atomic_load(&readers) != 0) {
+        vTaskDelay(1);
+    }
+    if (old && old != set && old != &builtin_set) {
+        calib_unmap(old);
+    }
+}
+
+/* Init */
+
+void calib_init(void) {
+    builtin_set.half = -1;
+    builtin_set.by_id[CALIB_MAP] = &map_table;
+    cal_table_validate(&map_table);
+    atomic_store(&active_set, &builtin_set);
+
+    calib_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)CALIB_PARTITION_SUBTYPE, "calib");
+    if (calib_part == NULL) {
+        ESP_LOGW(TAG, "No calib partition, using built-in tables");
+        return;
+    }
+    half_size = calib_part->size / 2;
+
+    char msg[64];
+    calib_set_t *best = NULL;
+    for (int8_t half = 0; half < 2; half++) {
+        if (calib_map_half(half, msg, sizeof(msg))) {
+            ESP_LOGI(TAG, "Half %d: %d tables, seq %lu", half, flash_sets[half].n_tables, flash_sets[half].seq);
+            if (best == NULL || flash_sets[half].seq > best->seq) {
+                best = &flash_sets[half];
+            }
+        } else {
+            ESP_LOGI(TAG, "Half %d not usable: %s", half, msg);
+        }
+    }
+    for (int8_t half = 0; half < 2; half++) {
+        if (&flash_sets[half] != best) {
+            calib_unmap(&flash_sets[half]);
+        }
+    }
+    if (best) {
+        atomic_store(&active_set, best);
+        ESP_LOGI(TAG, "Using calibration half %d (seq %lu)", best->half, best->seq);
+    } else {
+        ESP_LOGI(TAG, "Using built-in tables");
+    }
+}
+
+/* Lookups */
+
+const cal_table_t *calib_table_acquire(calib_id_t id) {
+    atomic_fetch_add(&readers, 1); // Before loading the pointer, so a swap waits for us
+    calib_set_t *set = atomic_load(&active_set);
+    return set->by_id[id];
+}
+
+void calib_table_release(void) {
+    atomic_fetch_sub(&readers, 1);
+}
+
+/* Update */
+
+esp_err_t calib_update_begin(size_t length) {
+    if (calib_part == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (length <= sizeof(calib_hdr_t) || length > half_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    calib_set_t *active = atomic_load(&active_set);
+    update.half = active->half == 0 ? 1 : 0;
+    update.length = length;
+    update.written = 0;
+    calib_unmap(&flash_sets[update.half]); // Not active, nothing can be reading it
+
+    flash_op_begin();
+    esp_err_t err = esp_partition_erase_range(calib_part, update.half * half_size, half_size);
+    flash_op_end();
+    update.open = err == ESP_OK;
+    return err;
+}
+
+esp_err_t calib_update_write(const void *data, size_t len) {
+    if (!update.open || update.written + len > update.length) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const uint8_t *bytes = data;
+    // The header is kept in RAM and written last, so a torn upload never looks valid
+    if (update.written < sizeof(calib_hdr_t)) {
+        size_t n = sizeof(calib_hdr_t) - update.written;
+        if (n > len) {n = len;}
+        memcpy((uint8_t *)&update.hdr + update.written, bytes, n);
+        update.written += n;
+        bytes += n;
+        len -= n;
+    }
+    if (len == 0) {
+        return ESP_OK;
+    }
+    flash_op_begin();
+    esp_err_t err = esp_partition_write(calib_part, update.half * half_size + update.written, bytes, len);
+    flash_op_end();
+    update.written += len;
+    return err;
+}
+
+esp_err_t calib_update_commit(char *msg, size_t msg_len) {
+    if (!update.open || update.written != update.length) {
+        snprintf(msg, msg_len, "incomplete upload");
+        calib_update_abort();
+        return ESP_ERR_INVALID_STATE;
+    }
+    update.open = false;
+    if (update.hdr.length != update.length) {
+        snprintf(msg, msg_len, "header length %lu != upload %u", update.hdr.length, update.length);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    calib_set_t *active = atomic_load(&active_set);
+    update.hdr.seq = active->seq + 1;
+    flash_op_begin();
+    esp_err_t err = esp_partition_write(calib_part, update.half * half_size, &update.hdr, sizeof(calib_hdr_t));
+    flash_op_end();
+    if (err != ESP_OK) {
+        snprintf(msg, msg_len, "header write failed (%s)", esp_err_to_name(err));
+        return err;
+    }
+
+    // Verify through the mapping the lookups will use
+    if (!calib_map_half(update.half, msg, msg_len)) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    calib_swap(&flash_sets[update.half]);
+    snprintf(msg, msg_len, "half %d active, seq %lu, %d tables", update.half, update.hdr.seq, flash_sets[update.half].n_tables);
+    ESP_LOGI(TAG, "Calibration updated: %s", msg);
+    return ESP_OK;
+}
+
+void calib_update_abort(void) {
+    update.open = false;
+}
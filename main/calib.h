@@ -0,0 +1,74 @@
+#ifndef __CALIB_H
+#define __CALIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "cal_table.h"
+
+// Calibration tables from the "calib" flash partition, memory-mapped (zero copy, no DRAM for the table data).
+// The partition is split into two halves (A/B). Uploads go to the inactive half and are swapped in atomically;
+// lookups stay lock-free throughout. Until a valid set is uploaded, the tables built into phys_const.h are used.
+//
+// Binary format (little-endian, all table fields 4-byte aligned):
+//   calib_hdr_t, then n_tables records of:
+//     calib_rec_t
+//     per axis d < dims: uniform (bit d of uniform_mask): int32 min, int32 step
+//                        otherwise:                       int32 breakpoints[n[d]]
+//     int32 data[n[0] * n[1] * n[2]], row-major, outermost axis first (unused n[] = 1)
+// The header is written last (commit marker) with the firmware's own sequence number; crc32 (esp_rom_crc32_le, zlib
+// compatible) covers everything after the header.
+
+#define CALIB_PARTITION_SUBTYPE 0x40        // Matches partitions.csv
+#define CALIB_MAGIC             0x424C4143  // "CALB"
+#define CALIB_VERSION           1
+#define CALIB_MAX_TABLES        8           // Per set
+#define CALIB_NAME_LEN          8
+#define CALIB_MAX_AXIS_POINTS   256         // Per axis, uploads with more are rejected
+
+typedef struct __attribute__((packed)) calib_hdr_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t n_tables;
+    uint32_t seq;           // Set by the firmware on commit, the valid half with the highest seq wins at boot
+    uint32_t length;        // [B] Whole set, header included
+    uint32_t crc32;         // Of the bytes after the header
+    uint8_t reserved[12];
+} calib_hdr_t;
+
+typedef struct __attribute__((packed)) calib_rec_t {
+    char name[CALIB_NAME_LEN];  // NUL-padded
+    uint8_t dims;               // 1 .. 3
+    uint8_t uniform_mask;
+    uint16_t n[3];              // Points per axis, 2 .. CALIB_MAX_AXIS_POINTS; uniform axes must end within int32
+} calib_rec_t;
+
+_Static_assert(sizeof(calib_hdr_t) % 4 == 0 && sizeof(calib_rec_t) % 4 == 0, "calib records must keep int32 alignment");
+
+// Tables the firmware looks up
+typedef enum calib_id_t {
+    CALIB_MAP,              // [Pa] MAP over RPM x load [%]
+    CALIB_N_IDS
+} calib_id_t;
+
+// Picks the newest valid half (or the built-in tables)
+void calib_init(void);
+
+// Lock-free lookup: hold the table between acquire and release, never across a blocking call
+const cal_table_t *calib_table_acquire(calib_id_t id);
+
+void calib_table_release(void);
+
+// Streaming update into the inactive half, from the HTTP server task
+esp_err_t calib_update_begin(size_t length);
+
+esp_err_t calib_update_write(const void *data, size_t len);
+
+// Verifies, commits and swaps in the new set. On failure the active set is left untouched
+esp_err_t calib_update_commit(char *msg, size_t msg_len);
+
+void calib_update_abort(void);
+
+#endif
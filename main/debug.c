@@ -37,4 +37,64 @@ void timer_stop(const char *label) {
     ESP_LOGI(label, "elapsed: %lld.%02lld ms",
              ms_hundredths / 100,   // integer
              ms_hundredths % 100); // fraction
-}
\ No newline at end of file
+}
+
+#ifdef FUEL_KERNEL_BENCHMARK
+// Per-pulse cost of both fuel kernels in CPU cycles, and how far apart they are, over the whole pulse width range
+void fuel_kernel_benchmark(void) {
+    static const char *BTAG = "fuel_kernel";
+    static const uint32_t baro[] = {52000, 80000, 100000, 105000};    // [Pa]
+    static const uint32_t map[] = {30000, 60000, 100000};             // [Pa]
+    const uint32_t max_width = 100000;                                 // [us]
+    const uint32_t step = 7;                                           // [us] Odd step so both regions and all residues get hit
+
+    double max_abs_err = 0;     // [uL]
+    double max_rel_err = 0;     // [-] Pulses > 0.1 uL only, below that the Q16 LSB dominates
+    uint64_t cycles_double = 0, cycles_fixed = 0, cycles_lut = 0;
+    uint32_t n = 0;
+    volatile double sink_double = 0;   // Keep the calls from being optimised away
+    volatile uint32_t sink_fixed = 0;
+    volatile uint32_t sink_lut = 0;
+    static fuel_model_t model;  // Built-in profile
+    engine_profile_t profile;
+    engine_profile_default(&profile);
+    fuel_model_init(&model, &profile);
+
+    for (size_t b = 0; b < sizeof(baro) / sizeof(baro[0]); b++) {
+        for (size_t m = 0; m < sizeof(map) / sizeof(map[0]); m++) {
+            fuel_kernel_t kernel;
+            fuel_kernel_init(&kernel, &model, baro[b], map[m]);
+            for (uint32_t w = 0; w <= max_width; w += step) {
+                uint32_t t0 = esp_cpu_get_cycle_count();
+                double ref = fuel_pulse_double(&kernel, w);
+                uint32_t t1 = esp_cpu_get_cycle_count();
+                uint32_t fx = fuel_pulse_q16(&kernel, w);
+                uint32_t t2 = esp_cpu_get_cycle_count();
+                uint32_t eff = fuel_eff_q8(&model, w); // The period's coefficient multiply isn't per pulse
+                uint32_t t3 = esp_cpu_get_cycle_count();
+                cycles_double += t1 - t0;
+                cycles_fixed += t2 - t1;
+                cycles_lut += t3 - t2;
+                sink_double = ref;
+                sink_fixed = fx;
+                sink_lut = eff;
+                n++;
+
+                double err = ref - (double)fx / FUEL_Q16_ONE;
+                if (err < 0) {err = -err;}
+                if (err > max_abs_err) {max_abs_err = err;}
+                if (ref > 0.1 && err / ref > max_rel_err) {max_rel_err = err / ref;}
+            }
+        }
+        vTaskDelay(1); // Let the idle task feed the watchdog
+    }
+    (void)sink_double;
+    (void)sink_fixed;
+    (void)sink_lut;
+
+    const fuel_lut_info_t *lut = fuel_lut_info();
+    ESP_LOGI(BTAG, "%lu pulses: double %llu, fixed %llu, LUT %llu cycles/pulse", n, cycles_double / n, cycles_fixed / n, cycles_lut / n);
+    ESP_LOGI(BTAG, "fixed max error: %.6f uL abs, %.4f%% rel", max_abs_err, max_rel_err * 100);
+    ESP_LOGI(BTAG, "LUT (%lu us step, %d B) max error: %.6f uL abs, %.4f%% rel", FUEL_LUT_STEP_US, (int)(model.lut_n * sizeof(model.lut_q8[0])), lut->max_err_ul, lut->max_err_pct);
+}
+#endif
@@ -6,6 +6,11 @@
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "esp_random.h"
+#include "esp_cpu.h"
+#include "fuel_kernel.h"
+#include "phys_const.h"
+
+// #define FUEL_KERNEL_BENCHMARK // uncomment to benchmark/compare the fuel kernels at boot (results in the log)
 
 void monitor_server_handle_task(void *arg);
 
@@ -15,4 +20,8 @@ void timer_start(const char *label);
 
 void timer_stop(const char *label);
 
+#ifdef FUEL_KERNEL_BENCHMARK
+void fuel_kernel_benchmark(void);
+#endif
+
 #endif
\ No newline at end of file
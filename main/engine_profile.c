@@ -0,0 +1,47 @@
+#include "engine_profile.h"
+#include "fuel_kernel.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void engine_profile_default(engine_profile_t *profile) {
+    memset(profile, 0, sizeof(engine_profile_t));
+    strncpy(profile->name, "Z12XEP", PROFILE_NAME_LEN - 1);
+    profile->n_cyl = N_CYL;
+    profile->rail_pressure = FUEL_RAIL_PRESSURE;
+    profile->static_flow_pressure = STATIC_FLOW_PRESSURE;
+    profile->static_flow_ml_min = STATIC_FLOW_RATE_ML_MIN;
+    profile->deadtime = INJECTOR_DEADTIME;
+    profile->full_opening_time = INJECTOR_FULL_OPENING_TIME;
+    profile->full_closing_time = INJECTOR_FULL_CLOSING_TIME;
+    profile->reset_time = INJECTOR_RESET_TIME;
+}
+
+bool engine_profile_validate(const engine_profile_t *profile, char *msg, size_t msg_len) {
+    if (profile->name[0] == '\0' || memchr(profile->name, '\0', PROFILE_NAME_LEN) == NULL) {
+        snprintf(msg, msg_len, "name must be 1-%d characters", PROFILE_NAME_LEN - 1); return false;
+    }
+    if (profile->n_cyl < 1 || profile->n_cyl > PROFILE_MAX_CYL) {
+        snprintf(msg, msg_len, "cylinders must be 1-%d", PROFILE_MAX_CYL); return false;
+    }
+    // Pressure across the injector is rail + ambient - MAP, must stay positive for any MAP
+    if (profile->rail_pressure < 100000 || profile->rail_pressure > 1000000) {
+        snprintf(msg, msg_len, "rail pressure must be 1-10 bar"); return false;
+    }
+    if (profile->static_flow_pressure < 100000 || profile->static_flow_pressure > 1000000) {
+        snprintf(msg, msg_len, "flow test pressure must be 1-10 bar"); return false;
+    }
+    if (!(profile->static_flow_ml_min >= 10 && profile->static_flow_ml_min <= 2000)) {
+        snprintf(msg, msg_len, "static flow must be 10-2000 mL/min"); return false;
+    }
+    if (profile->full_opening_time <= profile->deadtime) {
+        snprintf(msg, msg_len, "full opening time must be longer than deadtime"); return false;
+    }
+    if (profile->full_opening_time - profile->deadtime > FUEL_LUT_MAX_RAMP_US) {
+        snprintf(msg, msg_len, "ramp-up (opening - deadtime) must be <= %d us", FUEL_LUT_MAX_RAMP_US); return false;
+    }
+    if (profile->full_closing_time > 5000 || profile->reset_time > 20000) {
+        snprintf(msg, msg_len, "closing time must be <= 5000 us, reset time <= 20000 us"); return false;
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef __ENGINE_PROFILE_H
+#define __ENGINE_PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "phys_const.h"
+
+// Engine/injector profile: the constants the fuel model needs, so one build can run on more than one car.
+// Profiles are stored in NVS (PROFILE_SLOTS of them) and selected/tuned over the WebSocket; the phys_const.h values
+// are the built-in default. fuel_model_init() derives everything the per-pulse path needs once per profile load.
+
+#define PROFILE_SLOTS       4       // Profiles stored in NVS, slot 0 falls back to the built-in default while empty
+#define PROFILE_NAME_LEN    16      // Including the terminating NUL
+#define PROFILE_MAX_CYL     12
+
+typedef struct engine_profile_t {
+    char name[PROFILE_NAME_LEN];
+    uint8_t n_cyl;                  // [-]
+    uint32_t rail_pressure;         // [Pa] Manometric fuel rail pressure
+    uint32_t static_flow_pressure;  // [Pa] Pressure across the injector the static flow rate was measured at
+    float static_flow_ml_min;       // [mL/min]
+    uint16_t deadtime;              // [us] Pulse start -> non-zero fuel flow
+    uint16_t full_opening_time;     // [us] Pulse start -> needle fully open
+    uint16_t full_closing_time;     // [us] Pulse end -> needle fully closed
+    uint16_t reset_time;            // [us] Minimum time between spray events
+} engine_profile_t;
+
+// Built-in profile from phys_const.h
+void engine_profile_default(engine_profile_t *profile);
+
+// Range/consistency checks, msg gets the reason on failure
+bool engine_profile_validate(const engine_profile_t *profile, char *msg, size_t msg_len);
+
+#endif
@@ -0,0 +1,24 @@
+#include "flash_guard.h"
+
+static flash_guard_t flash_guard = {0};
+
+void flash_op_begin(void) {
+    atomic_fetch_add(&flash_guard.active, 1);
+    atomic_fetch_add(&flash_guard.seq, 1);
+}
+
+void flash_op_end(void) {
+    atomic_fetch_sub(&flash_guard.active, 1);
+}
+
+flash_guard_mark_t flash_guard_mark(void) {
+    flash_guard_mark_t mark = {
+        .seq = atomic_load(&flash_guard.seq),
+        .active = atomic_load(&flash_guard.active) > 0
+    };
+    return mark;
+}
+
+bool flash_guard_overlapped(const flash_guard_mark_t *since) {
+    return since->active || atomic_load(&flash_guard.seq) != since->seq || atomic_load(&flash_guard.active) > 0;
+}
@@ -0,0 +1,32 @@
+#ifndef __FLASH_GUARD_H
+#define __FLASH_GUARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Marks our own flash operations (NVS commits, SPIFFS reads), during which the flash cache is disabled
+// and only IRAM code with DRAM data keeps running. The capture path is built to survive that; this lets
+// fuel_meter_task tell which 600 ms periods overlapped such a window so their totals can be checked.
+
+typedef struct flash_guard_t {
+    _Atomic uint32_t seq;       // Incremented at the start of every operation
+    _Atomic uint32_t active;    // Operations in progress
+} flash_guard_t;
+
+// Snapshot taken at the start of a period
+typedef struct flash_guard_mark_t {
+    uint32_t seq;
+    bool active;
+} flash_guard_mark_t;
+
+void flash_op_begin(void);
+
+void flash_op_end(void);
+
+flash_guard_mark_t flash_guard_mark(void);
+
+// True if a flash operation was running at 'since', started after it, or is running now
+bool flash_guard_overlapped(const flash_guard_mark_t *since);
+
+#endif
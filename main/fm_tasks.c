@@ -1,14 +1,23 @@
 #include "fm_tasks.h"
 #include <sys/time.h>
 
-static portMUX_TYPE pulse_spinlock = portMUX_INITIALIZER_UNLOCKED;
-static volatile uint16_t pulse_count_isr = 0;
-static uint32_t pulse_buffer[MAX_PULSES];
+_Static_assert(N_INJ_CHANNELS >= 1 && N_CYL % N_INJ_CHANNELS == 0, "N_INJ_CHANNELS must divide N_CYL"); // Built-in profile, others are checked on load
+_Static_assert(N_INJ_CHANNELS <= FUEL_INT_MAX_CHANNELS, "fuel integrator keeps totals for FUEL_INT_MAX_CHANNELS channels");
+
+static injector_channel_t inj_channels[N_INJ_CHANNELS] = {0}; // Injector capture channels
+static inj_rpm_t inj_rpm = {0};             // RPM estimated from injection spacing (channel 0)
+static uint32_t period_drain_us = 0;        // [us] When the channels were drained, the estimate's reference time
+#ifdef INJECTOR_ISR_PROFILE
+static isr_prof_t isr_prof_dur = {0};       // ISR entry -> exit
+static isr_prof_t isr_prof_stamp = {0};     // ISR entry -> timestamp taken, i.e. how much our own code delays the edge time
+#endif
 
 EventGroupHandle_t startup_event_group = NULL;
 TaskHandle_t fuel_meter_task_handle = NULL;
 TaskHandle_t current_page_task_handle = NULL;
 TaskHandle_t display_task_handle = NULL;
+TaskHandle_t scope_task_handle = NULL;
+TaskHandle_t fuel_integrator_task_handle = NULL;
 
 
 extern bool kwp_init_success;
@@ -18,7 +27,29 @@ SemaphoreHandle_t fuel_data_mutex = NULL;          // Protects fuel_meter_task a
 static fuel_stats_t stats = {0};                // Stores runtime fuel statistics
 static uint16_t local_pulse_count = 0;         // Stores the pulse count accumulated every 600 ms
 static uint64_t avg_pulse_width = 0;          // Stores the average pulse width calculated every 600 ms
+static uint32_t ring_overflow = 0;           // Pulses dropped by the ISR because the ring was full (since boot)
+static uint16_t ring_high_water = 0;        // Max pulse ring fill level (since boot)
+static uint16_t inj_rpm_last = 0;           // Last valid injector-derived RPM, 0 if the estimate isn't usable
+static pw_stats_t pw_stats;                 // Pulse width distributions per RPM band (per period and since boot)
+static uint16_t recon_pulse_count = 0;      // Injections reconciled in the last period
+static uint8_t recon_confidence = 100;      // [%] Share of the last period's injections that were actually captured
+static volatile int scope_fps = SCOPE_DEFAULT_FPS; // [frames/s] Raw pulse stream frame rate
+static uint32_t lost_edges = 0;             // Pulses lost to missed edges (since boot)
+static uint16_t flash_periods = 0;          // Periods that overlapped one of our flash operations (since boot)
+static uint32_t flash_lost_edges = 0;       // Pulses lost to missed edges during those periods (since boot)
+static uint32_t period_us = FUEL_PERIOD_MS * 1000; // [us] Measured length of the last period
+static uint32_t kwp_us = 0;                 // [us] Time the last period's KWP requests took
+static uint16_t loop_overruns = 0;          // Periods whose work ran past the next wake time (since boot)
+static uint16_t late_wakeups = 0;           // Wakeups at least FUEL_LATE_WAKE_MS late (since boot)
+static car_data_time_t car_data_time = {0}; // When each PID in car_data was last read
+static fuel_hist_t fuel_hist;               // Fuel/distance history at 600 ms to 1 h resolution, protected by fuel_data_mutex
+static fuel_model_t fuel_model;             // Derived from the active engine profile, fuel_meter_task only
+static fuel_model_t fuel_model_pending;     // Next period's model, protected by fuel_data_mutex
+static bool fuel_model_changed = false;     // fuel_model_pending is waiting to be applied
+static engine_profile_t engine_profile;     // Profile of the newest model (pending if there is one), protected by fuel_data_mutex
+static uint8_t cyl_per_channel = N_CYL / N_INJ_CHANNELS; // Cylinders each measured injector stands in for
 static comms_data_pack_t car_data = {0};     // Stores the retrieved data from KWP comms, accessed by multiple tasks
+static kwp_timing_data_pack_t kwp_timing = {0}; // Bus timing and latency after the last KWP requests, protected by fuel_data_mutex
 static bmp280_data_t bmp280_data = {0};     // Stores BMP280 measurements
 
 char currently_open_page[32] = {0};       // used to indicate which type of packet to prepare & send
@@ -30,27 +61,59 @@ static bool responsive_bmp = false;   // Flag to show whether the BMP280 is resp
 
 static const char *TAG = "fm_tasks";
 
-// ISR handler for both edges
-static void IRAM_ATTR injector_isr_handler(void* arg) {
-    static volatile uint64_t fall_time_us = 0;
-    int level = gpio_get_level(INJECTOR_PIN);
-    uint64_t now = esp_timer_get_time();
+// Both edges, arg is the channel the pin belongs to. Inlined into two handlers so that the scope copy
+// costs nothing unless someone is streaming; set_scope_capture() swaps between them
+static inline __attribute__((always_inline)) void injector_isr_common(void* arg, bool scope) {
+#ifdef INJECTOR_ISR_PROFILE
+    uint32_t entry_cycles = esp_cpu_get_cycle_count();
+#endif
+    injector_channel_t *ch = (injector_channel_t *)arg;
+    uint32_t level = gpio_ll_get_level(&GPIO, ch->pin); // Register read; gpio_get_level() lives in flash
+    uint64_t now = esp_timer_get_time();                // In IRAM (CONFIG_ESP_TIMER_IN_IRAM)
+#ifdef INJECTOR_ISR_PROFILE
+    uint32_t stamp_cycles = esp_cpu_get_cycle_count();
+#endif
+
+    // Every interrupt is an edge, so seeing the same level twice means the opposite edge in between was never seen
+    if (level == ch->last_level) {
+        ch->lost_edges++;
+    }
+    ch->last_level = level;
 
     if (level == 0) {
-        // Falling edge: start timing
-        fall_time_us = now;
+        // Falling edge: start timing (restarts if the previous rising edge was lost)
+        ch->fall_time_us = now;
     } else {
         // Rising edge: stop timing
-        if (fall_time_us > 0) {
-            uint64_t duration = now - fall_time_us;
-            // Filter anything below injector deadtime (injector will not physically open)
-            if (duration > INJECTOR_DEADTIME && pulse_count_isr < MAX_PULSES) {
-                taskENTER_CRITICAL_ISR(&pulse_spinlock);
-                pulse_buffer[pulse_count_isr++] = (uint32_t)duration;
-                taskEXIT_CRITICAL_ISR(&pulse_spinlock);
+        if (ch->fall_time_us > 0) {
+            uint64_t duration = now - ch->fall_time_us;
+            // Filter glitches only; sub-deadtime pulses are kept as (zero fuel) injection events so they don't look like missed pulses
+            if (duration > INJECTOR_GLITCH_US) {
+                pulse_ring_push(&ch->ring, (uint32_t)ch->fall_time_us, (uint32_t)duration); // Counts an overflow instead of blocking if the ring is full
+                if (scope) {
+                    pulse_ring_push(&ch->scope_ring, (uint32_t)ch->fall_time_us, (uint32_t)duration);
+                }
+                if (fuel_integrator_task_handle) { // Integrate it straight away
+                    BaseType_t woken = pdFALSE;
+                    vTaskNotifyGiveFromISR(fuel_integrator_task_handle, &woken);
+                    portYIELD_FROM_ISR(woken);
+                }
             }
         }
+        ch->fall_time_us = 0; // A second rising edge in a row must not produce a pulse
     }
+#ifdef INJECTOR_ISR_PROFILE
+    isr_prof_record(&isr_prof_stamp, stamp_cycles - entry_cycles);
+    isr_prof_record(&isr_prof_dur, esp_cpu_get_cycle_count() - entry_cycles);
+#endif
+}
+
+static void IRAM_ATTR injector_isr_handler(void* arg) {
+    injector_isr_common(arg, false);
+}
+
+static void IRAM_ATTR injector_scope_isr_handler(void* arg) {
+    injector_isr_common(arg, true);
 }
 
 // Callback for LCD write
@@ -61,21 +124,113 @@ static esp_err_t write_lcd_data(const hd44780_t *lcd, uint8_t data)
 
 /* Getter/setter for fuel_stats */
 
-const fuel_stats_t *get_stats(void) {
-    return &stats;
+void get_stats(fuel_stats_t *get_stats) {
+    memset(get_stats, 0, sizeof(fuel_stats_t));
+    if(fuel_data_mutex == NULL){ // fuel_meter_task not running yet, nothing can change it
+        *get_stats = stats;
+    }
+    else if(xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(1000))){
+        *get_stats = stats;
+        xSemaphoreGive(fuel_data_mutex);
+    }
+}
+
+static void apply_stats(const fuel_stats_t *set_stats) {
+    fuel_stats_t new_stats = *set_stats; // fuel_hist keeps its own totals, so the recent history survives a load/clear
+    uint64_t cyl_total = 0;
+    for(size_t c = 0; c < N_INJ_CHANNELS; c++){cyl_total += stats.cyl_fuel_consumed[c];}
+    for(size_t c = 0; c < N_INJ_CHANNELS; c++){
+        double share = cyl_total ? (double)stats.cyl_fuel_consumed[c] / cyl_total : 1.0 / N_INJ_CHANNELS;
+        new_stats.cyl_fuel_consumed[c] = (uint64_t)(share * new_stats.fuel_consumed / cyl_per_channel);
+    }
+    double raw_share = stats.fuel_consumed ? (double)stats.fuel_consumed_raw / stats.fuel_consumed : 1.0;
+    new_stats.fuel_consumed_raw = (uint64_t)(raw_share * new_stats.fuel_consumed);
+    stats = new_stats;
 }
 
 void set_stats(const fuel_stats_t *set_stats) {
-    if(set_stats){
-        stats = *set_stats;
+    if(set_stats == NULL){return;}
+    if(fuel_data_mutex == NULL){
+        apply_stats(set_stats);
+    }
+    else if(xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(1000))){
+        apply_stats(set_stats);
+        xSemaphoreGive(fuel_data_mutex);
+    }
+}
+
+/* Engine profile */
+
+bool check_engine_profile(const engine_profile_t *profile, char *msg, size_t msg_len) {
+    if(!engine_profile_validate(profile, msg, msg_len)){return false;}
+    if(profile->n_cyl % N_INJ_CHANNELS){
+        snprintf(msg, msg_len, "cylinders must be a multiple of the %d injector channels", N_INJ_CHANNELS); return false;
+    }
+    return true;
+}
+
+// Boot: the stored active profile, or the built-in one
+static void load_engine_profile(void) {
+    char msg[64];
+    uint8_t slot = get_active_profile_slot();
+    if(!get_engine_profile_slot(slot, &engine_profile) || !check_engine_profile(&engine_profile, msg, sizeof(msg))){
+        ESP_LOGW(TAG, "No usable profile in slot %d, using the built-in one", slot);
+        engine_profile_default(&engine_profile);
+    }
+    fuel_model_init(&fuel_model, &engine_profile);
+    cyl_per_channel = fuel_model.n_cyl / N_INJ_CHANNELS;
+    fuel_integrator_init(N_INJ_CHANNELS, &fuel_model);
+    const fuel_lut_info_t *lut = fuel_lut_info();
+    ESP_LOGI(TAG, "Engine profile '%s': %d cyl, %.0f mL/min", engine_profile.name, engine_profile.n_cyl, engine_profile.static_flow_ml_min);
+    ESP_LOGI(TAG, "Fuel LUT: %d entries @ %lu us, max error %.5f uL (%.3f%%)", fuel_model.lut_n, FUEL_LUT_STEP_US, lut->max_err_ul, lut->max_err_pct);
+}
+
+bool set_engine_profile(const engine_profile_t *profile, char *msg, size_t msg_len) {
+    if(!check_engine_profile(profile, msg, msg_len)){return false;}
+    fuel_model_t *model = malloc(sizeof(fuel_model_t)); // Derived outside the mutex, too big for the caller's stack
+    if(model == NULL){
+        snprintf(msg, msg_len, "out of memory"); return false;
+    }
+    fuel_model_init(model, profile);
+    if(fuel_data_mutex == NULL || !xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(1000))){
+        free(model);
+        snprintf(msg, msg_len, "fuel meter busy"); return false;
+    }
+    fuel_model_pending = *model;
+    engine_profile = *profile;
+    fuel_model_changed = true;
+    xSemaphoreGive(fuel_data_mutex);
+    free(model);
+    snprintf(msg, msg_len, "'%s' applies from the next period", profile->name);
+    return true;
+}
+
+void get_engine_profile(engine_profile_t *profile) {
+    if(fuel_data_mutex == NULL){ // fuel_meter_task not running yet, nothing can change it
+        *profile = engine_profile;
+    }
+    else if(xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(1000))){
+        *profile = engine_profile;
+        xSemaphoreGive(fuel_data_mutex);
     }
 }
 
 /* Inits */
 
 void init_pulse_width_gpio(void) {
+    calib_init();
+    load_engine_profile();
+
+    const gpio_num_t pins[N_INJ_CHANNELS] = INJECTOR_PINS;
+    uint64_t pin_mask = 0;
+    for(size_t i = 0; i < N_INJ_CHANNELS; i++){
+        inj_channels[i].pin = pins[i];
+        inj_channels[i].cyl = i * cyl_per_channel + 1;
+        inj_channels[i].last_level = 1; // Idle high (pull-up), the ECU pulls low to open the injector
+        pin_mask |= 1ULL << pins[i];
+    }
     gpio_config_t io_conf = {
-        .pin_bit_mask = 1ULL << INJECTOR_PIN,
+        .pin_bit_mask = pin_mask,
         .mode = GPIO_MODE_INPUT,
         .pull_up_en = GPIO_PULLUP_ENABLE,
         .pull_down_en = GPIO_PULLDOWN_DISABLE,
@@ -83,9 +238,12 @@ void init_pulse_width_gpio(void) {
     };
     ESP_ERROR_CHECK(gpio_config(&io_conf));
 
-    ESP_ERROR_CHECK(gpio_install_isr_service(0));
-    ESP_ERROR_CHECK(gpio_isr_handler_add(INJECTOR_PIN, injector_isr_handler, NULL));
-    ESP_LOGI(TAG, "Ready to measure injector pulses on GPIO %d...", INJECTOR_PIN);
+    // IRAM interrupt: keeps being serviced while NVS/SPIFFS have the flash cache disabled
+    ESP_ERROR_CHECK(gpio_install_isr_service(ESP_INTR_FLAG_IRAM));
+    for(size_t i = 0; i < N_INJ_CHANNELS; i++){
+        ESP_ERROR_CHECK(gpio_isr_handler_add(inj_channels[i].pin, injector_isr_handler, &inj_channels[i]));
+        ESP_LOGI(TAG, "Ready to measure injector pulses for cylinder %d on GPIO %d...", inj_channels[i].cyl, inj_channels[i].pin);
+    }
 }
 
 void init_bmp280_sensor(void *pvParameters) {
@@ -111,63 +269,132 @@ void init_bmp280_sensor(void *pvParameters) {
     vTaskDelete(NULL);
 }
 
-inline bool get_pid(uint8_t pid, uint8_t return_length, comms_data_pack_t *data) {
-    bool res = OBD9141_get_current_pid(pid, return_length);
-    data->attempt_cntr++;
-    if (res)
-        data->success_cntr++;
-    return res;
+// Injector-derived RPM, valid only if injections kept coming at a consistent rate up to the last drain
+static bool get_inj_rpm(uint16_t *rpm, uint32_t *us_per_cycle) {
+    return inj_rpm_get(&inj_rpm, period_drain_us, rpm, us_per_cycle);
 }
 
-/* Get data for fuel meter from KWP comms */
+/* Raw pulse stream */
 
-static comms_data_pack_t get_car_data(void) {
-    comms_data_pack_t data = car_data; // Takes the last period's data (if any requests fail, we fall back to the last valid data, and if it's the first time, we just assume 0)
-    data.can_calc_map = true;
-    data.attempt_cntr = 0;
-    data.success_cntr = 0;
+void set_scope_fps(int fps) {
+    if(fps < SCOPE_MIN_FPS){fps = SCOPE_MIN_FPS;}
+    if(fps > SCOPE_MAX_FPS){fps = SCOPE_MAX_FPS;}
+    scope_fps = fps;
+}
 
-    // Load [%]
-    if(get_pid(0x04, 1, &data)){
-        data.load = OBD9141_read_uint8() * 100 / 255;
+// Swaps the channels' ISR handlers; gpio_isr_handler_add() replaces the handler in place, so no edges are lost
+static void set_scope_capture(bool enable) {
+    for(size_t i = 0; i < N_INJ_CHANNELS; i++){
+        gpio_isr_handler_add(inj_channels[i].pin, enable ? injector_scope_isr_handler : injector_isr_handler, &inj_channels[i]);
     }
-    else{data.can_calc_map = false;}
-    OBD9141_delay(INBETWEEN_DELAY_MS);
+}
 
-    // Engine Coolant Temperature [°C]
-    if(get_pid(0x05, 1, &data)){
-        data.coolant_temp = OBD9141_read_uint8() - 40;
-    }
-    OBD9141_delay(INBETWEEN_DELAY_MS);
+/* Get data for fuel meter from KWP comms */
 
-    // RPM
-    if(get_pid(0x0C, 2, &data)){
-        data.rpm = OBD9141_read_uint16() / 4;
-    }
-    else{data.can_calc_map = false;}
-    OBD9141_delay(INBETWEEN_DELAY_MS);
+// Where a cycle's answers are decoded into
+typedef struct car_read_t {
+    comms_data_pack_t *data;
+    car_data_time_t *time;
+    int64_t now;
+} car_read_t;
+
+static void decode_load(const uint8_t *raw, void *ctx) {
+    car_read_t *r = ctx;
+    r->data->load = raw[0] * 100 / 255;                 // [%]
+    r->time->load_us = r->now;
+}
+
+static void decode_coolant(const uint8_t *raw, void *ctx) {
+    car_read_t *r = ctx;
+    r->data->coolant_temp = raw[0] - 40;                // [°C]
+    r->time->coolant_temp_us = r->now;
+}
+
+static void decode_rpm(const uint8_t *raw, void *ctx) {
+    car_read_t *r = ctx;
+    r->data->rpm = (raw[0] * 256 + raw[1]) / 4;
+    r->time->rpm_us = r->now;
+}
 
-    // Vehicle Speed [km/h]
-    if(get_pid(0x0D, 1, &data)){
-        data.speed = OBD9141_read_uint8();
-    } else{data.speed = 0;} // Do not leave old speed data so you don't assume distance travelled but only record fuel consumed
-    OBD9141_delay(INBETWEEN_DELAY_MS);
+static void decode_speed(const uint8_t *raw, void *ctx) {
+    car_read_t *r = ctx;
+    r->data->speed = raw[0];                            // [km/h]
+}
+
+static void decode_intake(const uint8_t *raw, void *ctx) {
+    car_read_t *r = ctx;
+    r->data->intake_temp = raw[0] - 40;                 // [°C]
+    r->time->intake_temp_us = r->now;
+}
+
+static void decode_maf(const uint8_t *raw, void *ctx) {
+    car_read_t *r = ctx;
+    r->data->maf = (raw[0] * 256 + raw[1]) / 100.0f;    // [g/s]
+    r->time->maf_us = r->now;
+}
+
+static void decode_throttle(const uint8_t *raw, void *ctx) {
+    car_read_t *r = ctx;
+    r->data->throttle = raw[0] * 100 / 255;             // [%]
+    r->time->throttle_us = r->now;
+}
+
+// Skip the bus request if the injector spacing already gives us a good estimate
+static bool rpm_wanted(void) {
+    return !get_inj_rpm(NULL, NULL);
+}
 
-    // Intake Air Temperature [°C]
-    if(get_pid(0x0F, 1, &data)){
-        data.intake_temp = OBD9141_read_uint8() - 40;
+// Everything get_car_data() reads. Fast PIDs (period 0) feed the fuel maths and go out every cycle, the slow ones
+// only change over seconds to minutes and share what's left of the cycle's request
+static const pid_def_t car_pids[] = {
+    // PID  len  decoder          period [ms]  priority  wanted
+    {0x04, 1,   decode_load,     0,           0,        NULL},          // Load (MAP lookup)
+    {0x0C, 2,   decode_rpm,      0,           1,        rpm_wanted},    // RPM (MAP lookup, duty cycle limit)
+    {0x0D, 1,   decode_speed,    0,           2,        NULL},          // Vehicle Speed (distance)
+    {0x11, 1,   decode_throttle, 0,           3,        NULL},          // Throttle
+    {0x10, 2,   decode_maf,      1200,        4,        NULL},          // Mass Air Flow
+    {0x05, 1,   decode_coolant,  5000,        5,        NULL},          // Engine Coolant Temperature
+    {0x0F, 1,   decode_intake,   5000,        6,        NULL},          // Intake Air Temperature
+};
+#define N_CAR_PIDS (sizeof(car_pids) / sizeof(car_pids[0]))
+_Static_assert(N_CAR_PIDS <= PID_SCHED_MAX, "car_pids doesn't fit the scheduler");
+
+static pid_sched_t car_pid_sched;
+
+// Every successful read is stamped in *time; a failed speed read counts as a 0 km/h sample taken then.
+// One batched request per cycle: the fast PIDs plus whichever slow ones are due
+static comms_data_pack_t get_car_data(car_data_time_t *time) {
+    comms_data_pack_t data = car_data; // Takes the last period's data (if any requests fail, we fall back to the last valid data, and if it's the first time, we just assume 0)
+    int64_t now = esp_timer_get_time();
+    car_read_t read = {&data, time, now};
+
+    uint16_t inj_rpm_val = 0;
+    if(get_inj_rpm(&inj_rpm_val, NULL)){
+        data.rpm = inj_rpm_val;
+        time->rpm_us = now;
     }
-    OBD9141_delay(INBETWEEN_DELAY_MS);
 
-    // Mass Air Flow [g/s]
-    if(get_pid(0x10, 2, &data)){
-        data.maf = OBD9141_read_uint16() / 100.0f;
+    uint8_t order[KWP_PIDS_PER_CYCLE];
+    OBD9141_pid_req_t req[KWP_PIDS_PER_CYCLE];
+    uint8_t n = pid_sched_select(&car_pid_sched, now, KWP_PIDS_PER_CYCLE, order);
+    for(uint8_t i = 0; i < n; i++){
+        req[i] = (OBD9141_pid_req_t){.pid = car_pids[order[i]].pid, .len = car_pids[order[i]].len};
     }
-    OBD9141_delay(INBETWEEN_DELAY_MS);
+    OBD9141_get_current_pids(req, n);
 
-    // Throttle [%]
-    if(get_pid(0x11, 1, &data)){
-        data.throttle = OBD9141_read_uint8() * 100 / 255;
+    data.speed = 0; // Do not leave old speed data so you don't assume distance travelled but only record fuel consumed
+    time->speed_us = now;
+    data.attempt_cntr = n;
+    data.success_cntr = 0;
+    for(uint8_t i = 0; i < n; i++){
+        if(req[i].ok){
+            car_pids[order[i]].decode(req[i].data, &read);
+            data.success_cntr++;
+        }
+    }
+    data.can_calc_map = time->load_us == now && time->rpm_us == now; // Both fresh
+    for(uint8_t i = 0; i < n && data.success_cntr; i++){ // Nothing answered: ignition off, not unsupported PIDs
+        pid_support_result(req[i].pid, req[i].ok);
     }
 
     if(data.success_cntr != data.attempt_cntr){
@@ -178,47 +405,14 @@ static comms_data_pack_t get_car_data(void) {
 }
 
 static uint32_t get_map(uint16_t load, uint16_t rpm) {
-    // Clamp rpm/load
-    if (rpm <= rpm_bp[0]) rpm = rpm_bp[0];
-    if (rpm >= rpm_bp[N_RPM_BINS - 1]) rpm = rpm_bp[N_RPM_BINS - 1];
-    if (load <= load_bp[0]) load = load_bp[0];
-    if (load >= load_bp[N_LOAD_BINS - 1]) load = load_bp[N_LOAD_BINS - 1];
-
-    // Find load indices
-    int ix = 0;
-    while (ix < N_LOAD_BINS - 2 && load > load_bp[ix + 1]) ix++;
-    int ix1 = ix, ix2 = ix + 1;
-
-    uint16_t x1 = load_bp[ix1];
-    uint16_t x2 = load_bp[ix2];
-    uint16_t dx = x2 - x1;
-    uint16_t fx = dx ? ((load - x1) * 1000) / dx : 0;
-
-    // Find rpm indices
-    int iy = 0;
-    while (iy < N_RPM_BINS - 2 && rpm > rpm_bp[iy + 1]) iy++;
-    int iy1 = iy, iy2 = iy + 1;
-
-    uint16_t y1 = rpm_bp[iy1];
-    uint16_t y2 = rpm_bp[iy2];
-    uint16_t dy = y2 - y1;
-    uint16_t fy = dy ? ((rpm - y1) * 1000) / dy : 0;
-
-    // 4 surrounding MAP values
-    uint32_t m11 = map_table[iy1][ix1];
-    uint32_t m12 = map_table[iy1][ix2];
-    uint32_t m21 = map_table[iy2][ix1];
-    uint32_t m22 = map_table[iy2][ix2];
-
-    // Bilinear interpolation
-    uint32_t m1 = m11 + ((m12 - m11) * fx) / 1000;
-    uint32_t m2 = m21 + ((m22 - m21) * fx) / 1000;
-    uint32_t map = m1 + ((m2 - m1) * fy) / 1000;
-
-    return map; // in Pa
-}
-
-static double get_fuel_coeff(uint32_t map) {
+    const cal_table_t *table = calib_table_acquire(CALIB_MAP);
+    uint32_t map = cal_table_2d(table, rpm, load); // in Pa
+    calib_table_release();
+    return map;
+}
+
+// Reads ambient pressure and hands it and MAP to the integrator, which holds them until the next period
+static void update_fuel_inputs(uint32_t map) {
     uint32_t p_barometric = P_BAROMETRIC_BASELINE;
     esp_err_t err = bmp280_read_float(&bmp280, &bmp280_data.amb_temp, &bmp280_data.baro_pressure, NULL);
     if (err == ESP_OK){
@@ -229,98 +423,17 @@ static double get_fuel_coeff(uint32_t map) {
         responsive_bmp = false;
         xTaskCreate(init_bmp280_sensor, "init_bmp280_task", 4096, NULL, 3, NULL);
     }
-    
-    double p_ratio = p_barometric / P_BAROMETRIC_BASELINE;
-
-    uint32_t p_across_inj = FUEL_RAIL_PRESSURE + (p_barometric - map);  // Current pressure across injector, can vary between 4.0 bar @ WOT and 4.7 bar @ idle
-    double deltap_coeff = sqrt(p_across_inj / STATIC_FLOW_PRESSURE);    // Coeffcient for static fuel flow rate @ measured pressure across injector, based on delta-P square law
-
-    double coeff = STATIC_FLOW_RATE * deltap_coeff    * p_ratio;
-    // [uL/ms]   = [uL/ms]          * (1.00 ~ 1.08)   * (0.52 ~ 1.05)
-    //  coeff    = flow @ 4.0 bar   * (4.0 ~ 4.7 bar) * (0.52 ~ 1.05 bar)
-    //                        pressure across injector  atmospheric pressure
-    return coeff;
-}
-
-static double get_pulse_fuel(uint32_t pulse_width, double fuel_coeff) {
-    double pulse_fuel = 0;
-    if(pulse_width >= INJECTOR_FULL_OPENING_TIME) { // Pulse has full ramp-up and ramp-down
-        uint32_t static_flow_width = pulse_width - INJECTOR_FULL_OPENING_TIME;
-        pulse_fuel = ((INJECTOR_RAMP_UP_TIME * 0.5) + static_flow_width + (INJECTOR_RAMP_DOWN_TIME * 0.5)) * 0.001 * fuel_coeff; // [uL]
-        //           (          [us]              +       [us]        +            [us]              )     * 0.001 * [uL/ms] = [uL]
-        //                                          [us] * 0.001 = [ms]
-
-        // Ramp-up/ramp-down fuel amount is calculated as area of right triangle formed by injector ramp-up/ramp-down time on x-axis, 
-        // static flow rate coefficient on y-axis, and the change of flow rate over ramp time as a linear function
-        /*
-
-        Injector pulse, [ms]
-        /\ 
-        |  start                 end
-    HIGH|_____                    __________________
-        |     |                  |
-        |     |                  |
-     LOW|     |__________________|
-
-        Fuel flow rate, [uL/ms]
-        /\
-        |start of pulse__________v--- end of pulse
-        |     |       /|         |\
-        |     |      / |coeff    | \
-        |_____v_____/__|_________|__\___________> time, [ms]
-              dead  ramp-up      ramp-down
-              time  time         time      
-
-        Ramp-up time + Static flow time + Ramp-down time
-        
-        Area of trapezoid is total fuel injected! 
-
-        */
-
-    }
-    else{ // Pulse has partial ramp-up and ramp-down
-        double full_ramp_up_fuel = ((INJECTOR_RAMP_UP_TIME * 0.5) * fuel_coeff) * 0.001;
-        double full_ramp_down_fuel = ((INJECTOR_RAMP_DOWN_TIME * 0.5) * fuel_coeff) * 0.001;
-
-        uint32_t ramp_up_width = pulse_width - INJECTOR_DEADTIME;
-        double partial_coeff = pow((ramp_up_width / INJECTOR_RAMP_UP_TIME), 2);
-
-        double partial_ramp_up_fuel = partial_coeff * full_ramp_up_fuel;
-        double partial_ramp_down_fuel = partial_coeff * full_ramp_down_fuel;
-        pulse_fuel = partial_ramp_up_fuel + partial_ramp_down_fuel;
-
-        // Partial ramp-up/ramp-down pulses end up being triangles proportional to the 100% triangle ramps from above
-        // their sides are in a ratio of (partial/full), which is in the range (0; 1), and their areas (fuel injected) are proportional to
-        // the full ramp triangles in a ratio of (partial/full)^2.
-        // Example: if full ramp-up time is 0.650 ms, partial ramp-up time is 0.325 ms, their ratio is 0.325/0.650 = 1/2;
-        // so their areas (and the injected fuel) are in the ratio (1/2)^2 = 1/4.
-
-        /*
-
-        Injector pulse, [ms]
-        /\ 
-        |   start         end
-    HIGH|_______           __________________
-        |       |         |
-        |       |         |
-     LOW|       |_________|
-
-        Fuel flow rate, [uL/ms]
-        /\
-        |start of pulse   v--- end of pulse
-        |       |        /|\
-        |       |       / | \
-        |_______v______/__|__\___________> time, [ms]
-                 dead ramp ramp
-                 time up   down
-                      time time      
-        Partial ramp-up time + partial ramp-down time
-
-        Area of triangles is total fuel injected! 
+    fuel_integrator_set_baro(p_barometric);
+    fuel_integrator_set_map(map);
+}
 
-        */
-    }
-    return pulse_fuel;
+// Number of injections missing between two captured pulse starts on the same channel
+static uint16_t get_missing_injections(uint32_t prev_start_us, uint32_t start_us, uint32_t us_per_cycle) {
+    if(us_per_cycle == 0){return 0;}
+    uint32_t gap = start_us - prev_start_us;
+    uint32_t cycles = (gap + us_per_cycle / 2) / us_per_cycle; // Round to the nearest whole cycle
+    if(cycles <= 1){return 0;}
+    return cycles - 1 > UINT16_MAX ? UINT16_MAX : cycles - 1;
 }
 
 /* Get current page's data pack */
@@ -329,55 +442,176 @@ static comms_data_pack_t get_comms_data_pack(void) {
     return car_data;
 }
 
+// Runs in fuel_meter_task, the bus owner, which publishes the result under fuel_data_mutex (kwp_timing)
+static kwp_timing_data_pack_t read_kwp_timing(void) {
+    kwp_timing_data_pack_t data_pack = {0};
+    OBD9141_lat_info_t lat[OBD9141_LAT_SLOTS];
+    uint16_t retries = 0, recovered = 0;
+    data_pack.n = OBD9141_get_latency(lat, OBD9141_LAT_SLOTS, &retries, &recovered);
+    data_pack.retries = retries;
+    data_pack.recovered = recovered;
+    OBD9141_timing_t timing;
+    OBD9141_get_timing(&timing);
+    data_pack.negotiated = timing.negotiated;
+    data_pack.p2_min = timing.p2_min_ms;
+    data_pack.p2_max = timing.p2_max_ms;
+    data_pack.p3_min = timing.p3_min_ms;
+    data_pack.p4_min = timing.p4_min_ms;
+    memcpy(data_pack.lat, lat, data_pack.n * sizeof(lat[0]));
+    return data_pack;
+}
+
+static kwp_timing_data_pack_t get_kwp_timing_data_pack(void) {
+    kwp_timing_data_pack_t data_pack = {0};
+    // Copy locally, the bus task updates the latency statistics with every request
+    if(xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(100))){
+        data_pack = kwp_timing;
+        xSemaphoreGive(fuel_data_mutex);
+    }
+    return data_pack;
+}
+
 static debug_fuel_data_pack_t get_debug_fuel_data_pack(void) {
     debug_fuel_data_pack_t data_pack = {0};
     fuel_stats_t local_stats = {0};
     comms_data_pack_t local_car_data = {0};
     uint16_t local_local_pulse_count = 0;
     uint64_t local_avg_pulse_width = 0;
+    uint32_t local_ring_overflow = 0;
+    uint16_t local_ring_high_water = 0;
+    uint16_t local_inj_rpm = 0;
+    uint16_t local_recon_pulse_count = 0;
+    uint8_t local_recon_confidence = 100;
+    uint32_t local_lost_edges = 0;
+    uint16_t local_flash_periods = 0;
+    uint32_t local_flash_lost_edges = 0;
+    uint32_t local_period_us = FUEL_PERIOD_MS * 1000;
+    uint32_t local_kwp_us = 0;
+    uint16_t local_loop_overruns = 0;
+    uint16_t local_late_wakeups = 0;
+    const fuel_lut_info_t *lut = fuel_lut_info(); // Only changes when the LUT is rebuilt
     // Copy locally to prevent overwrites
     if(xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(100))){
         local_stats = stats;
         local_car_data = car_data;
         local_local_pulse_count = local_pulse_count;
         local_avg_pulse_width = avg_pulse_width;
+        local_ring_overflow = ring_overflow;
+        local_ring_high_water = ring_high_water;
+        local_inj_rpm = inj_rpm_last;
+        local_recon_pulse_count = recon_pulse_count;
+        local_recon_confidence = recon_confidence;
+        local_lost_edges = lost_edges;
+        local_flash_periods = flash_periods;
+        local_flash_lost_edges = flash_lost_edges;
+        local_period_us = period_us;
+        local_kwp_us = kwp_us;
+        local_loop_overruns = loop_overruns;
+        local_late_wakeups = late_wakeups;
         xSemaphoreGive(fuel_data_mutex);
     }
 
     data_pack.inst_fuel = local_stats.fuel_cons_inst;
     data_pack.avg_fuel = local_stats.fuel_cons_avg;
-    data_pack.dist_tr = local_stats.dist_tr;
-    data_pack.cons_fuel = local_stats.fuel_consumed * 0.000001;       // [uL] to [L]
+    data_pack.dist_tr = local_stats.dist_tr * 0.001f;                  // [mm] to [m]
+    data_pack.cons_fuel = local_stats.fuel_consumed * 1e-9f;          // [nL] to [L]
     data_pack.rpm = local_car_data.rpm;
     data_pack.speed = local_car_data.speed;
     data_pack.pcnt_isr = local_local_pulse_count;
-    // Injections per 600 ms, as expected from RPM
-    // revs/min / 60 s = revs/sec; revs/sec / 2 (because every other rotation has an injection) and * 0.6 because revs/0.6 sec
-    data_pack.pcnt_rpm = (int16_t)lround(local_car_data.rpm / 60 / 2 * 0.6);
+    // Injections in the last period, as expected from RPM (injector-derived if available, it's fresher than KWP)
+    // revs/min / 60 s = revs/sec; revs/sec / 2 (because every other rotation has an injection) * the period's measured length
+    uint16_t rpm = local_inj_rpm ? local_inj_rpm : local_car_data.rpm;
+    data_pack.pcnt_rpm = (int16_t)lround(rpm / 60.0 / 2 * local_period_us * 1e-6);
     data_pack.pdelta = data_pack.pcnt_rpm - data_pack.pcnt_isr;
     data_pack.avg_pwidth = local_avg_pulse_width * 0.001; // [us] to [ms]
     data_pack.amb_temp = bmp280_data.amb_temp;
     data_pack.baro_pressure = bmp280_data.baro_pressure * 0.001f; // [Pa] to [kPa]
+    data_pack.ring_overflow = local_ring_overflow;
+    data_pack.ring_high_water = local_ring_high_water;
+    data_pack.inj_rpm = local_inj_rpm;
+    data_pack.recon_pcnt = local_recon_pulse_count;
+    data_pack.raw_fuel = local_stats.fuel_consumed_raw * 1e-9f;     // [nL] to [L]
+    data_pack.confidence = local_recon_confidence;
+    data_pack.lost_edges = local_lost_edges;
+    data_pack.flash_periods = local_flash_periods;
+    data_pack.flash_lost_edges = local_flash_lost_edges;
+    data_pack.lut_rebuilds = lut->rebuilds;
+    data_pack.lut_err = lut->max_err_pct;
+    data_pack.period_ms = local_period_us * 0.001f;  // [us] to [ms]
+    data_pack.kwp_ms = local_kwp_us * 0.001f;        // [us] to [ms]
+    data_pack.loop_overruns = local_loop_overruns;
+    data_pack.late_wakeups = local_late_wakeups;
 
     return data_pack;
 }
 
-static fuel_data_pack_t get_fuel_data_pack(void) {
+static cyl_fuel_data_pack_t get_cyl_fuel_data_pack(void) {
+    cyl_fuel_data_pack_t data_pack = {0};
+    // Copy locally to prevent overwrites
+    if(xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(100))){
+        data_pack.n_channels = N_INJ_CHANNELS;
+        for(size_t c = 0; c < N_INJ_CHANNELS; c++){
+            data_pack.ch[c].cyl = inj_channels[c].cyl;
+            data_pack.ch[c].pcnt = inj_channels[c].pulse_count;
+            data_pack.ch[c].avg_pwidth = inj_channels[c].avg_pulse_width * 0.001f;  // [us] to [ms]
+            data_pack.ch[c].period_fuel = inj_channels[c].period_fuel * 0.001f;      // [nL] to [uL]
+            data_pack.ch[c].cons_fuel = stats.cyl_fuel_consumed[c] * 1e-6f;         // [nL] to [mL]
+            data_pack.ch[c].ring_overflow = inj_channels[c].ring.overflow_cnt;
+        }
+        xSemaphoreGive(fuel_data_mutex);
+    }
+    return data_pack;
+}
+
+static isr_prof_data_pack_t get_isr_prof_data_pack(void) {
+    isr_prof_data_pack_t data_pack = {0};
+#ifdef INJECTOR_ISR_PROFILE
+    // Lock-free snapshot, the ISR keeps recording meanwhile
+    isr_prof_summary_t dur, stamp;
+    isr_prof_summarise(&isr_prof_dur, &dur);
+    isr_prof_summarise(&isr_prof_stamp, &stamp);
+    data_pack.enabled = true;
+    data_pack.samples = dur.count;
+    data_pack.dur_min = dur.min_us;
+    data_pack.dur_avg = dur.avg_us;
+    data_pack.dur_p99 = dur.p99_us;
+    data_pack.dur_max = dur.max_us;
+    data_pack.stamp_min = stamp.min_us;
+    data_pack.stamp_avg = stamp.avg_us;
+    data_pack.stamp_p99 = stamp.p99_us;
+    data_pack.stamp_max = stamp.max_us;
+    // Both edges see the same offset distribution, so the width error we add is at most the spread between them
+    data_pack.width_err_p99 = stamp.p99_us - stamp.min_us;
+#endif
+    return data_pack;
+}
+
+// Instantaneous consumption comes straight off the integrator, over the caller's own trailing window
+static fuel_data_pack_t get_fuel_data_pack(fuel_window_t *window) {
     fuel_data_pack_t data_pack = {0};
+    fuel_sample_t sample;
+    fuel_integrator_sample(&sample);
     fuel_stats_t local_stats = {0};
     comms_data_pack_t local_car_data = {0};
+    fuel_hist_span_t last_6 = {0}, last_60 = {0}, last_10m = {0}, last_1h = {0};
     // Copy locally to prevent overwrites
     if(xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(100))){
         local_stats = stats;
         local_car_data = car_data;
+        fuel_hist_last(&fuel_hist, 6, &last_6);
+        fuel_hist_last(&fuel_hist, 60, &last_60);
+        fuel_hist_last(&fuel_hist, 600, &last_10m);
+        fuel_hist_last(&fuel_hist, 3600, &last_1h);
         xSemaphoreGive(fuel_data_mutex);
     }
-    data_pack.inst_fuel = local_stats.fuel_cons_inst;
+    data_pack.inst_fuel = fuel_window_update(window, &sample);
     data_pack.avg_fuel = local_stats.fuel_cons_avg;
     data_pack.coolant_temp = local_car_data.coolant_temp;
-    data_pack.cons_fuel = local_stats.fuel_consumed * 0.000001;       // [uL] to [L]
-    data_pack.fuel_last_6 = local_stats.fuel_cons_last_6 * 0.001;     // [uL] to [mL]
-    data_pack.fuel_last_60 = local_stats.fuel_cons_last_60 * 0.001;   // [uL] to [mL]
+    data_pack.cons_fuel = local_stats.fuel_consumed * 1e-9f;          // [nL] to [L]
+    data_pack.fuel_last_6 = last_6.fuel_nl * 1e-6f;     // [nL] to [mL]
+    data_pack.fuel_last_60 = last_60.fuel_nl * 1e-6f;   // [nL] to [mL]
+    data_pack.avg_10m = last_10m.cons;
+    data_pack.avg_1h = last_1h.cons;
 
     return data_pack;
 }
@@ -387,15 +621,29 @@ static fuel_data_pack_t get_fuel_data_pack(void) {
 static void comms_page_handler(void) {
     comms_data_pack_t data = get_comms_data_pack();
     send_comms_data_pack(data);
+    kwp_timing_data_pack_t timing = get_kwp_timing_data_pack();
+    send_kwp_timing_data_pack(&timing);
 }
 
 static void debug_fuel_page_handler(void) {
     debug_fuel_data_pack_t data = get_debug_fuel_data_pack();
     send_debug_fuel_data_pack(data);
+    cyl_fuel_data_pack_t cyl = get_cyl_fuel_data_pack();
+    send_cyl_fuel_data_pack(cyl);
+    isr_prof_data_pack_t prof = get_isr_prof_data_pack();
+    send_isr_prof_data_pack(prof);
+}
+
+static void injector_page_handler(void) {
+    // The distributions are too big to copy onto this task's stack; build the packet while holding the mutex instead
+    if(xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(100))){
+        send_pw_stats_data(&pw_stats);
+        xSemaphoreGive(fuel_data_mutex);
+    }
 }
 
-static void fuel_page_handler(void) {
-    fuel_data_pack_t data = get_fuel_data_pack();
+static void fuel_page_handler(fuel_window_t *window) {
+    fuel_data_pack_t data = get_fuel_data_pack(window);
     send_fuel_data_pack(data);
 }
 
@@ -403,106 +651,292 @@ static void fuel_page_handler(void) {
 /* FreeRTOS tasks */
 
 void fuel_meter_task(void *pvParameters) {
+    fuel_hist_init(&fuel_hist, esp_timer_get_time()); // Before the mutex exists, nobody can read it yet
+    fuel_heatmap_init();
+    trips_init();
     fuel_data_mutex = xSemaphoreCreateMutex();
+    pw_stats_init(&pw_stats);
+    pid_sched_init(&car_pid_sched, car_pids, N_CAR_PIDS);
+    car_pid_sched.supported = pid_support_has;
+    flash_guard_mark_t flash_mark = flash_guard_mark();
     TickType_t last_wake = xTaskGetTickCount();
+    int64_t period_start_us = esp_timer_get_time();
     while (1) {
-        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(600));
+        // The KWP requests below block for as long as the ECU takes, so a period is rarely exactly FUEL_PERIOD_MS;
+        // everything is integrated over the measured interval instead, overruns and late wakeups are only counted
+        bool overrun = xTaskDelayUntil(&last_wake, pdMS_TO_TICKS(FUEL_PERIOD_MS)) == pdFALSE;
+        TickType_t late = xTaskGetTickCount() - last_wake;
+        if(overrun){
+            last_wake = xTaskGetTickCount(); // Don't fire a burst of back-to-back periods to catch up, the next one is just longer
+        }
+        int64_t wake_us = esp_timer_get_time();
         if(xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(100))){
+            period_us = (uint32_t)(wake_us - period_start_us);
+            period_start_us = wake_us;
+            if(overrun){
+                loop_overruns++;
+                ESP_LOGW(TAG, "fuel_meter_task overran its period (%lu ms, KWP %lu ms)", period_us / 1000, kwp_us / 1000);
+            }
+            else if(late >= pdMS_TO_TICKS(FUEL_LATE_WAKE_MS)){
+                late_wakeups++;
+            }
         
 /* ---------------------------------- Gather data ----------------------------------------------- */
 
-            // Get data from Corsa over KWP
-            car_data = get_car_data();
+            // A new engine profile takes over at the period boundary, stats carry on
+            if(fuel_model_changed){
+                fuel_model = fuel_model_pending;
+                fuel_model_changed = false;
+                fuel_integrator_set_model(&fuel_model);
+                cyl_per_channel = fuel_model.n_cyl / N_INJ_CHANNELS;
+                for(size_t c = 0; c < N_INJ_CHANNELS; c++){
+                    inj_channels[c].cyl = c * cyl_per_channel + 1;
+                }
+                ESP_LOGI(TAG, "Engine profile '%s' applied", engine_profile.name);
+            }
 
-            // Snapshot data locally for safe calculations 
-            uint32_t local_pulse_buffer[MAX_PULSES];
-            taskENTER_CRITICAL(&pulse_spinlock);
-            local_pulse_count = pulse_count_isr;
-            pulse_count_isr = 0;
-            memcpy(local_pulse_buffer, pulse_buffer, local_pulse_count * sizeof(uint32_t));
-            taskEXIT_CRITICAL(&pulse_spinlock);
+            // Drain only what the ISR had published so far; anything arriving meanwhile belongs to the next period.
+            // Done first so the injector RPM estimate is as fresh as possible for the KWP requests below
+            // Each channel is drained as one batch; no interrupts are masked, the ISRs keep filling their rings meanwhile
+            period_drain_us = (uint32_t)esp_timer_get_time();
+            local_pulse_count = 0;
+            ring_overflow = 0;
+            ring_high_water = 0;
+            for(size_t c = 0; c < N_INJ_CHANNELS; c++){
+                injector_channel_t *ch = &inj_channels[c];
+                uint32_t pending = pulse_ring_count(&ch->period_ring); // Already integrated by fuel_integrator_task
+                ch->pulse_count = 0;
+                while(pending-- && pulse_ring_pop(&ch->period_ring, &ch->period_pulses[ch->pulse_count])){
+                    if(c == 0){ // One injector fires once per cycle, so a single channel is all the estimator needs
+                        inj_rpm_update(&inj_rpm, ch->period_pulses[ch->pulse_count].start_us);
+                    }
+                    ch->pulse_count++;
+                }
+                local_pulse_count += ch->pulse_count;
+                ring_overflow += ch->ring.overflow_cnt + ch->period_ring.overflow_cnt;
+                if(ch->ring.high_water > ring_high_water){ring_high_water = ch->ring.high_water;}
+                if(ch->period_ring.high_water > ring_high_water){ring_high_water = ch->period_ring.high_water;}
+            }
+            // The pulses themselves were integrated one by one as they came in (fuel_integrator_task), this period gets
+            // whatever has accumulated up to the drain, so its fuel covers the same window as its pulses, not the KWP time
+            fuel_period_t period;
+            fuel_integrator_take_period(&period);
+            // Did any of our flash operations overlap this period's capture, and did we lose edges?
+            bool flash_overlap = flash_guard_overlapped(&flash_mark);
+            flash_mark = flash_guard_mark();
+            uint32_t period_lost_edges = 0;
+            for(size_t c = 0; c < N_INJ_CHANNELS; c++){
+                uint32_t lost = inj_channels[c].lost_edges;
+                period_lost_edges += lost - inj_channels[c].lost_edges_seen;
+                inj_channels[c].lost_edges_seen = lost;
+            }
+            lost_edges += period_lost_edges;
+            if(flash_overlap){
+                flash_periods++;
+                flash_lost_edges += period_lost_edges;
+                if(period_lost_edges){
+                    ESP_LOGW(TAG, "%lu injector edges lost during a flash operation", period_lost_edges);
+                }
+            }
+            if(ring_overflow){
+                static uint32_t reported_overflow = 0;
+                if(ring_overflow != reported_overflow){
+                    ESP_LOGW(TAG, "Pulse ring overflowed, %lu pulses dropped since boot", ring_overflow);
+                    reported_overflow = ring_overflow;
+                }
+            }
+
+            xSemaphoreGive(fuel_data_mutex);
+
+            // Get data from Corsa over KWP, into locals: the requests block for ~180 ms (up to ~470 ms one PID at a time)
+            // and the page/LCD tasks only wait 100 ms for the mutex. Only this task writes car_data, so reading it is fine
+            int64_t kwp_start_us = esp_timer_get_time();
+            car_data_time_t new_car_data_time = car_data_time;
+            comms_data_pack_t new_car_data = get_car_data(&new_car_data_time);
+            uint32_t new_kwp_us = (uint32_t)(esp_timer_get_time() - kwp_start_us);
+            kwp_timing_data_pack_t new_kwp_timing = read_kwp_timing();
 
             // Get MAP for fuel injected calculations
             uint32_t map = MAP_DEFAULT;
-            if(car_data.can_calc_map){
-                map = get_map(car_data.load, car_data.rpm);
+            if(new_car_data.can_calc_map){
+                map = get_map(new_car_data.load, new_car_data.rpm);
             }
 
-            double fuel_coeff = get_fuel_coeff(map);
+            update_fuel_inputs(map);
+            fuel_integrator_set_speed(new_car_data.speed);
+
+            // The pulses are drained already, so this period is finished even if a reader holds the mutex a while
+            xSemaphoreTake(fuel_data_mutex, portMAX_DELAY);
+            uint8_t last_speed = car_data.speed;
+            int64_t last_speed_us = car_data_time.speed_us;
+            car_data = new_car_data;
+            car_data_time = new_car_data_time;
+            kwp_us = new_kwp_us;
+            kwp_timing = new_kwp_timing;
 
             // Get time period for cycle (to check for invalid values such as > 100% duty cycle)
-            uint32_t us_per_cycle = car_data.rpm < 300 ? 400 * 1000 : 120000 * 1000 / car_data.rpm; // [ms/cycle] to [us/cycle]
-            uint32_t max_pulse_width = us_per_cycle - INJECTOR_RESET_TIME;
+            uint32_t us_per_cycle = 0;
+            if(get_inj_rpm(&inj_rpm_last, &us_per_cycle) == false){ // Prefer the measured injection spacing over the KWP RPM
+                inj_rpm_last = 0;
+                us_per_cycle = car_data.rpm < 300 ? 400 * 1000 : 120000 * 1000 / car_data.rpm; // [ms/cycle] to [us/cycle]
+            }
+            uint32_t max_pulse_width = us_per_cycle - fuel_model.reset_time;
+            fuel_integrator_set_max_width(max_pulse_width);
             uint16_t invalid_pulse_count = 0;
 
+            // Pulse width distributions are bucketed by this period's RPM
+            pw_stats_begin_period(&pw_stats);
+            uint8_t rpm_band = pw_stats_rpm_band(inj_rpm_last ? inj_rpm_last : car_data.rpm);
+
             // Fuel consumed during this 600 ms period
-            double period_fuel_cons = 0; // in [uL] (microlitres)
+            uint32_t period_fuel_cons = 0; // in [nL] (nanolitres), including reconciled injections
+            uint32_t period_fuel_raw = 0;  // in [nL], captured pulses only
             avg_pulse_width = 0; // Reset the avg every 600 ms
-            for(size_t i = 0; i < local_pulse_count; i++){
-                if(local_pulse_buffer[i] >= max_pulse_width){invalid_pulse_count++; continue;}
-                double pulse_fuel = get_pulse_fuel(local_pulse_buffer[i], fuel_coeff); // [uL]
-                period_fuel_cons += pulse_fuel * N_CYL; // For all 4 cylinders, we assume the same pulse width across all cylinders in a given 4-stroke cycle
-                avg_pulse_width += local_pulse_buffer[i];
+            recon_pulse_count = 0;
+            for(size_t c = 0; c < N_INJ_CHANNELS; c++){
+                injector_channel_t *ch = &inj_channels[c];
+                uint16_t ch_invalid = 0;
+                uint64_t ch_width_sum = 0;
+                ch->recon_count = 0;
+
+                // Pulses the ISR dropped on ring overflow show up as gaps, possibly only in the next period
+                uint32_t new_overflow = ch->ring.overflow_cnt + ch->period_ring.overflow_cnt - ch->overflow_seen;
+                ch->overflow_seen += new_overflow;
+                ch->overflow_budget += new_overflow;
+
+                for(size_t i = 0; i < ch->pulse_count; i++){
+                    const injector_pulse_t *pulse = &ch->period_pulses[i];
+                    uint32_t pulse_width = pulse->width_us;
+
+                    // Reconcile injections missing since the previous pulse: a short gap is a lost edge (ISR latency),
+                    // a longer one only if the ring is known to have dropped that many, otherwise it's fuel cut/engine stop
+                    if(ch->has_last){
+                        uint16_t missing = get_missing_injections(ch->last_pulse.start_us, pulse->start_us, us_per_cycle);
+                        if(missing && (missing <= RECON_MAX_MISSING || missing <= ch->overflow_budget)){
+                            ch->overflow_budget -= missing < ch->overflow_budget ? missing : ch->overflow_budget;
+                            uint32_t est_width = (ch->last_pulse.width_us + pulse_width) / 2; // Neighbouring pulses
+                            fuel_integrator_recon(c, missing, est_width);
+                            ch->recon_count += missing;
+                        }
+                    }
+                    ch->last_pulse = *pulse;
+                    ch->has_last = true;
+
+                    // Needle never lifted (no fuel), or longer than the whole cycle
+                    if(pulse_width <= fuel_model.deadtime || pulse_width >= max_pulse_width){ch_invalid++; continue;}
+                    ch_width_sum += pulse_width;
+                    pw_stats_add(&pw_stats, rpm_band, pulse_width);
+                }
+                if(ch->pulse_count){
+                    ch->overflow_budget = ch->overflow_budget < new_overflow ? ch->overflow_budget : new_overflow; // Older drops had their chance to match a gap
+                }
+                ch->avg_pulse_width = ch->pulse_count > ch_invalid ? ch_width_sum / (ch->pulse_count - ch_invalid) : 0;
+                avg_pulse_width += ch_width_sum;
+                invalid_pulse_count += ch_invalid;
+                recon_pulse_count += ch->recon_count;
             }
-            if(local_pulse_count){
-                avg_pulse_width /= (local_pulse_count - invalid_pulse_count); // Avoid division by 0
+            // Plus the injections reconciled above, their gaps lie in this period's pulses
+            fuel_integrator_take_recon(&period);
+            for(size_t c = 0; c < N_INJ_CHANNELS; c++){
+                injector_channel_t *ch = &inj_channels[c];
+                ch->period_fuel = period.fuel_nl[c];
+                ch->recon_fuel = period.recon_nl[c];
+                stats.cyl_fuel_consumed[c] += ch->period_fuel + ch->recon_fuel;
+                // Each measured injector stands in for cyl_per_channel cylinders (all of them if only one is wired up),
+                // assuming the same pulse width across those cylinders in a given 4-stroke cycle
+                period_fuel_cons += (ch->period_fuel + ch->recon_fuel) * cyl_per_channel;
+                period_fuel_raw += ch->period_fuel * cyl_per_channel;
+            }
+            if(local_pulse_count > invalid_pulse_count){ // Avoid division by 0
+                avg_pulse_width /= (local_pulse_count - invalid_pulse_count);
+            }
+            // Confidence: how much of this period's injections we actually saw
+            recon_confidence = (local_pulse_count + recon_pulse_count) ? (uint8_t)((uint32_t)local_pulse_count * 100 / (local_pulse_count + recon_pulse_count)) : 100;
+
+            // Distance travelled between the last two speed samples, trapezoidal over their measured spacing:
+            // (v0 + v1) [km/h] * dt [us] / 2 / 3600 = [mm], the remainder is carried over so the total doesn't drift
+            static uint64_t dist_rem = 0; // [km/h * us * 2]
+            uint32_t dist_tr_mm = 0;
+            if(last_speed_us){
+                uint64_t dist_kmh_us = (uint64_t)(last_speed + car_data.speed) * (uint64_t)(car_data_time.speed_us - last_speed_us) + dist_rem;
+                dist_tr_mm = dist_kmh_us / 7200;
+                dist_rem = dist_kmh_us % 7200;
             }
-
-            // Distance travelled during this 600 ms period
-            double speed_m_s = car_data.speed / 3.6; // [m/s]
-            double dist_tr_m = speed_m_s * 0.600;    // [m/s * 0.6 s]
 
 /* ---------------------------------- Update stats ----------------------------------------------- */
 
             /* Total fuel consumed and distance travelled since boot */
             stats.fuel_consumed += period_fuel_cons;
-            stats.dist_tr += dist_tr_m;
+            stats.fuel_consumed_raw += period_fuel_raw;
+            stats.dist_tr += dist_tr_mm;
             
             /* Instantaneous and average fuel consumption */ 
-            if ((dist_tr_m < 0.1) || (stats.dist_tr < 0.1)) { // Car is stationary (0 m travelled in this 600 ms period)
+            // 1 [nL/mm] = 1 [uL/m] = 1 [mL/km] = 100 [mL/100 km] = 0.1 [L/100 km]
+            if ((dist_tr_mm < 100) || (stats.dist_tr < 100)) { // Car is stationary (0 m travelled in this period)
                 stats.fuel_cons_inst = -1; // Avoid division by 0 or nonsensical values
             } else { // Car is moving so we can calculate an actual instantaneous fuel consumption
-                stats.fuel_cons_inst = period_fuel_cons / dist_tr_m * 0.1; // [L/100 km]
-                // 1 [uL/m] = 1 [mL/km] = 100 [mL/100 km] = 0.1 [L/100 km]
+                stats.fuel_cons_inst = (float)period_fuel_cons / dist_tr_mm * 0.1f; // [L/100 km]
             }
-            if(stats.dist_tr < 0.1){ // Car hasn't moved yet (0 m since boot)
+            if(stats.dist_tr < 100){ // Car hasn't moved yet (0 m since boot)
                 stats.fuel_cons_avg = -1; // Avoid division by 0 or nonsensical values
             } else{ // Car has travelled non-zero distance so we can 
-                stats.fuel_cons_avg = stats.fuel_consumed / stats.dist_tr * 0.1; // [L/100 km]
-                // 1 [uL/m] = 1 [mL/km] = 100 [mL/100 km] = 0.1 [L/100 km]
+                stats.fuel_cons_avg = (float)stats.fuel_consumed / stats.dist_tr * 0.1f; // [L/100 km]
             }
 
-            /* Running sum of fuel consumed last 6 and 60 seconds */
-            static double fuel_last_6[10] = {0};    // Stores last 6 seconds'  fuel amounts (in 600 ms intervals)
-            static double fuel_last_60[100] = {0};  // Stores last 60 seconds' fuel amounts (in 600 ms intervals)
-            static size_t index_6 = 0;
-            static size_t index_60 = 0;
-
-            // Remove oldest val
-            stats.fuel_cons_last_6  -= fuel_last_6[index_6];
-            stats.fuel_cons_last_60 -= fuel_last_60[index_60];
-            // Possible rounding error fix
-            if(stats.fuel_cons_last_6 < 0) {stats.fuel_cons_last_6 =  0;} 
-            if(stats.fuel_cons_last_60 < 0){stats.fuel_cons_last_60 = 0;}
-            // Store newest val
-            fuel_last_6[index_6] = period_fuel_cons;
-            fuel_last_60[index_60] = period_fuel_cons;
-            // Add newest to sum
-            stats.fuel_cons_last_6 += period_fuel_cons;
-            stats.fuel_cons_last_60 += period_fuel_cons;
-            // Wrap around array
-            index_6 = (index_6 + 1) % 6;
-            index_60 = (index_60 + 1) % 60;
+            /* Recent history (last 6 s, 60 s, 10 min, ...), queried by the page/LCD tasks */
+            fuel_hist_add(&fuel_hist, wake_us, period_fuel_cons, dist_tr_mm);
+
+            /* Where the fuel goes, binned by RPM and speed/load */
+            fuel_heatmap_add(inj_rpm_last ? inj_rpm_last : car_data.rpm, car_data.speed, car_data.load, period_fuel_cons, dist_tr_mm, period_us / 1000);
+
+            /* Trip segmentation: injections (or ECU-reported RPM) mean the engine runs, an ECU that answers means ignition on */
+            bool ecu_answering = car_data.success_cntr > 0;
+            bool engine_running = local_pulse_count > 0 || (ecu_answering && car_data.rpm > 0);
+            trips_update(period_us / 1000, period_fuel_cons, dist_tr_mm, car_data.speed, engine_running, ecu_answering);
 /* ----------------------------------Fuel Meter data done ----------------------------------------------- */
             xSemaphoreGive(fuel_data_mutex);
         }
+        fuel_heatmap_save_if_due(); // Outside the mutex, these are flash writes
+        trips_save_if_due();
+        pid_support_recheck(); // Bus requests and a flash write if the last period's polls marked the bitmaps stale
         xTaskNotifyGive(current_page_task_handle);
-        xTaskNotifyGive(display_task_handle);
+    }
+}
+
+void fuel_integrator_task(void *pvParameters) {
+    while (1) {
+        // Woken by the ISR for every pulse; the timeout only bounds how long a pulse can sit if a notification coalesces
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+        for(size_t c = 0; c < N_INJ_CHANNELS; c++){
+            injector_channel_t *ch = &inj_channels[c];
+            injector_pulse_t pulse;
+            while(pulse_ring_pop(&ch->ring, &pulse)){
+                fuel_integrator_pulse(c, pulse.width_us);
+                pulse_ring_push(&ch->period_ring, pulse.start_us, pulse.width_us); // On to fuel_meter_task for the period statistics
+            }
+        }
     }
 }
 
 void current_page_task(void *pvParameters) {
+    static fuel_window_t fuel_page_window;
+    TickType_t fuel_page_wake = 0;
+    bool fuel_page_open = false;
     while (1) {
+        // fuel.html runs at its own rate off the integrator, the other pages follow the 600 ms periods
+        if (strcmp(currently_open_page, "fuel.html") == 0) {
+            if (!fuel_page_open) {
+                fuel_page_open = true;
+                fuel_window_init(&fuel_page_window, FUEL_PAGE_RATE_HZ * FUEL_PAGE_WINDOW_MS / 1000 + 1);
+                fuel_page_wake = xTaskGetTickCount();
+            }
+            vTaskDelayUntil(&fuel_page_wake, pdMS_TO_TICKS(1000 / FUEL_PAGE_RATE_HZ));
+            ulTaskNotifyTake(pdTRUE, 0); // Period notifications aren't needed here
+            fuel_page_handler(&fuel_page_window);
+            continue;
+        }
+        fuel_page_open = false;
+
         // Wait for data to be ready, up to 600 + 100 ms
         uint32_t notifyCount = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(700));
 
@@ -515,8 +949,8 @@ void current_page_task(void *pvParameters) {
         else if (strcmp(currently_open_page, "debugfuel.html") == 0) {
             debug_fuel_page_handler();
         }
-        else if (strcmp(currently_open_page, "fuel.html") == 0) {
-            fuel_page_handler();
+        else if (strcmp(currently_open_page, "injector.html") == 0) {
+            injector_page_handler();
         }
         else {
             // Page not relevant, ignore notification
@@ -596,26 +1030,43 @@ i2c_fail: // We lost connection to the backpack/display; reinit and start over
     vTaskDelay(pdMS_TO_TICKS(500));
     }
 
+    fuel_window_t lcd_window;
+    fuel_window_init(&lcd_window, LCD_RATE_HZ * LCD_WINDOW_MS / 1000 + 1);
+    TickType_t last_wake = xTaskGetTickCount();
     while (1)
     {   
-        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(1000 / LCD_RATE_HZ)); // Own rate, sampled off the integrator
         reinit_cnt++;
-        if(reinit_cnt >= 120){responsive_lcd = false; goto i2c_fail;} // Periodic reinit because data on display gets corrupted over time
+        if(reinit_cnt >= LCD_RATE_HZ * LCD_REINIT_S){responsive_lcd = false; goto i2c_fail;} // Periodic reinit because data on display gets corrupted over time
         char line1[32] = {0};
         char line2[32] = {0};
         fuel_stats_t local_stats = {0};
         comms_data_pack_t local_car_data = {0};
-        // Copy locally to prevent overwrites
-        if(xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(100))){
+        // The top line cycles through the average since boot and over the last 10 minutes and hour
+        static const char *const avg_labels[] = {"Avg:", "10m:", "1h: "};
+        static const uint32_t avg_seconds[] = {0, 600, 3600};
+        size_t avg_page = reinit_cnt / (LCD_RATE_HZ * LCD_ROTATE_S) % 3;
+        float fuel_cons_avg = -1;
+        // Copy locally to prevent overwrites (no longer paced by fuel_meter_task, which may not have started yet)
+        if(fuel_data_mutex != NULL && xSemaphoreTake(fuel_data_mutex, pdMS_TO_TICKS(100))){
             local_stats = stats;
             local_car_data = car_data;
+            fuel_cons_avg = local_stats.fuel_cons_avg;
+            if(avg_seconds[avg_page]){
+                fuel_hist_span_t span;
+                fuel_hist_last(&fuel_hist, avg_seconds[avg_page], &span);
+                fuel_cons_avg = span.cons;
+            }
             xSemaphoreGive(fuel_data_mutex);
         }
+        fuel_sample_t sample;
+        fuel_integrator_sample(&sample);
+        float fuel_cons_inst = fuel_window_update(&lcd_window, &sample);
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat-truncation"
-        snprintf(line1, sizeof(line1), "Avg:%-5.1fL/100km", local_stats.fuel_cons_avg);
-        snprintf(line2, sizeof(line2), "Inst:%-2dL T:%3d%cC", (int)local_stats.fuel_cons_inst, local_car_data.coolant_temp, I2C_LCD1602_CHARACTER_DEGREE);
+        snprintf(line1, sizeof(line1), "%s%-5.1fL/100km", avg_labels[avg_page], fuel_cons_avg);
+        snprintf(line2, sizeof(line2), "Inst:%-2dL T:%3d%cC", (int)fuel_cons_inst, local_car_data.coolant_temp, I2C_LCD1602_CHARACTER_DEGREE);
 #pragma GCC diagnostic pop
 
         if(hd44780_gotoxy(&lcd, 0, 0) != ESP_OK)                {goto i2c_fail;}
@@ -624,3 +1075,56 @@ i2c_fail: // We lost connection to the backpack/display; reinit and start over
         if(hd44780_puts(&lcd, line2) != ESP_OK)                 {goto i2c_fail;}
     }
 }
+
+void scope_task(void *pvParameters) {
+    static uint8_t frame[sizeof(scope_frame_hdr_t) + SCOPE_MAX_PULSES * sizeof(scope_pulse_t)]; // Reused for every frame
+    scope_frame_hdr_t *hdr = (scope_frame_hdr_t *)frame;
+    scope_pulse_t *pulses = (scope_pulse_t *)(frame + sizeof(scope_frame_hdr_t));
+    uint32_t dropped_base[N_INJ_CHANNELS] = {0};
+
+    while (1) {
+        // Sleep until somebody subscribes
+        while(ws_scope_client_count() == 0){
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+
+        for(size_t c = 0; c < N_INJ_CHANNELS; c++){
+            dropped_base[c] = inj_channels[c].scope_ring.overflow_cnt;
+        }
+        set_scope_capture(true);
+        ESP_LOGI(TAG, "Pulse stream started");
+
+        TickType_t last_wake = xTaskGetTickCount();
+        while(ws_scope_client_count() > 0){
+            vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(1000 / scope_fps));
+
+            // Batch everything captured since the last frame; empty frames double as a heartbeat
+            uint16_t count = 0;
+            uint32_t dropped = 0;
+            for(size_t c = 0; c < N_INJ_CHANNELS; c++){
+                injector_channel_t *ch = &inj_channels[c];
+                injector_pulse_t pulse;
+                while(count < SCOPE_MAX_PULSES && pulse_ring_pop(&ch->scope_ring, &pulse)){
+                    pulses[count].start_us = pulse.start_us;
+                    pulses[count].width_us = pulse.width_us > UINT16_MAX ? UINT16_MAX : pulse.width_us;
+                    pulses[count].ch = c;
+                    count++;
+                }
+                dropped += ch->scope_ring.overflow_cnt - dropped_base[c];
+            }
+            hdr->magic = SCOPE_FRAME_MAGIC;
+            hdr->n_channels = N_INJ_CHANNELS;
+            hdr->count = count;
+            hdr->dropped = dropped;
+            send_scope_frame(frame, sizeof(scope_frame_hdr_t) + count * sizeof(scope_pulse_t));
+        }
+
+        set_scope_capture(false);
+        // Discard what's left so the next stream doesn't start with stale pulses
+        for(size_t c = 0; c < N_INJ_CHANNELS; c++){
+            injector_pulse_t pulse;
+            while(pulse_ring_pop(&inj_channels[c].scope_ring, &pulse)){}
+        }
+        ESP_LOGI(TAG, "Pulse stream stopped");
+    }
+}
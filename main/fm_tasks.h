@@ -5,16 +5,32 @@
 #include "obd9141.h"
 #include "debug.h"
 #include "phys_const.h"
+#include "pulse_ring.h"
+#include "inj_rpm.h"
+#include "isr_prof.h"
+#include "pw_stats.h"
+#include "flash_guard.h"
+#include "fuel_kernel.h"
+#include "calib.h"
+#include "fuel_integrator.h"
+#include "fuel_history.h"
+#include "fuel_heatmap.h"
+#include "trips.h"
+#include "pid_sched.h"
+#include "pid_support.h"
 
 #include "esp_timer.h"
 #include "rom/ets_sys.h"
+#include "hal/gpio_ll.h"
+#include "soc/gpio_struct.h"
 #include <math.h>
 
 #include <bmp280.h>
 #include <pcf8574.h>
 #include <hd44780.h>
 
-#define INJECTOR_PIN    GPIO_NUM_18
+#define N_INJ_CHANNELS  1                   // Number of injectors wired to GPIOs, must divide N_CYL (1 = one injector stands in for all cylinders)
+#define INJECTOR_PINS   {GPIO_NUM_18}       // One GPIO per channel, in cylinder order
 #define SCL_PIN         GPIO_NUM_22
 #define SDA_PIN         GPIO_NUM_21
 #define BMP280_ADDR     0x76
@@ -26,15 +42,70 @@
 
 
 
-#define INBETWEEN_DELAY_MS 1
-#define MAX_PULSES 64 // Max count of pulses per 500 ms, @ 12000 RPM you have 100 injections/sec or 50 injections per 500 ms, so 64 is way more than I will ever need (Corsa RPM limit 6-7k RPM)
+// #define INJECTOR_ISR_PROFILE // uncomment to enable injector ISR duration/timestamp-offset histograms (shown on debugfuel.html)
+
+#define INJECTOR_GLITCH_US  100   // [us] Pulses shorter than this are treated as noise by the ISR. Longer ones up to the profile's deadtime are injection events that carry no fuel
+#define RECON_MAX_MISSING   2     // Max consecutive injections reconciled on a gap not explained by ring overflow; longer gaps are taken as fuel cut
+
+#define SCOPE_DEFAULT_FPS   20    // [frames/s] Raw pulse stream frame rate unless the subscriber asks otherwise
+#define SCOPE_MIN_FPS       1
+#define SCOPE_MAX_FPS       50
+#define SCOPE_MAX_PULSES    256   // Pulses per frame (all channels); any excess waits in the scope rings for the next frame
+
+#define FUEL_PERIOD_MS      600   // [ms] Nominal fuel_meter_task period; the actual one is measured
+#define FUEL_LATE_WAKE_MS   20    // [ms] A wakeup this much past its due time is counted as late
+
+#define FUEL_PAGE_RATE_HZ   10    // [Hz] fuel.html update rate
+#define FUEL_PAGE_WINDOW_MS 1000  // [ms] Trailing window for fuel.html's instantaneous consumption
+#define LCD_RATE_HZ         2     // [Hz] LCD update rate
+#define LCD_WINDOW_MS       1000  // [ms] Trailing window for the LCD's instantaneous consumption
+#define LCD_REINIT_S        72    // [s] Periodic LCD reinit interval
+#define LCD_ROTATE_S        4     // [s] Per average shown on the top line (since boot, 10 min, 1 h)
+
+#define KWP_PIDS_PER_CYCLE  OBD9141_MAX_BATCH_PIDS // PIDs read per fuel_meter_task period, one batched request
  
 typedef struct bmp280_data_t {
     float amb_temp;             // [°C] Ambient (cabin) temperature
     float baro_pressure;        // [Pa] Ambient barometric pressure
 } bmp280_data_t;
 
-// Stores runtime fuel statistics
+// When each PID in car_data was last read (esp_timer), 0 = never
+typedef struct car_data_time_t {
+    int64_t load_us;
+    int64_t coolant_temp_us;
+    int64_t rpm_us;
+    int64_t speed_us;           // Also stamped on a failed read, which counts as 0 km/h
+    int64_t intake_temp_us;
+    int64_t maf_us;
+    int64_t throttle_us;
+} car_data_time_t;
+
+// One injector capture channel; the ISR owns the ring's producer side, fuel_integrator_task its consumer side and
+// period_ring's producer side, fuel_meter_task everything else.
+// Instances live in DRAM and the ISR only touches IRAM code, so capture keeps going while the flash cache is off
+typedef struct injector_channel_t {
+    gpio_num_t pin;
+    uint8_t cyl;                            // [-] Cylinder number (1-based)
+    pulse_ring_t ring;                      // Injector pulses, ISR -> fuel_integrator_task
+    pulse_ring_t period_ring;               // Integrated pulses, fuel_integrator_task -> fuel_meter_task
+    pulse_ring_t scope_ring;                // Copy of the pulses for the raw stream, ISR -> scope_task (only filled while streaming)
+    volatile uint64_t fall_time_us;         // [us] Start of the pulse in progress, 0 if none (ISR-owned)
+    volatile uint8_t last_level;            // Pin level seen by the previous interrupt (ISR-owned)
+    volatile uint32_t lost_edges;           // [-] Interrupts that saw the same level twice in a row, i.e. a pulse was lost (ISR-owned)
+    uint32_t lost_edges_seen;               // [-] lost_edges already accounted for
+    injector_pulse_t period_pulses[PULSE_RING_SIZE]; // Pulses drained from the ring for the current 600 ms period
+    uint16_t pulse_count;                   // [-] Pulses drained this period
+    uint32_t avg_pulse_width;               // [us] Average valid pulse width this period
+    uint32_t period_fuel;                   // [nL] Fuel injected this period (this cylinder only, captured pulses)
+    injector_pulse_t last_pulse;            // Last pulse processed, carried across periods for gap detection
+    bool has_last;                          // last_pulse is valid
+    uint32_t overflow_seen;                 // [-] ring.overflow_cnt already accounted for
+    uint32_t overflow_budget;               // [-] Dropped pulses not yet matched to a gap
+    uint16_t recon_count;                   // [-] Injections reconciled this period
+    uint32_t recon_fuel;                    // [nL] Fuel estimated for reconciled injections this period
+} injector_channel_t;
+
+// Stores runtime fuel statistics. Totals are exact integers (1 nL = 0.001 uL, 1 mm), converted to float only when sent/displayed
 typedef struct fuel_stats_t {
     // Instantaneous fuel consumption (based on fuel/distance in the last 600 ms)
     float fuel_cons_inst;       // [L/100 km]
@@ -42,23 +113,27 @@ typedef struct fuel_stats_t {
     // Average fuel consumption (since boot)
     float fuel_cons_avg;        // [L/100 km]
 
-    // Fuel consumed (since boot)
-    double fuel_consumed;       // [uL]
+    // Fuel consumed (since boot), including fuel estimated for missed injections
+    uint64_t fuel_consumed;     // [nL]
 
-    // Distance travelled (since boot)
-    double dist_tr;             // [m]
+    // Fuel consumed (since boot), captured pulses only
+    uint64_t fuel_consumed_raw; // [nL]
 
-    // Fuel consumed in the last 6 seconds
-    double fuel_cons_last_6;    // [uL]
+    // Distance travelled (since boot)
+    uint64_t dist_tr;           // [mm]
 
-    // Fuel consumed in the last 60 seconds
-    double fuel_cons_last_60;   // [uL]
+    // Fuel consumed per measured cylinder (since boot)
+    uint64_t cyl_fuel_consumed[N_INJ_CHANNELS]; // [nL]
 } fuel_stats_t;
 
 /* Getter/setter for fuel_stats */
 
-const fuel_stats_t *get_stats(void);
+// Copy taken under fuel_data_mutex (the 64-bit totals can't be read in one go)
+void get_stats(fuel_stats_t *get_stats);
 
+// Overwrites the averages and totals (load/clear) under fuel_data_mutex. fuel_consumed_raw and cyl_fuel_consumed[]
+// aren't stored, so they're not taken from set_stats but scaled to the new fuel_consumed with their current shares
+// (captured vs reconciled, per cylinder), and the pages keep adding up
 void set_stats(const fuel_stats_t *set_stats);
 
 /* Inits */
@@ -67,12 +142,31 @@ void init_pulse_width_gpio(void);
 
 void init_bmp280_sensor(void *pvParameters);
 
+/* Engine profile */
+
+// engine_profile_validate() plus what this build needs (cylinders a multiple of N_INJ_CHANNELS)
+bool check_engine_profile(const engine_profile_t *profile, char *msg, size_t msg_len);
+
+// Validates, derives and queues a profile; it takes over at the next 600 ms period boundary
+bool set_engine_profile(const engine_profile_t *profile, char *msg, size_t msg_len);
+
+// The newest profile set (possibly not applied yet)
+void get_engine_profile(engine_profile_t *profile);
+
+/* Raw pulse stream */
+
+void set_scope_fps(int fps);
+
 /* Fuel Meter tasks */
 
 void fuel_meter_task(void *pvParameters);
 
+void fuel_integrator_task(void *pvParameters);
+
 void current_page_task(void *pvParameters);
 
 void display_task(void *pvParameters);
 
+void scope_task(void *pvParameters);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "fuel_heatmap.h"
+#include "nvs.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "fuel_heatmap";
+
+#define HEATMAP_AXES_SIZE   (sizeof(heatmap_hdr_t) + (HEATMAP_NX + HEATMAP_NY) * sizeof(int32_t)) // Everything before the cells
+
+static SemaphoreHandle_t heatmap_mutex = NULL;
+static heatmap_cell_t cells[HEATMAP_NY][HEATMAP_NX];   // Protected by heatmap_mutex
+static bool dirty = false;                              // Changed since the last save
+static volatile bool clear_pending = false;             // Cleared, the stored copy isn't yet (set under heatmap_mutex)
+static int64_t last_save_us = 0;                        // [us]
+// Only fuel_meter_task saves (fuel_heatmap_save_if_due()), so a clear can't be overwritten by a save already under way
+
+static void put_axis(int32_t *out, const cal_axis_t *axis) {
+    for (uint16_t i = 0; i < axis->n; i++) {
+        out[i] = axis->bp ? axis->bp[i] : axis->min + axis->step * i;
+    }
+}
+
+// Header and breakpoints; also what a stored grid must match to be loaded
+static void put_axes(uint8_t *buf) {
+    heatmap_hdr_t hdr = {
+        .magic = HEATMAP_MAGIC,
+        .version = HEATMAP_VERSION,
+        .x_kind = HEATMAP_X_KIND,
+        .nx = HEATMAP_NX,
+        .ny = HEATMAP_NY,
+    };
+    memcpy(buf, &hdr, sizeof(hdr));
+    int32_t bp[HEATMAP_NX + HEATMAP_NY];
+    put_axis(bp, &HEATMAP_X_AXIS);
+    put_axis(bp + HEATMAP_NX, &HEATMAP_Y_AXIS);
+    memcpy(buf + sizeof(hdr), bp, sizeof(bp));
+}
+
+void fuel_heatmap_init(void) {
+    last_save_us = esp_timer_get_time();
+    uint8_t *stored = malloc(FUEL_HEATMAP_BLOB_SIZE);
+    uint8_t axes[HEATMAP_AXES_SIZE];
+    put_axes(axes);
+    if (stored == NULL) {
+        ESP_LOGE(TAG, "No memory to load the stored heatmap");
+    } else if (get_fuel_blob("heatmap", stored, FUEL_HEATMAP_BLOB_SIZE)) {
+        if (memcmp(stored, axes, HEATMAP_AXES_SIZE) == 0) {
+            memcpy(cells, stored + HEATMAP_AXES_SIZE, sizeof(cells));
+            ESP_LOGI(TAG, "Loaded stored heatmap");
+        } else {
+            ESP_LOGW(TAG, "Stored heatmap has different axes, starting a new one");
+        }
+    }
+    free(stored);
+    heatmap_mutex = xSemaphoreCreateMutex(); // Only now, until then the grid reads as empty
+}
+
+void fuel_heatmap_add(uint16_t rpm, uint8_t speed, uint8_t load, uint32_t fuel_nl, uint32_t dist_mm, uint32_t time_ms) {
+    if (heatmap_mutex == NULL || (fuel_nl == 0 && dist_mm == 0)) {
+        return; // Engine off and standing still, nothing to show
+    }
+#ifdef FUEL_HEATMAP_LOAD
+    int32_t x = load;
+#else
+    int32_t x = speed;
+#endif
+    heatmap_cell_t *cell = &cells[cal_axis_bin(&HEATMAP_Y_AXIS, rpm)][cal_axis_bin(&HEATMAP_X_AXIS, x)];
+    xSemaphoreTake(heatmap_mutex, portMAX_DELAY);
+    cell->fuel_nl += fuel_nl;
+    cell->dist_mm += dist_mm;
+    cell->time_ms += time_ms;
+    dirty = true;
+    xSemaphoreGive(heatmap_mutex);
+}
+
+void fuel_heatmap_blob(uint8_t *buf) {
+    put_axes(buf);
+    if (heatmap_mutex == NULL) {
+        memset(buf + HEATMAP_AXES_SIZE, 0, sizeof(cells));
+        return;
+    }
+    xSemaphoreTake(heatmap_mutex, portMAX_DELAY);
+    memcpy(buf + HEATMAP_AXES_SIZE, cells, sizeof(cells));
+    xSemaphoreGive(heatmap_mutex);
+}
+
+static void save(void) {
+    uint8_t *buf = malloc(FUEL_HEATMAP_BLOB_SIZE);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "No memory to save the heatmap");
+        return;
+    }
+    xSemaphoreTake(heatmap_mutex, portMAX_DELAY);
+    dirty = false; // Anything added or cleared from here on goes into the next save
+    clear_pending = false;
+    xSemaphoreGive(heatmap_mutex);
+    fuel_heatmap_blob(buf);
+    if (!set_fuel_blob("heatmap", buf, FUEL_HEATMAP_BLOB_SIZE)) {
+        dirty = true; // Try again next time
+    }
+    last_save_us = esp_timer_get_time();
+    free(buf);
+}
+
+void fuel_heatmap_save_if_due(void) {
+    if (heatmap_mutex && (clear_pending || (dirty && esp_timer_get_time() - last_save_us >= (int64_t)FUEL_HEATMAP_SAVE_S * 1000000))) {
+        save();
+    }
+}
+
+void fuel_heatmap_clear(void) {
+    if (heatmap_mutex == NULL) {
+        return;
+    }
+    xSemaphoreTake(heatmap_mutex, portMAX_DELAY);
+    memset(cells, 0, sizeof(cells));
+    clear_pending = true; // Stored by fuel_meter_task at the end of its period
+    xSemaphoreGive(heatmap_mutex);
+    ESP_LOGI(TAG, "Heatmap cleared");
+}
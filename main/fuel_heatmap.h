@@ -0,0 +1,72 @@
+#ifndef __FUEL_HEATMAP_H
+#define __FUEL_HEATMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "phys_const.h"
+
+// Where the fuel goes: every period's fuel, distance and time binned into an RPM x speed (or RPM x load) grid.
+// O(1)-ish per period (one bin lookup per axis), kept across drives in NVS. Writes are coalesced: the grid is
+// saved at most every FUEL_HEATMAP_SAVE_S and only if it changed. The browser gets the whole grid as one binary
+// blob (GET /heatmap) and does all the formatting itself.
+
+// #define FUEL_HEATMAP_LOAD    // uncomment to bin by engine load instead of vehicle speed (changing it discards the stored map)
+
+#define FUEL_HEATMAP_SAVE_S     300     // [s] Minimum time between NVS writes
+
+CAL_AXIS_UNIFORM(speed, 0, 20, 8);      // Vehicle speed, [km/h] (0, 20, ..., 140)
+
+#ifdef FUEL_HEATMAP_LOAD
+#define HEATMAP_X_AXIS  load_axis
+#define HEATMAP_NX      load_n
+#define HEATMAP_X_KIND  1
+#else
+#define HEATMAP_X_AXIS  speed_axis
+#define HEATMAP_NX      speed_n
+#define HEATMAP_X_KIND  0
+#endif
+#define HEATMAP_Y_AXIS  rpm_axis
+#define HEATMAP_NY      rpm_n
+
+// Blob, little-endian: header, HEATMAP_NX x breakpoints, HEATMAP_NY y breakpoints (int32 each),
+// then HEATMAP_NY rows of HEATMAP_NX cells. The same layout is stored in NVS
+#define HEATMAP_MAGIC   0x48 // 'H'
+#define HEATMAP_VERSION 1
+
+typedef struct __attribute__((packed)){
+    uint8_t magic;          // HEATMAP_MAGIC
+    uint8_t version;        // HEATMAP_VERSION
+    uint8_t x_kind;         // 0 = speed [km/h], 1 = load [%]; y is always RPM
+    uint8_t nx;
+    uint8_t ny;
+    uint8_t reserved[3];
+} heatmap_hdr_t;
+
+typedef struct __attribute__((packed)){
+    uint64_t fuel_nl;       // [nL]
+    uint64_t dist_mm;       // [mm]
+    uint64_t time_ms;       // [ms]
+} heatmap_cell_t;
+
+#define FUEL_HEATMAP_BLOB_SIZE (sizeof(heatmap_hdr_t) + (HEATMAP_NX + HEATMAP_NY) * sizeof(int32_t) + \
+                                HEATMAP_NX * HEATMAP_NY * sizeof(heatmap_cell_t))
+
+// Loads the stored grid (NVS must be up), starts empty if there is none or its axes don't match
+void fuel_heatmap_init(void);
+
+// One period
+void fuel_heatmap_add(uint16_t rpm, uint8_t speed, uint8_t load, uint32_t fuel_nl, uint32_t dist_mm, uint32_t time_ms);
+
+// Saves if the grid changed and the last save is at least FUEL_HEATMAP_SAVE_S old, or right away after a clear.
+// fuel_meter_task only, the one task that writes the stored copy
+void fuel_heatmap_save_if_due(void);
+
+// Empties the grid now, the stored copy with the next fuel_heatmap_save_if_due()
+void fuel_heatmap_clear(void);
+
+// Serialises the grid into buf (FUEL_HEATMAP_BLOB_SIZE bytes)
+void fuel_heatmap_blob(uint8_t *buf);
+
+#endif
@@ -0,0 +1,92 @@
+#include "fuel_history.h"
+
+#include <string.h>
+
+static const uint8_t hist_ratios[FUEL_HIST_LEVELS] = FUEL_HIST_RATIOS;
+
+_Static_assert(FUEL_HIST_SLOTS <= UINT8_MAX, "slot indices are uint8_t");
+_Static_assert(FUEL_HIST_SLOTS > 10, "a level must reach back further than one bucket of the next level");
+
+// i = 0 is the oldest valid slot
+static const fuel_hist_snap_t *level_snap(const fuel_hist_level_t *level, uint8_t i) {
+    return &level->slot[(level->head + FUEL_HIST_SLOTS - level->count + i) % FUEL_HIST_SLOTS];
+}
+
+static void level_push(fuel_hist_level_t *level, const fuel_hist_snap_t *snap) {
+    level->slot[level->head] = *snap;
+    level->head = (level->head + 1) % FUEL_HIST_SLOTS;
+    if (level->count < FUEL_HIST_SLOTS) {
+        level->count++;
+    }
+}
+
+void fuel_hist_init(fuel_hist_t *hist, int64_t time_us) {
+    memset(hist, 0, sizeof(fuel_hist_t));
+    hist->now.time_us = time_us;
+    for (size_t l = 0; l < FUEL_HIST_LEVELS; l++) {
+        level_push(&hist->level[l], &hist->now); // Every level starts at boot, so short histories answer "since boot"
+    }
+}
+
+void fuel_hist_add(fuel_hist_t *hist, int64_t time_us, uint32_t fuel_nl, uint32_t dist_mm) {
+    hist->now.time_us = time_us;
+    hist->now.fuel_nl += fuel_nl;
+    hist->now.dist_mm += dist_mm;
+    for (size_t l = 0; l < FUEL_HIST_LEVELS; l++) {
+        fuel_hist_level_t *level = &hist->level[l];
+        if (++level->sub < hist_ratios[l]) {
+            break; // Coarser levels aren't due either
+        }
+        level->sub = 0;
+        level_push(level, &hist->now);
+    }
+}
+
+void fuel_hist_last(const fuel_hist_t *hist, uint32_t seconds, fuel_hist_span_t *span) {
+    int64_t target = hist->now.time_us - (int64_t)seconds * 1000000;
+
+    // Finest level that reaches back far enough, else the coarsest (as far back as we have)
+    const fuel_hist_level_t *level = &hist->level[FUEL_HIST_LEVELS - 1];
+    for (size_t l = 0; l < FUEL_HIST_LEVELS; l++) {
+        if (level_snap(&hist->level[l], 0)->time_us <= target) {
+            level = &hist->level[l];
+            break;
+        }
+    }
+
+    // Newest snapshot at or before the target (binary search, times are increasing), and the one after it
+    const fuel_hist_snap_t *before = level_snap(level, 0);
+    const fuel_hist_snap_t *after = &hist->now;
+    if (before->time_us < target) {
+        uint8_t lo = 0, hi = level->count; // before is in [lo, hi)
+        while (hi - lo > 1) {
+            uint8_t mid = (lo + hi) / 2;
+            if (level_snap(level, mid)->time_us <= target) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        before = level_snap(level, lo);
+        if (hi < level->count) {
+            after = level_snap(level, hi);
+        }
+    } else {
+        target = before->time_us; // History doesn't reach back that far
+    }
+
+    // Totals at the target, linearly interpolated within the bucket
+    uint64_t fuel_at = before->fuel_nl;
+    uint64_t dist_at = before->dist_mm;
+    if (after->time_us > before->time_us && target > before->time_us) {
+        float frac = (float)(target - before->time_us) / (float)(after->time_us - before->time_us);
+        fuel_at += (uint64_t)((after->fuel_nl - before->fuel_nl) * frac);
+        dist_at += (uint64_t)((after->dist_mm - before->dist_mm) * frac);
+    }
+
+    span->fuel_nl = hist->now.fuel_nl - fuel_at;
+    span->dist_mm = hist->now.dist_mm - dist_at;
+    span->span_ms = (uint32_t)((hist->now.time_us - target) / 1000);
+    // 1 [nL/mm] = 1 [uL/m] = 1 [mL/km] = 100 [mL/100 km] = 0.1 [L/100 km]
+    span->cons = span->dist_mm < 100 ? -1 : (float)span->fuel_nl / span->dist_mm * 0.1f;
+}
@@ -0,0 +1,51 @@
+#ifndef __FUEL_HISTORY_H
+#define __FUEL_HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Multi-resolution fuel/distance history: cascading rings of cumulative snapshots at 600 ms, 6 s, 1 min, 10 min
+// and 1 h resolution. Every level stores running totals (prefix sums) rather than per-bucket amounts, so the fuel
+// and distance over the last N seconds is the newest total minus the total at now - N, interpolated between the
+// two snapshots of the finest level that reaches back that far. Adding a period is O(1) (amortised, a push
+// cascades to the next level every FUEL_HIST_RATIOS[level] pushes); all memory is in fuel_hist_t.
+
+#define FUEL_HIST_LEVELS    5
+#define FUEL_HIST_RATIOS    {1, 10, 10, 10, 6}  // Pushes into the previous level per push into this one (level 0: per period)
+#define FUEL_HIST_SLOTS     24                  // Snapshots per level; level 0 reaches back ~14 s, the last one ~23 h
+
+typedef struct fuel_hist_snap_t {
+    int64_t time_us;            // [us] esp_timer time of the period end
+    uint64_t fuel_nl;           // [nL] Total since fuel_hist_init()
+    uint64_t dist_mm;           // [mm] Total since fuel_hist_init()
+} fuel_hist_snap_t;
+
+typedef struct fuel_hist_level_t {
+    fuel_hist_snap_t slot[FUEL_HIST_SLOTS];
+    uint8_t head;               // Next slot to write
+    uint8_t count;              // Valid slots
+    uint8_t sub;                // Pushes into the previous level since the last push into this one
+} fuel_hist_level_t;
+
+typedef struct fuel_hist_t {
+    fuel_hist_level_t level[FUEL_HIST_LEVELS];
+    fuel_hist_snap_t now;       // Newest totals
+} fuel_hist_t;
+
+// Fuel and distance over a trailing span
+typedef struct fuel_hist_span_t {
+    uint64_t fuel_nl;           // [nL]
+    uint64_t dist_mm;           // [mm]
+    uint32_t span_ms;           // [ms] Actual span, shorter than asked for until the history reaches back that far
+    float cons;                 // [L/100 km], -1 if stationary (< 0.1 m)
+} fuel_hist_span_t;
+
+void fuel_hist_init(fuel_hist_t *hist, int64_t time_us);
+
+// One period's fuel and distance, ending at time_us
+void fuel_hist_add(fuel_hist_t *hist, int64_t time_us, uint32_t fuel_nl, uint32_t dist_mm);
+
+// Over the last seconds (up to the newest period end)
+void fuel_hist_last(const fuel_hist_t *hist, uint32_t seconds, fuel_hist_span_t *span);
+
+#endif
@@ -0,0 +1,224 @@
+#include "fuel_integrator.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+// Everything below is touched with integ_mux held, for a few hundred cycles at most; the per-pulse maths runs outside it
+static portMUX_TYPE integ_mux = portMUX_INITIALIZER_UNLOCKED;
+static fuel_model_t model;              // Copy, so the caller's can change under us
+static fuel_kernel_t kernel;
+static uint8_t n_channels = 1;
+static uint8_t cyl_per_channel = 1;
+static fuel_held_t held_map = {MAP_DEFAULT, 0};
+static fuel_held_t held_baro = {P_BAROMETRIC_BASELINE, 0};
+static fuel_held_t held_speed = {0, 0};
+static uint32_t max_width = UINT32_MAX; // [us]
+static uint32_t model_gen = 0;          // Bumped with every model change, pulses computed against an older one are redone
+
+static uint64_t fuel_pl = 0;            // [pL] All cylinders
+static uint64_t fuel_raw_pl = 0;        // [pL] All cylinders, captured only
+static uint64_t dist_kmh_us = 0;        // [km/h * us] = [um * 3.6]
+static int64_t dist_time_us = 0;        // [us] dist_kmh_us is integrated up to here
+static uint32_t pulses = 0;
+static uint64_t period_pl[FUEL_INT_MAX_CHANNELS];       // [pL] Per channel, not yet handed out
+static uint64_t period_recon_pl[FUEL_INT_MAX_CHANNELS]; // [pL]
+
+// Held speed over the time since the last event (mux held)
+static void advance_distance(int64_t now) {
+    if (now > dist_time_us) {
+        dist_kmh_us += (uint64_t)held_speed.value * (now - dist_time_us);
+        dist_time_us = now;
+    }
+}
+
+// Derived outside the mux (software double sqrt); only the setters' task writes held_map/held_baro, so reading them
+// here without it is safe
+static void update_kernel(void) {
+    fuel_kernel_t k;
+    fuel_kernel_init(&k, &model, held_baro.value, held_map.value);
+    taskENTER_CRITICAL(&integ_mux);
+    kernel = k;
+    kernel.model = &model;
+    taskEXIT_CRITICAL(&integ_mux);
+}
+
+void fuel_integrator_init(uint8_t channels, const fuel_model_t *fuel_model) {
+    n_channels = channels < FUEL_INT_MAX_CHANNELS ? channels : FUEL_INT_MAX_CHANNELS;
+    dist_time_us = esp_timer_get_time();
+    fuel_integrator_set_model(fuel_model);
+}
+
+/* Inputs */
+
+void fuel_integrator_set_model(const fuel_model_t *fuel_model) {
+    fuel_kernel_t k;
+    fuel_kernel_init(&k, fuel_model, held_baro.value, held_map.value);
+    taskENTER_CRITICAL(&integ_mux);
+    model = *fuel_model;
+    model_gen++;
+    cyl_per_channel = model.n_cyl / n_channels;
+    kernel = k;
+    kernel.model = &model;
+    taskEXIT_CRITICAL(&integ_mux);
+}
+
+void fuel_integrator_set_map(uint32_t map) {
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL(&integ_mux);
+    bool changed = map != held_map.value;
+    held_map.value = map;
+    held_map.time_us = now;
+    taskEXIT_CRITICAL(&integ_mux);
+    if (changed) {
+        update_kernel();
+    }
+}
+
+void fuel_integrator_set_baro(uint32_t baro) {
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL(&integ_mux);
+    bool changed = baro != held_baro.value;
+    held_baro.value = baro;
+    held_baro.time_us = now;
+    taskEXIT_CRITICAL(&integ_mux);
+    if (changed) {
+        update_kernel();
+    }
+}
+
+void fuel_integrator_set_speed(uint8_t speed) {
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL(&integ_mux);
+    advance_distance(now); // The old speed up to now
+    held_speed.value = speed;
+    held_speed.time_us = now;
+    taskEXIT_CRITICAL(&integ_mux);
+}
+
+void fuel_integrator_set_max_width(uint32_t max_width_us) {
+    taskENTER_CRITICAL(&integ_mux);
+    max_width = max_width_us;
+    taskEXIT_CRITICAL(&integ_mux);
+}
+
+/* Events */
+
+// [pL] One injection, computed outside the mux from a snapshot of the kernel so interrupts stay unmasked for the
+// maths; false (0 pL) if out of range. The model the snapshot points into is only rewritten by
+// fuel_integrator_set_model(), which bumps model_gen, so the caller redoes it if *gen is stale by the time it adds
+static bool pulse_pl(uint32_t width_us, uint32_t *gen, uint64_t *pl) {
+    taskENTER_CRITICAL(&integ_mux);
+    fuel_kernel_t k = kernel;
+    uint32_t max = max_width;
+    *gen = model_gen;
+    taskEXIT_CRITICAL(&integ_mux);
+    *pl = 0;
+    if (width_us <= k.model->deadtime || width_us >= max) {
+        return false; // Needle never lifted, or longer than the whole cycle
+    }
+    *pl = fuel_acc_to_pl(&k, fuel_pulse(&k, width_us));
+    return true;
+}
+
+bool fuel_integrator_pulse(uint8_t ch, uint32_t width_us) {
+    int64_t now = esp_timer_get_time();
+    while (1) {
+        uint32_t gen;
+        uint64_t pl;
+        bool valid = pulse_pl(width_us, &gen, &pl);
+        taskENTER_CRITICAL(&integ_mux);
+        if (gen == model_gen) {
+            advance_distance(now);
+            pulses++;
+            period_pl[ch] += pl;
+            fuel_pl += pl * cyl_per_channel;
+            fuel_raw_pl += pl * cyl_per_channel;
+            taskEXIT_CRITICAL(&integ_mux);
+            return valid;
+        }
+        taskEXIT_CRITICAL(&integ_mux); // A new model came in meanwhile
+    }
+}
+
+void fuel_integrator_recon(uint8_t ch, uint16_t missing, uint32_t est_width_us) {
+    while (1) {
+        uint32_t gen;
+        uint64_t pl;
+        pulse_pl(est_width_us, &gen, &pl);
+        pl *= missing;
+        taskENTER_CRITICAL(&integ_mux);
+        if (gen == model_gen) {
+            period_recon_pl[ch] += pl;
+            fuel_pl += pl * cyl_per_channel;
+            taskEXIT_CRITICAL(&integ_mux);
+            return;
+        }
+        taskEXIT_CRITICAL(&integ_mux);
+    }
+}
+
+/* Consumers */
+
+void fuel_integrator_sample(fuel_sample_t *sample) {
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL(&integ_mux);
+    sample->time_us = now;
+    sample->fuel_pl = fuel_pl;
+    sample->fuel_raw_pl = fuel_raw_pl;
+    uint64_t dist = dist_kmh_us + (now > dist_time_us ? (uint64_t)held_speed.value * (now - dist_time_us) : 0);
+    sample->pulses = pulses;
+    sample->map = held_map;
+    sample->baro = held_baro;
+    sample->speed = held_speed;
+    taskEXIT_CRITICAL(&integ_mux);
+    sample->dist_um = dist * 10 / 36;
+}
+
+void fuel_integrator_take_period(fuel_period_t *period) {
+    taskENTER_CRITICAL(&integ_mux);
+    for (uint8_t c = 0; c < n_channels; c++) {
+        period->fuel_nl[c] = period_pl[c] / 1000;
+        period_pl[c] -= (uint64_t)period->fuel_nl[c] * 1000;
+        period->recon_nl[c] = period_recon_pl[c] / 1000;
+        period_recon_pl[c] -= (uint64_t)period->recon_nl[c] * 1000;
+    }
+    taskEXIT_CRITICAL(&integ_mux);
+}
+
+void fuel_integrator_take_recon(fuel_period_t *period) {
+    taskENTER_CRITICAL(&integ_mux);
+    for (uint8_t c = 0; c < n_channels; c++) {
+        uint32_t recon_nl = period_recon_pl[c] / 1000;
+        period_recon_pl[c] -= (uint64_t)recon_nl * 1000;
+        period->recon_nl[c] += recon_nl;
+    }
+    taskEXIT_CRITICAL(&integ_mux);
+}
+
+void fuel_window_init(fuel_window_t *window, uint8_t len) {
+    memset(window, 0, sizeof(fuel_window_t));
+    window->len = len < 2 ? 2 : (len > FUEL_WINDOW_MAX ? FUEL_WINDOW_MAX : len);
+}
+
+float fuel_window_update(fuel_window_t *window, const fuel_sample_t *sample) {
+    window->entry[window->idx].time_us = sample->time_us;
+    window->entry[window->idx].fuel_pl = sample->fuel_pl;
+    window->entry[window->idx].dist_um = sample->dist_um;
+    window->idx = (window->idx + 1) % window->len;
+    if (window->count < window->len) {
+        window->count++;
+    }
+    if (window->count < 2) {
+        return -1;
+    }
+    // Oldest sample in the window: the next slot to be overwritten once it's full, the first one before that
+    uint8_t oldest = window->count == window->len ? window->idx : 0;
+    uint64_t dist_um = sample->dist_um - window->entry[oldest].dist_um;
+    if (dist_um < 100000) { // < 0.1 m: stationary
+        return -1;
+    }
+    // 1 [pL/um] = 1 [uL/m] = 1 [mL/km] = 0.1 [L/100 km]
+    return (float)(sample->fuel_pl - window->entry[oldest].fuel_pl) / dist_um * 0.1f;
+}
@@ -0,0 +1,94 @@
+#ifndef __FUEL_INTEGRATOR_H
+#define __FUEL_INTEGRATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fuel_kernel.h"
+
+// Event-driven fuel integration: every captured pulse is turned into fuel as soon as the capture path hands it over
+// (fuel_integrator_task wakes up on each pulse), so the running totals are always current. Consumers snapshot them at
+// their own rate with fuel_integrator_sample() and get consumption over a trailing window of their own samples.
+// The slow inputs (MAP, barometric pressure, vehicle speed) are sample-and-hold values stamped with the time they
+// were taken; the kernel is re-derived when one of them changes, never per pulse.
+// Fuel is kept in picolitres so per-pulse rounding stays far below a nanolitre; periods are handed out in whole
+// nanolitres with the remainder carried over.
+
+#define FUEL_INT_MAX_CHANNELS   4   // Capture channels the integrator keeps totals for
+#define FUEL_WINDOW_MAX         20  // Samples a consumer's trailing window can span
+
+// Sample-and-hold input
+typedef struct fuel_held_t {
+    uint32_t value;
+    int64_t time_us;                // [us] esp_timer time it was taken, 0 = never (default value in use)
+} fuel_held_t;
+
+typedef struct fuel_sample_t {
+    int64_t time_us;                // [us] When the sample was taken
+    uint64_t fuel_pl;               // [pL] All cylinders (since boot), including reconciled injections
+    uint64_t fuel_raw_pl;           // [pL] All cylinders (since boot), captured pulses only
+    uint64_t dist_um;               // [um] Held speed integrated over time (since boot), up to time_us
+    uint32_t pulses;                // [-] Pulses integrated (since boot)
+    fuel_held_t map;                // [Pa]
+    fuel_held_t baro;               // [Pa]
+    fuel_held_t speed;              // [km/h]
+} fuel_sample_t;
+
+// Fuel handed over to the 600 ms statistics, per capture channel (one cylinder each)
+typedef struct fuel_period_t {
+    uint32_t fuel_nl[FUEL_INT_MAX_CHANNELS];    // [nL] Captured pulses
+    uint32_t recon_nl[FUEL_INT_MAX_CHANNELS];   // [nL] Reconciled injections
+} fuel_period_t;
+
+// A consumer's trailing window: the last len samples it took
+typedef struct fuel_window_t {
+    struct {
+        int64_t time_us;
+        uint64_t fuel_pl;
+        uint64_t dist_um;
+    } entry[FUEL_WINDOW_MAX];
+    uint8_t len;
+    uint8_t idx;
+    uint8_t count;
+} fuel_window_t;
+
+void fuel_integrator_init(uint8_t n_channels, const fuel_model_t *model);
+
+/* Inputs (sample-and-hold), from fuel_meter_task */
+
+void fuel_integrator_set_model(const fuel_model_t *model);
+
+void fuel_integrator_set_map(uint32_t map);
+
+void fuel_integrator_set_baro(uint32_t baro);
+
+void fuel_integrator_set_speed(uint8_t speed);
+
+// Pulses at or above this width are longer than the whole cycle and carry no fuel
+void fuel_integrator_set_max_width(uint32_t max_width_us);
+
+/* Events */
+
+// One captured pulse, from fuel_integrator_task. Returns false if it carries no fuel (out of range)
+bool fuel_integrator_pulse(uint8_t ch, uint32_t width_us);
+
+// Injections the capture path missed, estimated from their neighbours' width
+void fuel_integrator_recon(uint8_t ch, uint16_t missing, uint32_t est_width_us);
+
+/* Consumers */
+
+void fuel_integrator_sample(fuel_sample_t *sample);
+
+// Fuel since the last call, in whole [nL]
+void fuel_integrator_take_period(fuel_period_t *period);
+
+// Reconciled fuel since the last take, added to period->recon_nl; for injections reconciled after the period was taken
+void fuel_integrator_take_recon(fuel_period_t *period);
+
+// len: samples the window spans, e.g. 11 at 10 Hz for 1 s
+void fuel_window_init(fuel_window_t *window, uint8_t len);
+
+// Adds a sample; returns [L/100 km] over the window, -1 while stationary or not enough samples yet
+float fuel_window_update(fuel_window_t *window, const fuel_sample_t *sample);
+
+#endif
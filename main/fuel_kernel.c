@@ -0,0 +1,170 @@
+#include "fuel_kernel.h"
+#include <math.h>
+
+static fuel_lut_info_t lut_info = {0};
+
+// [us] Effective open time, exact model
+static double fuel_eff_exact(const fuel_model_t *model, double r) {
+    if (r <= 0) {
+        return 0;
+    }
+    if (r >= model->ramp_up) {
+        return (r - model->ramp_up) + model->ramps2 * 0.5;
+    }
+    double ratio = r / model->ramp_up;
+    return ratio * ratio * model->ramps2 * 0.5;
+}
+
+static void fuel_lut_build(fuel_model_t *model) {
+    // Lookups only ever land before full opening, so the last entry continues the parabola
+    // (the one cell straddling the kink would otherwise be interpolated across it)
+    model->lut_n = (model->ramp_up + FUEL_LUT_STEP_US - 1) / FUEL_LUT_STEP_US + 1;
+    for (uint32_t i = 0; i < model->lut_n; i++) {
+        double ratio = (double)(i * FUEL_LUT_STEP_US) / model->ramp_up;
+        model->lut_q8[i] = (uint32_t)(ratio * ratio * model->ramps2 * 0.5 * 256 + 0.5);
+    }
+
+    // Worst case over every microsecond of the table's range
+    double max_err_us = 0, max_rel = 0;
+    const double min_eff_us = 0.1 / model->static_flow_rate * 1000; // [us] 0.1 uL at the nominal flow rate
+    for (uint32_t w = model->deadtime; w < model->full_opening; w++) {
+        double exact = fuel_eff_exact(model, w - model->deadtime);
+        double err = fabs(fuel_eff_q8(model, w) / 256.0 - exact);
+        if (err > max_err_us) {max_err_us = err;}
+        if (exact > min_eff_us && err / exact > max_rel) {max_rel = err / exact;}
+    }
+    lut_info.rebuilds++;
+    lut_info.max_err_ul = max_err_us * model->static_flow_rate * 0.001;
+    lut_info.max_err_pct = max_rel * 100;
+}
+
+void fuel_model_init(fuel_model_t *model, const engine_profile_t *profile) {
+    model->deadtime = profile->deadtime;
+    model->full_opening = profile->full_opening_time;
+    model->ramp_up = profile->full_opening_time - profile->deadtime;
+    model->ramp_down = profile->full_closing_time;  // Same thing, using for consistency with ramp-up time
+    model->reset_time = profile->reset_time;
+    model->n_cyl = profile->n_cyl;
+    model->rail_pressure = profile->rail_pressure;
+    model->static_flow_pressure = profile->static_flow_pressure;
+
+    model->static_flow_rate = profile->static_flow_ml_min / 60.0;   // [mL/min] -> [mL/s] or [uL/ms]
+    model->ramp_up_half_ms = model->ramp_up * 0.5 * 0.001;
+    model->ramp_down_half_ms = model->ramp_down * 0.5 * 0.001;
+    model->inv_ramp_up_sq = 1.0 / ((double)model->ramp_up * model->ramp_up);
+    model->ramps2 = model->ramp_up + model->ramp_down;
+    model->partial_q40 = (((uint64_t)model->ramps2 << 40) + model->ramp_up * model->ramp_up) / (2ULL * model->ramp_up * model->ramp_up);
+    model->eff_full_ramps_q8 = model->ramps2 << 7;
+
+    fuel_lut_build(model);
+}
+
+const fuel_lut_info_t *fuel_lut_info(void) {
+    return &lut_info;
+}
+
+void fuel_kernel_init(fuel_kernel_t *kernel, const fuel_model_t *model, uint32_t p_barometric, uint32_t map) {
+    kernel->model = model;
+    uint32_t p_across_inj = model->rail_pressure + (p_barometric - map);  // Current pressure across injector, can vary between 4.0 bar @ WOT and 4.7 bar @ idle
+
+    /* Reference */
+    double p_ratio = (double)p_barometric / P_BAROMETRIC_BASELINE;
+    double deltap_coeff = sqrt((double)p_across_inj / model->static_flow_pressure); // Coeffcient for static fuel flow rate @ measured pressure across injector, based on delta-P square law
+
+    kernel->coeff = model->static_flow_rate * deltap_coeff * p_ratio;
+    // [uL/ms]    = [uL/ms]          * (1.00 ~ 1.08)   * (0.52 ~ 1.05)
+    //  coeff     = flow @ 4.0 bar   * (4.0 ~ 4.7 bar) * (0.52 ~ 1.05 bar)
+    //                         pressure across injector  atmospheric pressure
+
+    /* Fixed point, the same coefficient rounded to Q32 */
+    // Once per period, so the software double costs nothing; Q20 factors multiplied in integer math were off by
+    // up to ~1e-6, over 0.001 uL on the longest pulses
+    kernel->k_full_q32 = (uint32_t)(kernel->coeff * 0.001 * 4294967296.0 + 0.5); // [uL/ms] -> [uL/us, Q32]
+    // Partial pulse: (r / RU)^2 * (RU + RD) / 2 [us] of effective open time; Q32 * Q40 -> Q40
+    kernel->k_partial_q40 = ((uint64_t)kernel->k_full_q32 * model->partial_q40 + (1ULL << 31)) >> 32;
+}
+
+double fuel_pulse_double(const fuel_kernel_t *kernel, uint32_t pulse_width) {
+    const fuel_model_t *model = kernel->model;
+    const double fuel_coeff = kernel->coeff;
+    double pulse_fuel = 0;
+    if(pulse_width <= model->deadtime) { // Needle never lifts
+        return 0;
+    }
+    if(pulse_width >= model->full_opening) { // Pulse has full ramp-up and ramp-down
+        uint32_t static_flow_width = pulse_width - model->full_opening;
+        pulse_fuel = (model->ramp_up_half_ms + static_flow_width * 0.001 + model->ramp_down_half_ms) * fuel_coeff; // [uL]
+        //           (        [ms]          +       [us] * 0.001       +          [ms]          )  * [uL/ms] = [uL]
+
+        // Ramp-up/ramp-down fuel amount is calculated as area of right triangle formed by injector ramp-up/ramp-down time on x-axis, 
+        // static flow rate coefficient on y-axis, and the change of flow rate over ramp time as a linear function
+        /*
+
+        Injector pulse, [ms]
+        /\ 
+        |  start                 end
+    HIGH|_____                    __________________
+        |     |                  |
+        |     |                  |
+     LOW|     |__________________|
+
+        Fuel flow rate, [uL/ms]
+        /\
+        |start of pulse__________v--- end of pulse
+        |     |       /|         |\
+        |     |      / |coeff    | \
+        |_____v_____/__|_________|__\___________> time, [ms]
+              dead  ramp-up      ramp-down
+              time  time         time      
+
+        Ramp-up time + Static flow time + Ramp-down time
+        
+        Area of trapezoid is total fuel injected! 
+
+        */
+
+    }
+    else{ // Pulse has partial ramp-up and ramp-down
+        double full_ramp_up_fuel = model->ramp_up_half_ms * fuel_coeff;
+        double full_ramp_down_fuel = model->ramp_down_half_ms * fuel_coeff;
+
+        uint32_t ramp_up_width = pulse_width - model->deadtime;
+        double partial_coeff = (double)ramp_up_width * ramp_up_width * model->inv_ramp_up_sq; // (partial / full)^2
+
+        double partial_ramp_up_fuel = partial_coeff * full_ramp_up_fuel;
+        double partial_ramp_down_fuel = partial_coeff * full_ramp_down_fuel;
+        pulse_fuel = partial_ramp_up_fuel + partial_ramp_down_fuel;
+
+        // Partial ramp-up/ramp-down pulses end up being triangles proportional to the 100% triangle ramps from above
+        // their sides are in a ratio of (partial/full), which is in the range (0; 1), and their areas (fuel injected) are proportional to
+        // the full ramp triangles in a ratio of (partial/full)^2.
+        // Example: if full ramp-up time is 0.650 ms, partial ramp-up time is 0.325 ms, their ratio is 0.325/0.650 = 1/2;
+        // so their areas (and the injected fuel) are in the ratio (1/2)^2 = 1/4.
+
+        /*
+
+        Injector pulse, [ms]
+        /\ 
+        |   start         end
+    HIGH|_______           __________________
+        |       |         |
+        |       |         |
+     LOW|       |_________|
+
+        Fuel flow rate, [uL/ms]
+        /\
+        |start of pulse   v--- end of pulse
+        |       |        /|\
+        |       |       / | \
+        |_______v______/__|__\___________> time, [ms]
+                 dead ramp ramp
+                 time up   down
+                      time time      
+        Partial ramp-up time + partial ramp-down time
+
+        Area of triangles is total fuel injected! 
+
+        */
+    }
+    return pulse_fuel;
+}
@@ -0,0 +1,151 @@
+#ifndef __FUEL_KERNEL_H
+#define __FUEL_KERNEL_H
+
+#include <stdint.h>
+
+#include "phys_const.h"
+#include "engine_profile.h"
+
+// Fuel injected per pulse: trapezoid flow model with partial ramps for pulses that never fully open the injector.
+// The injector timings come from the active engine profile, derived into a fuel_model_t once per profile load.
+// The flow coefficient (pressure across the injector and ambient pressure corrections) is set up once per period;
+// the per-pulse part comes in three builds:
+//  - LUT (default): pulse width -> effective open time table walk; fuel is linear in the coefficient,
+//    so it's applied with a single multiply (fuel_acc_to_pl())
+//  - fixed point: integer multiply-shift only, Q16 [uL]
+//  - double: the reference, software-emulated on the ESP32 (no double-precision FPU)
+// All are always compiled so they can be compared on-device (fuel_kernel_benchmark() in debug.c).
+// Over 0-400 ms pulses and the whole MAP/ambient pressure range the fixed-point kernel stays within
+// FUEL_FIXED_MAX_ERR_UL of the reference per pulse, and FUEL_FIXED_MAX_ERR_REL for pulses above
+// FUEL_FIXED_REL_MIN_UL (checked on the host by tools/fuel_kernel_diff).
+
+#define FUEL_KERNEL_DOUBLE  0
+#define FUEL_KERNEL_FIXED   1
+#define FUEL_KERNEL_LUT     2
+#define FUEL_KERNEL FUEL_KERNEL_LUT // Kernel used for fuel accounting
+
+#define FUEL_Q16_ONE (1UL << 16)
+
+#define FUEL_FIXED_MAX_ERR_UL   0.001   // [uL] Fixed-point kernel vs the reference, per pulse
+#define FUEL_FIXED_MAX_ERR_REL  0.0001  // [-] Same, relative (0.01%) ...
+#define FUEL_FIXED_REL_MIN_UL   0.1     // [uL] ... for pulses above this, below it the Q16 LSB dominates
+
+// Effective open time LUT. Only the partial-ramp region (deadtime to full opening) is curved, everything past it
+// is exactly linear, so that's all the table covers. Error grows with the step squared (measured by fuel_lut_build()),
+// for the built-in profile (650 us ramp-up):
+//   step [us]    4       8       16      32      64
+//   RAM [B]      656     332     168     88      48      (in use, the array is sized for FUEL_LUT_MAX_RAMP_US)
+//   max [uL]     0.00002 0.00007 0.00025 0.0010  0.0039
+//   max [%]      0.013   0.054   0.23    0.83    3.8     (pulses > 0.1 uL)
+#define FUEL_LUT_STEP_SHIFT 4                                   // Step = 16 us
+#define FUEL_LUT_STEP_US    (1UL << FUEL_LUT_STEP_SHIFT)
+#define FUEL_LUT_MAX_RAMP_US 2000                               // [us] Longest ramp-up a profile may have
+#define FUEL_LUT_MAX_N      ((FUEL_LUT_MAX_RAMP_US + FUEL_LUT_STEP_US - 1) / FUEL_LUT_STEP_US + 1)
+
+// Everything the kernels need from an engine profile, derived once per profile load so the per-pulse path is
+// compares, multiplies and shifts only
+typedef struct fuel_model_t {
+    uint32_t deadtime;          // [us]
+    uint32_t full_opening;      // [us]
+    uint32_t ramp_up;           // [us] Deadtime -> full opening
+    uint32_t ramp_down;         // [us] Pulse end -> fully closed
+    uint32_t reset_time;        // [us]
+    uint8_t n_cyl;              // [-]
+    uint32_t rail_pressure;     // [Pa]
+    uint32_t static_flow_pressure; // [Pa]
+    double static_flow_rate;    // [uL/ms] At static_flow_pressure
+    double ramp_up_half_ms;     // [ms] Full ramp-up triangle, as static flow time
+    double ramp_down_half_ms;   // [ms] Full ramp-down triangle, as static flow time
+    double inv_ramp_up_sq;      // [1/us^2] Partial ramps scale with (r / ramp_up)^2
+    uint64_t partial_q40;       // [1/us, Q40] (ramp_up + ramp_down) / (2 * ramp_up^2)
+    uint32_t ramps2;            // [us] ramp_up + ramp_down, twice the full ramps' effective open time
+    uint32_t eff_full_ramps_q8; // [us, Q8] Full ramp-up + ramp-down triangles count half
+    uint16_t lut_n;             // [-] LUT entries in use, the last one at or past full opening
+    uint32_t lut_q8[FUEL_LUT_MAX_N]; // [us, Q8] Effective open time at deadtime + i * FUEL_LUT_STEP_US
+} fuel_model_t;
+
+typedef struct fuel_kernel_t {
+    const fuel_model_t *model;  // Injector timings
+    double coeff;               // [uL/ms] Flow coefficient at the current pressures (reference kernel)
+    uint32_t k_full_q32;        // [uL/us, Q32] Same coefficient, per microsecond of effective open time
+    uint32_t k_partial_q40;     // [uL/us^2, Q40] Partial pulses: fuel = r^2 * k_partial, r = width past deadtime
+} fuel_kernel_t;
+
+typedef struct fuel_lut_info_t {
+    uint16_t rebuilds;          // [-] Table builds since boot
+    float max_err_ul;           // [uL] Max interpolation error per pulse at the nominal flow rate
+    float max_err_pct;          // [%] Max relative interpolation error, pulses > 0.1 uL only
+} fuel_lut_info_t;
+
+// Derives the model from a (validated) profile and builds its LUT, measuring the interpolation error.
+// The flow coefficient factors out of the table, so it only needs rebuilding if the timings change
+void fuel_model_init(fuel_model_t *model, const engine_profile_t *profile);
+
+// Of the last LUT built
+const fuel_lut_info_t *fuel_lut_info(void);
+
+// Once per period, p_barometric and map in [Pa]
+void fuel_kernel_init(fuel_kernel_t *kernel, const fuel_model_t *model, uint32_t p_barometric, uint32_t map);
+
+// [uL] Reference kernel
+double fuel_pulse_double(const fuel_kernel_t *kernel, uint32_t pulse_width);
+
+// [uL, Q16] Fixed-point kernel
+static inline uint32_t fuel_pulse_q16(const fuel_kernel_t *kernel, uint32_t pulse_width) {
+    const fuel_model_t *model = kernel->model;
+    if (pulse_width <= model->deadtime) {
+        return 0; // Needle never lifts
+    }
+    if (pulse_width >= model->full_opening) {
+        // Twice the effective open time: full ramp-up/down triangles count half, static flow in between counts fully
+        uint32_t eff2_us = 2 * (pulse_width - model->full_opening) + model->ramps2;
+        return (uint32_t)(((uint64_t)eff2_us * kernel->k_full_q32 + (1UL << 16)) >> 17); // Q32 -> Q16 (rounded), and the / 2
+    }
+    // Partial ramp triangles scale with (r / ramp_up)^2, folded into k_partial
+    uint32_t r = pulse_width - model->deadtime;
+    return (uint32_t)(((uint64_t)(r * r) * kernel->k_partial_q40 + (1UL << 23)) >> 24); // Q40 -> Q16 (rounded)
+}
+
+// [us, Q8] Effective open time (fuel per unit flow coefficient), LUT kernel
+static inline uint32_t fuel_eff_q8(const fuel_model_t *model, uint32_t pulse_width) {
+    if (pulse_width <= model->deadtime) {
+        return 0;
+    }
+    if (pulse_width >= model->full_opening) {
+        return ((pulse_width - model->full_opening) << 8) + model->eff_full_ramps_q8;
+    }
+    uint32_t r = pulse_width - model->deadtime;
+    uint32_t i = r >> FUEL_LUT_STEP_SHIFT;
+    uint32_t frac = r & (FUEL_LUT_STEP_US - 1);
+    return model->lut_q8[i] + (((model->lut_q8[i + 1] - model->lut_q8[i]) * frac) >> FUEL_LUT_STEP_SHIFT);
+}
+
+// Per-pulse result type for the selected kernel, converted with fuel_acc_to_pl()
+#if FUEL_KERNEL == FUEL_KERNEL_LUT
+typedef uint64_t fuel_acc_t;                                // [us, Q8] Effective open time
+static inline fuel_acc_t fuel_pulse(const fuel_kernel_t *kernel, uint32_t pulse_width) {
+    return fuel_eff_q8(kernel->model, pulse_width);
+}
+static inline uint64_t fuel_acc_to_pl(const fuel_kernel_t *kernel, fuel_acc_t acc) {
+    uint64_t ul_q20 = (acc * kernel->k_full_q32 + (1UL << 19)) >> 20;  // Q8 * Q32 -> Q20 [uL]
+    return (ul_q20 * 1000000 + (1UL << 19)) >> 20;                      // [uL] to [pL], rounded
+}
+#elif FUEL_KERNEL == FUEL_KERNEL_FIXED
+typedef uint64_t fuel_acc_t;                                // [uL, Q16]
+static inline fuel_acc_t fuel_pulse(const fuel_kernel_t *kernel, uint32_t pulse_width) {
+    return fuel_pulse_q16(kernel, pulse_width);
+}
+static inline uint64_t fuel_acc_to_pl(const fuel_kernel_t *kernel, fuel_acc_t acc) {
+    return (acc * 1000000 + FUEL_Q16_ONE / 2) >> 16;
+}
+#else
+typedef double fuel_acc_t;                                  // [uL]
+static inline fuel_acc_t fuel_pulse(const fuel_kernel_t *kernel, uint32_t pulse_width) {
+    return fuel_pulse_double(kernel, pulse_width);
+}
+static inline uint64_t fuel_acc_to_pl(const fuel_kernel_t *kernel, fuel_acc_t acc) {
+    return (uint64_t)(acc * 1000000 + 0.5);
+}
+#endif
+
+#endif
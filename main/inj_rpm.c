@@ -0,0 +1,61 @@
+#include "inj_rpm.h"
+
+#define US_PER_CYCLE_AT(rpm) (120000000UL / (rpm)) // 2 revolutions per injection
+
+void inj_rpm_reset(inj_rpm_t *est) {
+    est->last_start_us = 0;
+    est->cycle_us = 0;
+    est->samples = 0;
+    est->has_last = false;
+}
+
+void inj_rpm_update(inj_rpm_t *est, uint32_t start_us) {
+    if (!est->has_last) {
+        est->last_start_us = start_us;
+        est->has_last = true;
+        return;
+    }
+    uint32_t spacing = start_us - est->last_start_us; // Wraps correctly every ~71 min
+    est->last_start_us = start_us;
+
+    if (spacing > US_PER_CYCLE_AT(INJ_RPM_MIN_RPM) || spacing < US_PER_CYCLE_AT(INJ_RPM_MAX_RPM)) {
+        est->samples = 0; // Engine stopped, fuel cut or noise; start over from this injection
+        return;
+    }
+
+    if (est->samples == 0) {
+        est->cycle_us = spacing;
+        est->samples = 1;
+        return;
+    }
+
+    uint32_t diff = spacing > est->cycle_us ? spacing - est->cycle_us : est->cycle_us - spacing;
+    if (diff * 100 > est->cycle_us * INJ_RPM_MAX_JUMP_PCT) {
+        // Either a missed injection (spacing ~2x) or a real step change; restart from the new spacing
+        est->cycle_us = spacing;
+        est->samples = 1;
+        return;
+    }
+
+    int32_t delta = (int32_t)spacing - (int32_t)est->cycle_us;
+    est->cycle_us += delta / (1 << INJ_RPM_EMA_SHIFT);
+    if (est->samples < UINT16_MAX) {
+        est->samples++;
+    }
+}
+
+bool inj_rpm_get(const inj_rpm_t *est, uint32_t now_us, uint16_t *rpm, uint32_t *us_per_cycle) {
+    if (!est->has_last || est->samples < INJ_RPM_MIN_SAMPLES || est->cycle_us == 0) {
+        return false;
+    }
+    if (now_us - est->last_start_us > est->cycle_us * INJ_RPM_STALE_CYCLES) {
+        return false; // No injections lately (engine stopped or overrun fuel cut)
+    }
+    if (rpm) {
+        *rpm = (uint16_t)(120000000UL / est->cycle_us);
+    }
+    if (us_per_cycle) {
+        *us_per_cycle = est->cycle_us;
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef __INJ_RPM_H
+#define __INJ_RPM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Engine speed estimated from the spacing between injections on one injector.
+// Sequential injection fires each injector once per 4-stroke cycle (2 revolutions),
+// so RPM = 120 000 000 / [us per cycle]. Costs no bus time and updates on every injection.
+
+#define INJ_RPM_MIN_RPM         300     // Spacings slower than this are treated as the engine stopping/fuel cut
+#define INJ_RPM_MAX_RPM         8000    // Spacings faster than this are treated as noise
+#define INJ_RPM_MIN_SAMPLES     4       // Consistent spacings needed before the estimate is trusted
+#define INJ_RPM_MAX_JUMP_PCT    40      // A spacing more than this % away from the estimate restarts it (missed pulse/fuel cut)
+#define INJ_RPM_STALE_CYCLES    3       // Estimate expires if no injection was seen for this many cycles
+#define INJ_RPM_EMA_SHIFT       2       // Smoothing, new = old + (sample - old) / 2^shift
+
+typedef struct inj_rpm_t {
+    uint32_t last_start_us;     // [us] Start of the last injection
+    uint32_t cycle_us;          // [us] Smoothed engine cycle period (720°)
+    uint16_t samples;           // Consistent spacings seen since the last restart
+    bool has_last;              // last_start_us is valid
+} inj_rpm_t;
+
+void inj_rpm_reset(inj_rpm_t *est);
+
+// Feed every captured injection start, in capture order
+void inj_rpm_update(inj_rpm_t *est, uint32_t start_us);
+
+// Returns true if the estimate is good enough to replace the KWP RPM reading at time now_us
+bool inj_rpm_get(const inj_rpm_t *est, uint32_t now_us, uint16_t *rpm, uint32_t *us_per_cycle);
+
+#endif
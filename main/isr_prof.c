@@ -0,0 +1,39 @@
+#include "isr_prof.h"
+#include "esp_rom_sys.h"
+
+void isr_prof_summarise(const isr_prof_t *prof, isr_prof_summary_t *summary) {
+    uint32_t bins[ISR_PROF_N_BINS];
+    for (size_t i = 0; i < ISR_PROF_N_BINS; i++) {
+        bins[i] = prof->bins[i];
+    }
+    uint32_t count = prof->count;
+    uint64_t sum = prof->sum;
+    uint32_t min = prof->min;
+    uint32_t max = prof->max;
+
+    float cycles_per_us = (float)esp_rom_get_cpu_ticks_per_us();
+    summary->count = count;
+    if (count == 0) {
+        summary->min_us = summary->avg_us = summary->max_us = summary->p99_us = 0;
+        return;
+    }
+    summary->min_us = min / cycles_per_us;
+    summary->avg_us = (float)sum / count / cycles_per_us;
+    summary->max_us = max / cycles_per_us;
+
+    // p99 is the upper edge of the bin holding the 99th percentile, capped at the exact max
+    uint32_t target = count - count / 100;
+    uint32_t cumulative = 0;
+    uint32_t p99_cycles = max;
+    for (size_t i = 0; i < ISR_PROF_N_BINS - 1; i++) {
+        cumulative += bins[i];
+        if (cumulative >= target) {
+            p99_cycles = (uint32_t)(i + 1) << ISR_PROF_BIN_SHIFT;
+            break;
+        }
+    }
+    if (p99_cycles > max) {
+        p99_cycles = max;
+    }
+    summary->p99_us = p99_cycles / cycles_per_us;
+}
@@ -0,0 +1,53 @@
+#ifndef __ISR_PROF_H
+#define __ISR_PROF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_attr.h"
+#include "esp_cpu.h"
+
+// Lock-free timing histograms for ISR profiling, measured in CPU cycles.
+// The ISR is the only writer; readers take an unsynchronised snapshot, which can be off by the
+// sample being recorded at that moment but never blocks or masks the ISR.
+
+#define ISR_PROF_BIN_SHIFT 6    // Bin width = 2^6 cycles (~0.27 us @ 240 MHz)
+#define ISR_PROF_N_BINS    128  // Range ~34 us @ 240 MHz, anything slower lands in the last bin (max is still exact)
+
+typedef struct isr_prof_t {
+    volatile uint32_t bins[ISR_PROF_N_BINS];
+    volatile uint32_t count;
+    volatile uint64_t sum;      // [cycles]
+    volatile uint32_t min;      // [cycles]
+    volatile uint32_t max;      // [cycles]
+} isr_prof_t;
+
+typedef struct isr_prof_summary_t {
+    uint32_t count;
+    float min_us;
+    float avg_us;
+    float max_us;
+    float p99_us;
+} isr_prof_summary_t;
+
+static inline IRAM_ATTR __attribute__((always_inline)) void isr_prof_record(isr_prof_t *prof, uint32_t cycles) {
+    uint32_t bin = cycles >> ISR_PROF_BIN_SHIFT;
+    if (bin >= ISR_PROF_N_BINS) {
+        bin = ISR_PROF_N_BINS - 1;
+    }
+    prof->bins[bin]++;
+    prof->sum += cycles;
+    if (prof->count == 0 || cycles < prof->min) {
+        prof->min = cycles;
+    }
+    if (cycles > prof->max) {
+        prof->max = cycles;
+    }
+    prof->count++;
+}
+
+// Converts a snapshot of the histogram to [us]
+void isr_prof_summarise(const isr_prof_t *prof, isr_prof_summary_t *summary);
+
+#endif
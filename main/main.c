@@ -15,6 +15,8 @@ extern EventGroupHandle_t startup_event_group;
 extern TaskHandle_t fuel_meter_task_handle;
 extern TaskHandle_t current_page_task_handle;
 extern TaskHandle_t display_task_handle;
+extern TaskHandle_t scope_task_handle;
+extern TaskHandle_t fuel_integrator_task_handle;
 
 extern char currently_open_page[32];
 
@@ -28,6 +30,7 @@ void app_main() {
     i2cdev_init();
     xTaskCreate(display_task, "display_task", configMINIMAL_STACK_SIZE * 5, NULL, 5, &display_task_handle);
     init_nvs();
+    pid_support_init();
     wifi_init_softap();
     initi_web_page_buffer();
 #ifdef WS_DEBUG
@@ -35,6 +38,11 @@ void app_main() {
 #endif
     setup_websocket_server();
     init_pulse_width_gpio();
+    xTaskCreate(fuel_integrator_task, "fuel_integrator_task", 3072, NULL, 16, &fuel_integrator_task_handle); // Short, per pulse, ahead of everything else
+#ifdef FUEL_KERNEL_BENCHMARK
+    fuel_kernel_benchmark();
+#endif
+    xTaskCreate(scope_task, "scope_task", 4096, NULL, 6, &scope_task_handle);
     xTaskCreate(init_bmp280_sensor, "init_bmp280_task", 4096, NULL, 3, NULL);
     xTaskCreate(monitor_server_handle_task, "monitor_server_handle_task", 4096, NULL, 4, NULL);
 
@@ -52,6 +60,9 @@ void app_main() {
         xTaskNotifyGive(display_task_handle); // Indicate success/fail on display
         OBD9141_delay(50);
         if(kwp_init_success){
+            bool timing_ok = OBD9141_access_timing(); // Shorter bus timing for everything after, defaults if the ECU refuses
+            ESP_LOGI(TAG, "KWP timing negotiated: %d", timing_ok);
+            pid_support_discover(); // Before anything polls, so unsupported PIDs are never asked for
             xEventGroupSetBits(startup_event_group, KWP_INIT);
             // Create core functionality tasks and return from main
             xTaskCreate(fuel_meter_task, "fuel_meter_task", 8192, NULL, 15, &fuel_meter_task_handle);
@@ -1,9 +1,35 @@
 #include "nvs.h"
 
 nvs_handle_t fuel_data_handle;
+nvs_handle_t profiles_handle;
 
 static const char *TAG = "nvs";
 
+// Totals used to be stored in [uL] and [m] under the old keys; converted once, then the old key goes
+static void migrate_u64_key(const char *old_key, const char *new_key, uint64_t scale) {
+    uint64_t val = 0;
+    flash_op_begin();
+    esp_err_t err = nvs_get_u64(fuel_data_handle, old_key, &val);
+    if (err == ESP_OK) {
+        uint64_t existing;
+        if (nvs_get_u64(fuel_data_handle, new_key, &existing) == ESP_ERR_NVS_NOT_FOUND) {
+            err = nvs_set_u64(fuel_data_handle, new_key, val * scale);
+        }
+        if (err == ESP_OK) {
+            err = nvs_erase_key(fuel_data_handle, old_key);
+        }
+        if (err == ESP_OK) {
+            err = nvs_commit(fuel_data_handle);
+        }
+    }
+    flash_op_end();
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Migrated %s = %llu to %s", old_key, val, new_key);
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Error (%s) migrating %s!", esp_err_to_name(err), old_key);
+    }
+}
+
 void init_nvs(void) {
     // Init NVS
     esp_err_t err = nvs_flash_init();
@@ -20,16 +46,24 @@ void init_nvs(void) {
     if (err != ESP_OK) {
         printf("Error (%s) opening fuel_data NVS handle!\n", esp_err_to_name(err));
     }
+    migrate_u64_key("fuel_consumed", "fuel_nl", 1000);   // [uL] to [nL]
+    migrate_u64_key("dist_tr", "dist_mm", 1000);         // [m] to [mm]
+    err = nvs_open("profiles", NVS_READWRITE, &profiles_handle);
+    if (err != ESP_OK) {
+        printf("Error (%s) opening profiles NVS handle!\n", esp_err_to_name(err));
+    }
 }
 
 /* Getter functions */
 
-double get_fuel_consumed(void) {
+uint64_t get_fuel_consumed(void) {
     uint64_t fuel_consumed = 0;
-    esp_err_t err = nvs_get_u64(fuel_data_handle, "fuel_consumed", &fuel_consumed);
+    flash_op_begin();
+    esp_err_t err = nvs_get_u64(fuel_data_handle, "fuel_nl", &fuel_consumed);
+    flash_op_end();
     switch (err) {
         case ESP_OK:
-            ESP_LOGI(TAG, "Read fuel_consumed = %llu [uL]", fuel_consumed);
+            ESP_LOGI(TAG, "Read fuel_consumed = %llu [nL]", fuel_consumed);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
             ESP_LOGW(TAG, "The value of fuel_consumed is not initialised yet!");
@@ -37,16 +71,18 @@ double get_fuel_consumed(void) {
         default:
             ESP_LOGE(TAG, "Error (%s) reading fuel_consumed!", esp_err_to_name(err));
     }
-    return (double)fuel_consumed;
+    return fuel_consumed;
 }
 
 
-double get_dist_tr(void) {
+uint64_t get_dist_tr(void) {
     uint64_t dist_tr = 0;
-    esp_err_t err = nvs_get_u64(fuel_data_handle, "dist_tr", &dist_tr);
+    flash_op_begin();
+    esp_err_t err = nvs_get_u64(fuel_data_handle, "dist_mm", &dist_tr);
+    flash_op_end();
     switch (err) {
         case ESP_OK:
-            ESP_LOGI(TAG, "Read dist_tr = %llu [m]", dist_tr);
+            ESP_LOGI(TAG, "Read dist_tr = %llu [mm]", dist_tr);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
             ESP_LOGW(TAG, "The value of dist_tr is not initialised yet!");
@@ -54,37 +90,152 @@ double get_dist_tr(void) {
         default:
             ESP_LOGE(TAG, "Error (%s) reading dist_tr!", esp_err_to_name(err));
     }
-    return (double)dist_tr;
+    return dist_tr;
+}
+
+uint8_t get_active_profile_slot(void) {
+    uint8_t slot = 0;
+    flash_op_begin();
+    esp_err_t err = nvs_get_u8(profiles_handle, "active", &slot);
+    flash_op_end();
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Error (%s) reading active profile!", esp_err_to_name(err));
+    }
+    return slot < PROFILE_SLOTS ? slot : 0;
+}
+
+bool get_engine_profile_slot(uint8_t slot, engine_profile_t *profile) {
+    char key[8];
+    snprintf(key, sizeof(key), "prof%d", slot);
+    size_t len = sizeof(engine_profile_t);
+    flash_op_begin();
+    esp_err_t err = nvs_get_blob(profiles_handle, key, profile, &len);
+    flash_op_end();
+    switch (err) {
+        case ESP_OK:
+            if (len == sizeof(engine_profile_t)) {
+                return true;
+            }
+            ESP_LOGW(TAG, "Profile %d has the wrong size, ignoring it", slot);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading profile %d!", esp_err_to_name(err), slot);
+    }
+    if (slot == 0) {
+        engine_profile_default(profile);
+        return true;
+    }
+    return false;
+}
+
+bool get_fuel_blob(const char *key, void *buf, size_t len) {
+    size_t stored = len;
+    flash_op_begin();
+    esp_err_t err = nvs_get_blob(fuel_data_handle, key, buf, &stored);
+    flash_op_end();
+    switch (err) {
+        case ESP_OK:
+            if (stored == len) {
+                return true;
+            }
+            ESP_LOGW(TAG, "Stored %s has the wrong size, ignoring it", key);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            break;
+        case ESP_ERR_NVS_INVALID_LENGTH:
+            ESP_LOGW(TAG, "Stored %s is bigger than expected, ignoring it", key);
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading %s!", esp_err_to_name(err), key);
+    }
+    return false;
 }
 
 /* Setter functions */
 
-void set_fuel_consumed(double val) {
-    uint64_t fuel_consumed = (uint64_t)val;
-    esp_err_t err = nvs_set_u64(fuel_data_handle, "fuel_consumed", fuel_consumed);
+void set_fuel_consumed(uint64_t fuel_consumed) {
+    flash_op_begin();
+    esp_err_t err = nvs_set_u64(fuel_data_handle, "fuel_nl", fuel_consumed);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to write fuel_consumed!");
     }
     err = nvs_commit(fuel_data_handle);
+    flash_op_end();
     if(err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to commit fuel_consumed changes!");
     }
     else{
-        ESP_LOGI(TAG,"Set fuel_consumed to %llu [uL]", fuel_consumed);
+        ESP_LOGI(TAG,"Set fuel_consumed to %llu [nL]", fuel_consumed);
     }
 }
 
-void set_dist_tr(double val) {
-    uint64_t dist_tr = (uint64_t)val;
-    esp_err_t err = nvs_set_u64(fuel_data_handle, "dist_tr", dist_tr);
+void set_dist_tr(uint64_t dist_tr) {
+    flash_op_begin();
+    esp_err_t err = nvs_set_u64(fuel_data_handle, "dist_mm", dist_tr);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to write dist_tr!");
     }
     err = nvs_commit(fuel_data_handle);
+    flash_op_end();
     if(err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to commit dist_tr changes!");
     }
     else{
-        ESP_LOGI(TAG,"Set dist_tr to %llu [m]", dist_tr);
+        ESP_LOGI(TAG,"Set dist_tr to %llu [mm]", dist_tr);
+    }
+}
+
+void set_active_profile_slot(uint8_t slot) {
+    flash_op_begin();
+    esp_err_t err = nvs_set_u8(profiles_handle, "active", slot);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write active profile!");
     }
-}
\ No newline at end of file
+    err = nvs_commit(profiles_handle);
+    flash_op_end();
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to commit active profile changes!");
+    }
+    else{
+        ESP_LOGI(TAG,"Set active profile to slot %d", slot);
+    }
+}
+
+bool set_engine_profile_slot(uint8_t slot, const engine_profile_t *profile) {
+    char key[8];
+    snprintf(key, sizeof(key), "prof%d", slot);
+    flash_op_begin();
+    esp_err_t err = nvs_set_blob(profiles_handle, key, profile, sizeof(engine_profile_t));
+    if (err != ESP_OK) {
+        flash_op_end();
+        ESP_LOGE(TAG, "Failed to write profile %d!", slot);
+        return false;
+    }
+    err = nvs_commit(profiles_handle);
+    flash_op_end();
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to commit profile %d changes!", slot);
+        return false;
+    }
+    ESP_LOGI(TAG,"Saved profile '%s' to slot %d", profile->name, slot);
+    return true;
+}
+
+bool set_fuel_blob(const char *key, const void *buf, size_t len) {
+    flash_op_begin();
+    esp_err_t err = nvs_set_blob(fuel_data_handle, key, buf, len);
+    if (err != ESP_OK) {
+        flash_op_end();
+        ESP_LOGE(TAG, "Failed to write %s!", key);
+        return false;
+    }
+    err = nvs_commit(fuel_data_handle);
+    flash_op_end();
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to commit %s changes!", key);
+        return false;
+    }
+    return true;
+}
@@ -3,23 +3,40 @@
 
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "flash_guard.h"
+#include "engine_profile.h"
 
 void init_nvs(void);
 
 /* Getter functions */
 
-// [uL]
-double get_fuel_consumed(void);
+// [nL]
+uint64_t get_fuel_consumed(void);
 
-// [m]
-double get_dist_tr(void);
+// [mm]
+uint64_t get_dist_tr(void);
+
+// Slot of the profile to load at boot
+uint8_t get_active_profile_slot(void);
+
+// False if the slot is empty (slot 0 then holds the built-in profile)
+bool get_engine_profile_slot(uint8_t slot, engine_profile_t *profile);
+
+// Fixed-size blob in the fuel_data namespace (heatmap, trips), false if none stored or it isn't exactly len bytes
+bool get_fuel_blob(const char *key, void *buf, size_t len);
 
 /* Setter functions */
 
-// [uL]
-void set_fuel_consumed(double val);
+// [nL]
+void set_fuel_consumed(uint64_t val);
+
+// [mm]
+void set_dist_tr(uint64_t val);
+
+void set_active_profile_slot(uint8_t slot);
+
+bool set_engine_profile_slot(uint8_t slot, const engine_profile_t *profile);
 
-// [m]
-void set_dist_tr(double val);
+bool set_fuel_blob(const char *key, const void *buf, size_t len);
 
 #endif
\ No newline at end of file
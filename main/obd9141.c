@@ -40,25 +40,185 @@ static void OBD9141_write_arr(void *b, uint8_t len){
     uint8_t *bytes = (uint8_t*) b;
 #ifdef OBD9141_DEBUG
     printf("w: ");
-#endif
     for (uint8_t i = 0; i < len; i++) {
-#ifdef OBD9141_DEBUG
         printf("0x%02X ", bytes[i]);
-#endif
-        OBD9141_uart_write_bytes(obd9141.serial_port, &bytes[i], 1); // writes 1 byte at a time
-        OBD9141_delay(OBD9141_INTERSYMBOL_WAIT);
     }
-#ifdef OBD9141_DEBUG
     printf("\n");
 #endif
+    if (obd9141.timing.p4_min_ms == 0){
+        OBD9141_uart_write_bytes(obd9141.serial_port, bytes, len); // no inter-byte time needed, all at once
+    }
+    else {
+        for (uint8_t i = 0; i < len; i++) {
+            OBD9141_uart_write_bytes(obd9141.serial_port, &bytes[i], 1); // writes 1 byte at a time
+            OBD9141_delay(obd9141.timing.p4_min_ms);
+        }
+    }
 
     uint8_t tmp[len]; // temporary variable to read into
     size_t timeout_ms = OBD9141_REQUEST_ECHO_MS_PER_BYTE * len + OBD9141_WAIT_FOR_ECHO_TIMEOUT;
     OBD9141_uart_read_bytes(obd9141.serial_port, tmp, len, timeout_ms);
 }
 
+static void OBD9141_timing_defaults(void){
+    obd9141.timing.p2_min_ms = OBD9141_P2_MIN_MS;
+    obd9141.timing.p2_max_ms = OBD9141_P2_MAX_MS;
+    obd9141.timing.p3_min_ms = OBD9141_REQUEST_GAP_MS;
+    obd9141.timing.p4_min_ms = OBD9141_INTERSYMBOL_WAIT;
+    obd9141.timing.negotiated = false;
+}
+
+// Waits until P3min has passed since the last answer
+static void OBD9141_wait_p3(void){
+    int64_t wait_us = obd9141.answer_end_us + obd9141.timing.p3_min_ms * 1000 - OBD9141_micros();
+    if (wait_us > 0){
+        OBD9141_delay((wait_us + 999) / 1000);
+    }
+}
+
+// KWP answer latency
+
+// Keys of a request: its service, and for service 0x01 each PID it asks for
+static uint8_t OBD9141_lat_keys(const uint8_t *request, uint8_t request_len, uint8_t *pids){
+    if (request_len < 4){
+        return 0;
+    }
+    if (request[3] != 0x01 || request_len < 5){
+        pids[0] = 0;
+        return 1;
+    }
+    uint8_t n = request_len - 4;
+    memcpy(pids, &request[4], n);
+    return n;
+}
+
+static OBD9141_lat_t *OBD9141_lat_find(uint8_t service, uint8_t pid, bool create){
+    for (uint8_t i = 0; i < obd9141.n_lat; i++){
+        if (obd9141.lat[i].service == service && obd9141.lat[i].pid == pid){
+            return &obd9141.lat[i];
+        }
+    }
+    if (!create){
+        return NULL;
+    }
+    OBD9141_lat_t *slot;
+    if (obd9141.n_lat < OBD9141_LAT_SLOTS){
+        slot = &obd9141.lat[obd9141.n_lat++];
+    }
+    else { // replace the least used one
+        slot = &obd9141.lat[0];
+        for (uint8_t i = 1; i < OBD9141_LAT_SLOTS; i++){
+            if (obd9141.lat[i].samples < slot->samples){
+                slot = &obd9141.lat[i];
+            }
+        }
+    }
+    memset(slot, 0, sizeof(*slot));
+    slot->service = service;
+    slot->pid = pid;
+    return slot;
+}
+
+// Upper edge of the bin holding the pcnt quantile [ms]
+static uint8_t OBD9141_lat_quantile(const OBD9141_lat_t *slot, uint8_t pcnt){
+    uint32_t target = ((uint32_t)slot->weight * pcnt + 99) / 100;
+    uint32_t sum = 0;
+    for (uint8_t b = 0; b < OBD9141_LAT_BINS; b++){
+        sum += slot->hist[b];
+        if (sum >= target && sum){
+            return b + 1;
+        }
+    }
+    return OBD9141_LAT_BINS;
+}
+
+static void OBD9141_lat_add(OBD9141_lat_t *slot, uint32_t latency_ms){
+    if (latency_ms >= OBD9141_LAT_BINS){
+        latency_ms = OBD9141_LAT_BINS - 1;
+    }
+    if (slot->weight >= OBD9141_LAT_WINDOW){
+        slot->weight = 0;
+        for (uint8_t b = 0; b < OBD9141_LAT_BINS; b++){
+            slot->hist[b] /= 2;
+            slot->weight += slot->hist[b];
+        }
+    }
+    slot->hist[latency_ms]++;
+    slot->weight++;
+    if (slot->samples < UINT16_MAX){
+        slot->samples++;
+    }
+    slot->lost_streak = 0;
+
+    if (slot->samples >= OBD9141_LAT_MIN_SAMPLES){
+        slot->timeout_ms = OBD9141_lat_quantile(slot, OBD9141_LAT_QUANTILE) + OBD9141_LAT_MARGIN_MS;
+    }
+}
+
+// The learned timeout of the slot clamped to the P2 limits in use, P2max if there is none [ms]
+static size_t OBD9141_lat_clamp(const OBD9141_lat_t *slot){
+    size_t timeout_ms = slot->timeout_ms;
+    if (!timeout_ms || timeout_ms > obd9141.timing.p2_max_ms){
+        return obd9141.timing.p2_max_ms;
+    }
+    if (timeout_ms < obd9141.timing.p2_min_ms){
+        return obd9141.timing.p2_min_ms;
+    }
+    return timeout_ms;
+}
+
+// Records the answer (latency_ms >= 0) or the lost frame (latency_ms < 0) for every key of the request
+static void OBD9141_lat_record(const uint8_t *request, uint8_t request_len, int32_t latency_ms){
+    uint8_t pids[OBD9141_BUFFER_SIZE];
+    uint8_t n = OBD9141_lat_keys(request, request_len, pids);
+    for (uint8_t i = 0; i < n; i++){
+        OBD9141_lat_t *slot = OBD9141_lat_find(request[3], pids[i], true);
+        if (latency_ms >= 0){
+            OBD9141_lat_add(slot, latency_ms);
+        }
+        else {
+            if (slot->lost < UINT16_MAX){
+                slot->lost++;
+            }
+            if (slot->lost_streak < UINT8_MAX){
+                slot->lost_streak++;
+            }
+        }
+    }
+}
+
+// Answer timeout for the request [ms], the longest one of its keys. *retry is set if
+// all of them are learned and were answered last time, i.e. a lost frame is worth sending again.
+static size_t OBD9141_lat_timeout(const uint8_t *request, uint8_t request_len, bool *retry){
+    uint8_t pids[OBD9141_BUFFER_SIZE];
+    uint8_t n = OBD9141_lat_keys(request, request_len, pids);
+    size_t timeout_ms = 0;
+    *retry = n > 0;
+    for (uint8_t i = 0; i < n; i++){
+        const OBD9141_lat_t *slot = OBD9141_lat_find(request[3], pids[i], false);
+        if (slot == NULL || !slot->timeout_ms){
+            *retry = false;
+            return obd9141.timing.p2_max_ms;
+        }
+        if (slot->lost_streak){
+            *retry = false;
+        }
+        if (OBD9141_lat_clamp(slot) > timeout_ms){
+            timeout_ms = OBD9141_lat_clamp(slot);
+        }
+    }
+    if (!n){
+        return obd9141.timing.p2_max_ms;
+    }
+    if (timeout_ms >= obd9141.timing.p2_max_ms){
+        *retry = false; // nothing to gain
+    }
+    return timeout_ms;
+}
+
 static bool OBD9141_init_impl(bool check_v1_v2){
     obd9141.use_kwp = false;
+    OBD9141_timing_defaults();
     // this function performs the ISO9141 5-baud 'slow' init.
     OBD9141_set_port(false); // disable the port.
 
@@ -196,6 +356,10 @@ void OBD9141_delay(uint32_t ms){
     vTaskDelay(pdMS_TO_TICKS(ms));
 }
 
+int64_t OBD9141_micros(void){
+    return esp_timer_get_time();
+}
+
 void OBD9141_uart_init(void){
     // Setup UART buffered IO with event queue
     const int uart_buffer_size = (1024 * 2);
@@ -236,6 +400,10 @@ int OBD9141_uart_read_bytes(OBD_SERIAL_DATA_TYPE serial_port, void *b, size_t le
     return uart_read_bytes(serial_port, b, len, pdMS_TO_TICKS(timeout_ms));
 }
 
+void OBD9141_uart_flush_input(OBD_SERIAL_DATA_TYPE serial_port){
+    uart_flush_input(serial_port);
+}
+
 void OBD9141_set_pin_mode(int pin, int mode){
     ESP_ERROR_CHECK(gpio_set_direction(pin, mode));
 }
@@ -254,6 +422,13 @@ void OBD9141_begin(void){
     memset(obd9141.buffer, 0, OBD9141_BUFFER_SIZE);
     OBD9141_set_pin_mode(RX_PIN, GPIO_MODE_INPUT);
     obd9141.use_kwp = false;
+    obd9141.batch_ok = true;
+    obd9141.batch_fails = 0;
+    obd9141.n_lat = 0;
+    obd9141.retries = 0;
+    obd9141.recovered = 0;
+    obd9141.answer_end_us = 0;
+    OBD9141_timing_defaults();
 }
 
 bool OBD9141_get_current_pid(uint8_t pid, uint8_t return_length){
@@ -299,6 +474,84 @@ bool OBD9141_get_pid(uint8_t pid, uint8_t mode, uint8_t return_length){
     return res;
 }
 
+/*
+    Multi-PID request (ISO 15031-5, up to 6 PIDs), ISO 14230 KWP:
+      raw request: {0xc4, 0x33, 0xf1, 0x01, 0x0c, 0x0d, 0x05, cs}
+      returns       0x88  0xf1  0x11  0x41  0x0c  0x0c  0x4c  0x0d  0x00  0x05  0x7b  cs
+    The answer repeats each PID followed by its data, so the lengths have to be
+    known up front. PIDs the ECU doesn't support are left out of the answer.
+*/
+
+// Decodes a multi-PID answer of answer_len bytes (without checksum), returns the PIDs answered
+static uint8_t OBD9141_decode_pids(OBD9141_pid_req_t *pids, uint8_t n, uint8_t answer_len){
+    uint8_t answered = 0;
+    uint8_t i = 4; // after the header and service id
+    while (i < answer_len){
+        OBD9141_pid_req_t *req = NULL;
+        for (uint8_t p = 0; p < n; p++){
+            if (pids[p].pid == obd9141.buffer[i] && !pids[p].ok){
+                req = &pids[p];
+                break;
+            }
+        }
+        if (req == NULL || i + 1 + req->len > answer_len){
+            break; // not something we asked for, can't know its length
+        }
+        memcpy(req->data, &obd9141.buffer[i + 1], req->len);
+        req->ok = true;
+        answered++;
+        i += 1 + req->len;
+    }
+    return answered;
+}
+
+uint8_t OBD9141_get_current_pids(OBD9141_pid_req_t *pids, uint8_t n){
+    uint8_t answered = 0;
+    for (uint8_t p = 0; p < n; p++){
+        pids[p].ok = false;
+    }
+    if (n > OBD9141_MAX_BATCH_PIDS){
+        n = OBD9141_MAX_BATCH_PIDS;
+    }
+
+    bool rejected = false;
+    if (obd9141.use_kwp && obd9141.batch_ok && n > 1){
+        uint8_t message[4 + OBD9141_MAX_BATCH_PIDS] = {0x68, 0x6A, 0xF1, 0x01};
+        for (uint8_t p = 0; p < n; p++){
+            message[4 + p] = pids[p].pid;
+        }
+        uint8_t answer_len = OBD9141_request_var_ret_len(&message, 4 + n);
+        if (answer_len > 4 && obd9141.buffer[3] == 0x41){
+            answered = OBD9141_decode_pids(pids, n, answer_len);
+        }
+        if (answered){
+            obd9141.batch_fails = 0;
+            return answered;
+        }
+        rejected = answer_len >= 4 && obd9141.buffer[3] == 0x7F; // negative response
+    }
+
+    // one request per PID
+    for (uint8_t p = 0; p < n; p++){
+        if (pids[p].len <= OBD9141_PID_MAX_LEN && OBD9141_get_current_pid(pids[p].pid, pids[p].len)){
+            memcpy(pids[p].data, &obd9141.buffer[5], pids[p].len);
+            pids[p].ok = true;
+            answered++;
+        }
+    }
+
+    // A batch that went unanswered only counts against the ECU if the single requests got through
+    if (obd9141.use_kwp && obd9141.batch_ok && n > 1 && (rejected || answered)){
+        if (++obd9141.batch_fails >= OBD9141_BATCH_MAX_FAILS){
+            obd9141.batch_ok = false;
+#ifdef OBD9141_DEBUG
+            printf("ECU rejects multi-PID requests, asking one PID at a time.\n");
+#endif
+        }
+    }
+    return answered;
+}
+
 bool OBD9141_request(void *request, uint8_t request_len, uint8_t ret_len){
     if (obd9141.use_kwp){
         // have to modify the first bytes.
@@ -442,22 +695,47 @@ uint8_t OBD9141_request_kwp(void* request, uint8_t request_len){
 
     buf[request_len] = OBD9141_checksum(&buf, request_len); // add the checksum
 
-    OBD9141_write_arr(&buf, request_len + 1);
+    bool retry;
+    size_t answer_timeout_ms = OBD9141_lat_timeout(buf, request_len, &retry);
 
-    // wait after the request, officially 30 ms, but we might as well wait
-    // for the data in the readBytes function.
-
-    
     // Example response: 131 241 17 193 239 143 196 0 
     int ret;
-    memset(obd9141.buffer, 0, OBD9141_BUFFER_SIZE);
-    // set proper timeout
-    size_t timeout_ms = OBD9141_REQUEST_ANSWER_MS_PER_BYTE * 1 + OBD9141_WAIT_FOR_REQUEST_ANSWER_TIMEOUT;
-    // Try to read the fmt byte.
-    ret = OBD9141_uart_read_bytes(obd9141.serial_port, obd9141.buffer, 1, timeout_ms);
-    if (ret <= 0)
-    {
-      return 0; // failed reading the response byte.
+    size_t timeout_ms;
+    for (uint8_t attempt = 0; ; attempt++){
+        OBD9141_wait_p3();
+        OBD9141_write_arr(&buf, request_len + 1);
+
+        // wait after the request, officially 30 ms, but we might as well wait
+        // for the data in the readBytes function.
+        const int64_t sent_us = OBD9141_micros();
+
+        memset(obd9141.buffer, 0, OBD9141_BUFFER_SIZE);
+        // set proper timeout
+        timeout_ms = OBD9141_REQUEST_ANSWER_MS_PER_BYTE * 1 + answer_timeout_ms;
+        // Try to read the fmt byte.
+        ret = OBD9141_uart_read_bytes(obd9141.serial_port, obd9141.buffer, 1, timeout_ms);
+        if (ret > 0){
+            // timed the same way as the read above, so it includes whatever the UART driver adds
+            OBD9141_lat_record(buf, request_len, (OBD9141_micros() - sent_us + 999) / 1000);
+            if (attempt && obd9141.recovered < UINT16_MAX){
+                obd9141.recovered++;
+            }
+            break;
+        }
+        obd9141.answer_end_us = OBD9141_micros();
+        if (!retry || attempt >= OBD9141_LOST_FRAME_RETRIES){
+            OBD9141_lat_record(buf, request_len, -1);
+            return 0; // failed reading the response byte.
+        }
+        // Lost frame: ask again, waiting the full time so a slower answer gets measured
+#ifdef OBD9141_DEBUG
+        printf("No answer in %d ms, retrying.\n", (int)answer_timeout_ms);
+#endif
+        if (obd9141.retries < UINT16_MAX){
+            obd9141.retries++;
+        }
+        OBD9141_uart_flush_input(obd9141.serial_port);
+        answer_timeout_ms = obd9141.timing.p2_max_ms;
     }
 
     const uint8_t msg_len = (obd9141.buffer[0]) & 0b111111;
@@ -477,6 +755,7 @@ uint8_t OBD9141_request_kwp(void* request, uint8_t request_len){
 
     timeout_ms = OBD9141_REQUEST_ANSWER_MS_PER_BYTE * (remainder + 1);
     ret = OBD9141_uart_read_bytes(obd9141.serial_port, &(obd9141.buffer[1]), remainder, timeout_ms);
+    obd9141.answer_end_us = OBD9141_micros();
     if (ret > 0){
 #ifdef OBD9141_DEBUG
         printf("R: ");
@@ -554,6 +833,10 @@ bool OBD9141_init(void){
 bool  OBD9141_init_kwp(void){
     // this function performs the KWP2000 fast init.
     obd9141.use_kwp = true;
+    obd9141.batch_ok = true; // a new ECU (or the same one after a reset) gets another chance
+    obd9141.batch_fails = 0;
+    memset(obd9141.ecu_id, 0, OBD9141_ECU_ID_LEN);
+    OBD9141_timing_defaults(); // the ECU starts every session with them
     OBD9141_set_port(false); // disable the port
 
     OBD9141_kline(HIGH); // set high
@@ -581,7 +864,10 @@ bool  OBD9141_init_kwp(void){
     if (OBD9141_request_kwp(&message, 4) == 6) {
         // check positive response service ID, should be 0xC1.
         if (obd9141.buffer[3] == 0xC1) {
-            // Not necessary to do anything with this data?
+            // source address and key bytes, tell ECUs apart
+            obd9141.ecu_id[0] = obd9141.buffer[2];
+            obd9141.ecu_id[1] = obd9141.buffer[4];
+            obd9141.ecu_id[2] = obd9141.buffer[5];
             return true;
         }
         else {
@@ -599,6 +885,82 @@ bool OBD9141_init_kwp_slow(void){
     return res;
 }
 
+void OBD9141_get_ecu_id(uint8_t *id){
+    memcpy(id, obd9141.ecu_id, OBD9141_ECU_ID_LEN);
+}
+
+/*
+    AccessTimingParameters, ISO 14230 KWP:
+      read limits:  {0xc2, 0x33, 0xf1, 0x83, 0x00, cs}
+      returns        0x87  0xf1  0x11  0xc3  0x00  P2min P2max P3min P3max P4min cs
+      set values:   {0xc7, 0x33, 0xf1, 0x83, 0x03, P2min P2max P3min P3max P4min, cs}
+      returns        0x82  0xf1  0x11  0xc3  0x03  cs
+    The limits are the smallest P2min, P3min and P4min and the largest P2max
+    and P3max the ECU can do. The new values apply after the positive answer,
+    which still comes with the old ones.
+*/
+
+bool OBD9141_access_timing(void){
+    if (!obd9141.use_kwp){
+        return false;
+    }
+    uint8_t read_limits[5] = {0x68, 0x6A, 0xF1, 0x83, OBD9141_ATP_READ_LIMITS};
+    if (OBD9141_request_var_ret_len(&read_limits, 5) < 10 || obd9141.buffer[3] != 0xC3 || obd9141.buffer[4] != OBD9141_ATP_READ_LIMITS){
+#ifdef OBD9141_DEBUG
+        printf("No timing limits (0x%02X 0x%02X 0x%02X), keeping the defaults.\n", obd9141.buffer[3], obd9141.buffer[4], obd9141.buffer[5]);
+#endif
+        return false; // negative response (0x7F 0x83 code) or none
+    }
+    const uint8_t p2_min = obd9141.buffer[5];
+    const uint8_t p2_max = obd9141.buffer[6] && obd9141.buffer[6] < OBD9141_ATP_P2_MAX ? obd9141.buffer[6] : OBD9141_ATP_P2_MAX;
+    const uint8_t p3_min = obd9141.buffer[7];
+    const uint8_t p3_max = obd9141.buffer[8] && obd9141.buffer[8] < OBD9141_ATP_P3_MAX ? obd9141.buffer[8] : OBD9141_ATP_P3_MAX;
+    const uint8_t p4_min = obd9141.buffer[9];
+
+    uint8_t set_values[10] = {0x68, 0x6A, 0xF1, 0x83, OBD9141_ATP_SET_VALUES, p2_min, p2_max, p3_min, p3_max, p4_min};
+    if (OBD9141_request_var_ret_len(&set_values, 10) < 5 || obd9141.buffer[3] != 0xC3 || obd9141.buffer[4] != OBD9141_ATP_SET_VALUES){
+#ifdef OBD9141_DEBUG
+        printf("Timing not taken (0x%02X 0x%02X 0x%02X), keeping the defaults.\n", obd9141.buffer[3], obd9141.buffer[4], obd9141.buffer[5]);
+#endif
+        return false;
+    }
+    obd9141.timing.p2_min_ms = p2_min / 2;              // rounded down, the timeouts only get longer
+    obd9141.timing.p2_max_ms = p2_max * 25;
+    obd9141.timing.p3_min_ms = (p3_min + 1) / 2;        // rounded up, the ECU gets at least what it asked for
+    obd9141.timing.p4_min_ms = (p4_min + 1) / 2;
+    obd9141.timing.negotiated = true;
+#ifdef OBD9141_DEBUG
+    printf("Timing: P2 %d-%d ms, P3min %d ms, P4min %d ms.\n", obd9141.timing.p2_min_ms, obd9141.timing.p2_max_ms,
+           obd9141.timing.p3_min_ms, obd9141.timing.p4_min_ms);
+#endif
+    return true;
+}
+
+void OBD9141_get_timing(OBD9141_timing_t *timing){
+    *timing = obd9141.timing;
+}
+
+uint8_t OBD9141_get_latency(OBD9141_lat_info_t *info, uint8_t max, uint16_t *retries, uint16_t *recovered){
+    uint8_t n = obd9141.n_lat < max ? obd9141.n_lat : max;
+    for (uint8_t i = 0; i < n; i++){
+        const OBD9141_lat_t *slot = &obd9141.lat[i];
+        info[i].service = slot->service;
+        info[i].pid = slot->pid;
+        info[i].samples = slot->samples;
+        info[i].lost = slot->lost;
+        info[i].p50_ms = slot->weight ? OBD9141_lat_quantile(slot, 50) : 0;
+        info[i].p99_ms = slot->weight ? OBD9141_lat_quantile(slot, OBD9141_LAT_QUANTILE) : 0;
+        info[i].timeout_ms = OBD9141_lat_clamp(slot);
+    }
+    if (retries){
+        *retries = obd9141.retries;
+    }
+    if (recovered){
+        *recovered = obd9141.recovered;
+    }
+    return n;
+}
+
 bool OBD9141_clear_trouble_codes(void){
     uint8_t message[4] = {0x68, 0x6A, 0xF1, 0x04};
     // 0x04 without PID value should clear the trouble codes or
@@ -23,6 +23,7 @@
 #include "driver/uart.h"                        // Change this to your framework's equivalent header file
 #include "driver/gpio.h"                        // Change this to your framework's equivalent header file
 #include "esp_log.h"                            // Change this to your framework's equivalent header file
+#include "esp_timer.h"                          // Change this to your framework's equivalent header file
 
 #define RX_PIN GPIO_NUM_16                      // Change this to your board's UART RX pin
 #define TX_PIN GPIO_NUM_17                      // Change this to your board's UART TX pin
@@ -31,6 +32,8 @@
 
 // Change this function's contents to your framework's millisecond-precision delay function (preferrably non-blocking)
 void OBD9141_delay(uint32_t ms);
+// Change this function's contents to your framework's microsecond-precision monotonic clock
+int64_t OBD9141_micros(void);
 // Change this function's contents to your framework's equivalent UART init
 void OBD9141_uart_init(void);
 // Change this function's contents to your framework's equivalent UART deinit
@@ -41,6 +44,8 @@ bool OBD9141_uart_is_driver_installed(OBD_SERIAL_DATA_TYPE serial_port);
 int  OBD9141_uart_write_bytes(OBD_SERIAL_DATA_TYPE serial_port, void *b, size_t len);
 // Change this function's contents to your framework's equivalent UART read function
 int  OBD9141_uart_read_bytes(OBD_SERIAL_DATA_TYPE serial_port, void *b, size_t len, size_t timeout_ms);
+// Change this function's contents to your framework's equivalent UART receive buffer flush
+void OBD9141_uart_flush_input(OBD_SERIAL_DATA_TYPE serial_port);
 // Change this function's contents to your framework's equivalent GPIO mode function
 void OBD9141_set_pin_mode(int pin, int mode);
 // Change this function's contents to your framework's equivalent GPIO level function
@@ -57,14 +62,23 @@ void OBD9141_set_pin_level(int pin, int level);
 #define OBD9141_KLINE_BAUD 10400 
 // as per spec.
 
-#define OBD9141_BUFFER_SIZE 16
+#define OBD9141_BUFFER_SIZE (3 + 63 + 1)
 // maximum possible as per protocol is 256 payload, the buffer also contains
 // request and checksum, add 5 + 1 for those on top of the max desired length.
 // User needs to guarantee that the ret_len never exceeds the buffer size.
+// Sized for the longest KWP answer without a length byte (header, 63 payload
+// bytes, checksum), which a multi-PID answer can get close to.
 
 #define OBD9141_INTERSYMBOL_WAIT 5
 // Milliseconds delay between writing of subsequent bytes on the bus.
 // Is 5ms according to the specification.
+// This is the default P4min, KWP requests use the one OBD9141_access_timing()
+// negotiates, 0 writes the request in one go.
+
+#define OBD9141_REQUEST_GAP_MS 1
+// Milliseconds kept between the end of an answer and the next KWP request
+// (P3min) until OBD9141_access_timing() negotiates one. The spec's default is
+// 55 ms, ECUs take the next request much sooner in practice.
 
 
 // When data is sent over the serial port to the K-line transceiver, an echo of
@@ -95,8 +109,80 @@ void OBD9141_set_pin_level(int pin, int level);
 // Time added to the read timeout when reading the response to a request. 
 // This should incorporate the 30 ms that's between the request and answer
 // according to the specification.
+// KWP requests wait for the P2max in use instead (OBD9141_P2_MAX_MS unless
+// OBD9141_access_timing() negotiated another) until the ECU's latency has been
+// learned (see below), and for the retry of a lost frame.
+
+
+// KWP answer latency is timed from the end of the request to the fmt byte,
+// per service and, for service 0x01, per PID (a multi-PID request counts for
+// each of its PIDs). Once a key has OBD9141_LAT_MIN_SAMPLES answers, its
+// requests wait for the p99 latency plus OBD9141_LAT_MARGIN_MS, clamped to
+// the P2 limits in use, instead of P2max.
+// An answer that doesn't come in that time is a lost frame and the request is
+// sent once more, waiting the full P2max so a slower ECU is still heard (and
+// measured).
+
+#define OBD9141_P2_MIN_MS 25
+#define OBD9141_P2_MAX_MS 50
+// ISO 14230 default limits of P2, request end to answer.
+
+#define OBD9141_LAT_SLOTS 16
+// Services / PIDs latency is kept for, the least used one is replaced.
+
+#define OBD9141_LAT_BINS 64
+// 1 ms histogram bins, longer latencies land in the last one.
+
+#define OBD9141_LAT_WINDOW 255
+// The histogram counts are halved when they add up to this, so it follows
+// the ECU over roughly the last OBD9141_LAT_WINDOW answers.
+
+#define OBD9141_LAT_MIN_SAMPLES 32
+// Answers needed before a learned timeout is used.
+
+#define OBD9141_LAT_QUANTILE 99
+// [%] Latency quantile the timeout is based on.
+
+#define OBD9141_LAT_MARGIN_MS 5
+// Added to the quantile, covers a tick of timeout rounding and some drift.
+
+#define OBD9141_LOST_FRAME_RETRIES 1
+// Times a request with a learned timeout is sent again after a lost frame.
+
+
+
+// AccessTimingParameters (service 0x83, ISO 14230-3). The timing parameter
+// identifier picks what the request does; P2min, P3min and P4min are sent in
+// 0.5 ms steps, P2max in 25 ms and P3max in 250 ms steps.
+#define OBD9141_ATP_READ_LIMITS 0x00
+#define OBD9141_ATP_SET_DEFAULTS 0x01
+#define OBD9141_ATP_READ_CURRENT 0x02
+#define OBD9141_ATP_SET_VALUES 0x03
+
+#define OBD9141_ATP_P2_MAX 0x02
+// [25 ms] P2max asked for: the default 50 ms, the learned answer timeouts
+// already stop waiting for the worst case.
+
+#define OBD9141_ATP_P3_MAX 0x14
+// [250 ms] P3max asked for: the default 5 s, fuel_meter_task talks to the ECU
+// well within that.
+
 
 
+#define OBD9141_MAX_BATCH_PIDS 6
+// Most PIDs a single service 0x01 request may ask for (ISO 15031-5).
+
+#define OBD9141_BATCH_MAX_FAILS 3
+// Batched requests the ECU may reject (negative response, or no answer while
+// the same PIDs asked one by one are answered) before we stop batching until
+// the next init.
+
+#define OBD9141_PID_MAX_LEN 4
+// Longest PID answer OBD9141_get_current_pids() keeps, in data bytes.
+
+#define OBD9141_ECU_ID_LEN 3
+// ECU address and the two key bytes of its startCommunication answer.
+
 
 #define OBD9141_INIT_IDLE_BUS_BEFORE 3000
 // Before the init sequence; the bus is kept idle for this duration in ms.
@@ -106,12 +192,61 @@ void OBD9141_set_pin_level(int pin, int level);
 // It is not present in the spec, but prevents a request immediately after the
 // init has succeeded when the other side might not yet be ready.
 
+// Answer latency of one service / PID
+typedef struct OBD9141_lat_t{
+    uint8_t service;
+    uint8_t pid;                        // Service 0x01 PID, 0 for other services
+    uint16_t samples;                   // Answers timed (saturates)
+    uint16_t lost;                      // Requests that went unanswered, after any retry (saturates)
+    uint8_t lost_streak;                // Unanswered requests since the last answer
+    uint8_t timeout_ms;                 // [ms] Learned answer timeout, 0 until OBD9141_LAT_MIN_SAMPLES
+    uint16_t weight;                    // Sum of hist[]
+    uint8_t hist[OBD9141_LAT_BINS];     // Latency histogram, 1 ms bins
+} OBD9141_lat_t;
+
+// What OBD9141_get_latency() reports for one service / PID
+typedef struct OBD9141_lat_info_t{
+    uint8_t service;
+    uint8_t pid;
+    uint16_t samples;
+    uint16_t lost;
+    uint8_t p50_ms;                     // [ms]
+    uint8_t p99_ms;                     // [ms] OBD9141_LAT_QUANTILE
+    uint8_t timeout_ms;                 // [ms] In use, learned or the default
+} OBD9141_lat_info_t;
+
+// Bus timing in use, from OBD9141_access_timing() or the defaults
+typedef struct OBD9141_timing_t{
+    uint8_t p2_min_ms;                  // [ms] Earliest answer, lower bound of the learned timeouts
+    uint16_t p2_max_ms;                 // [ms] Latest answer, the answer timeout until one is learned
+    uint8_t p3_min_ms;                  // [ms] Answer end to the next request
+    uint8_t p4_min_ms;                  // [ms] Between the bytes of a request
+    bool negotiated;                    // False: defaults (OBD9141_P2_MIN_MS, OBD9141_P2_MAX_MS, OBD9141_REQUEST_GAP_MS, OBD9141_INTERSYMBOL_WAIT)
+} OBD9141_timing_t;
+
 typedef struct OBD9141_t{
     OBD_SERIAL_DATA_TYPE serial_port;
     bool use_kwp;
+    bool batch_ok;          // ECU takes multi-PID requests (until shown otherwise)
+    uint8_t batch_fails;    // Consecutive batched requests it rejected
+    uint8_t ecu_id[OBD9141_ECU_ID_LEN]; // From the last KWP fast init
+    OBD9141_timing_t timing;
+    int64_t answer_end_us;              // When the last KWP answer ended (or timed out), for P3min
+    uint8_t n_lat;                      // lat[] slots in use
+    uint16_t retries;                   // Lost frames sent again (since begin)
+    uint16_t recovered;                 // Of those, answered the second time
+    OBD9141_lat_t lat[OBD9141_LAT_SLOTS];
     uint8_t buffer[OBD9141_BUFFER_SIZE];
 } OBD9141_t;
 
+// One PID of a batched mode 0x01 request
+typedef struct OBD9141_pid_req_t{
+    uint8_t pid;
+    uint8_t len;                        // Data bytes expected, at most OBD9141_PID_MAX_LEN
+    bool ok;                            // Answered, set by OBD9141_get_current_pids()
+    uint8_t data[OBD9141_PID_MAX_LEN];  // Answer as sent (A, B, ...), valid if ok
+} OBD9141_pid_req_t;
+
 void OBD9141_begin(void);
 // begin function which allows setting the serial port and pins.
 
@@ -125,6 +260,21 @@ bool OBD9141_get_pid(uint8_t pid, uint8_t mode, uint8_t return_length);
 // Returns whether the request was answered with a correct answer
 // (correct PID and checksum)
 
+/**
+ * @brief Asks for up to OBD9141_MAX_BATCH_PIDS mode 0x01 PIDs in a single
+ *        request (KWP only) and decodes the answer into pids[].
+ * @param pids The PIDs to read, with their expected lengths; ok and data
+ *        are filled in.
+ * @param n The number of PIDs, extra ones beyond OBD9141_MAX_BATCH_PIDS
+ *        are left unanswered.
+ * @return The number of PIDs answered.
+ * @note PIDs left out of a multi-PID answer are not supported by the ECU
+ *       and stay unanswered. If the batch gets no usable answer at all,
+ *       each PID is asked for on its own; after OBD9141_BATCH_MAX_FAILS
+ *       rejected batches in a row every call does that until the next init.
+ */
+uint8_t OBD9141_get_current_pids(OBD9141_pid_req_t *pids, uint8_t n);
+
 /**
  * @brief Send a request to the ECU, includes header bytes. For KWP the
  *        first two header bytes will be corrected before transmission.
@@ -158,6 +308,8 @@ uint8_t OBD9141_request_var_ret_len(void* request, uint8_t request_len);
  * @return the number of bytes read if checksum matches.
  * @note If checksum doesn't match return will be zero, but bytes will
  *       still be written to the internal buffer.
+ * @note The answer timeout is learned from the ECU's latency, a lost frame
+ *       is sent again up to OBD9141_LOST_FRAME_RETRIES times.
  */
 uint8_t OBD9141_request_kwp(void* request, uint8_t request_len);
 
@@ -192,6 +344,34 @@ bool OBD9141_init_kwp_slow(void); // attempts 'slow' 5 baud kwp init, v1 = 233,
 // The struct keeps no track of whether this was successful or not.
 // It is up to the user to ensure that the initialisation is called.
 
+void OBD9141_get_ecu_id(uint8_t *id);
+// Copies the OBD9141_ECU_ID_LEN bytes identifying the ECU that answered the
+// last successful KWP fast init: its address and key bytes, zeros if none.
+
+/**
+ * @brief Negotiates the fastest bus timing the ECU allows (KWP only): reads
+ *        its timing limits with service 0x83 and sets P2min, P3min and P4min
+ *        to them, P2max and P3max to OBD9141_ATP_P2_MAX / OBD9141_ATP_P3_MAX
+ *        (or the ECU's maximum if lower).
+ * @return Whether the ECU took the new timing. If not, the defaults stay in
+ *         use.
+ * @note Call right after OBD9141_init_kwp(), which goes back to the defaults.
+ */
+bool OBD9141_access_timing(void);
+
+void OBD9141_get_timing(OBD9141_timing_t *timing);
+// Copies the bus timing in use.
+
+/**
+ * @brief Reports the learned KWP answer latency per service / PID.
+ * @param info Filled in with up to max entries.
+ * @param max The size of info.
+ * @param retries Set to the lost frames sent again since begin, may be NULL.
+ * @param recovered Set to how many of those were answered, may be NULL.
+ * @return The number of entries written.
+ */
+uint8_t OBD9141_get_latency(OBD9141_lat_info_t *info, uint8_t max, uint16_t *retries, uint16_t *recovered);
+
 bool OBD9141_clear_trouble_codes(void);
 // Attempts to Clear trouble codes / Malfunction indicator lamp (MIL)
 // Check engine light.
@@ -0,0 +1,70 @@
+#include "pid_sched.h"
+
+#include <string.h>
+
+void pid_sched_init(pid_sched_t *sched, const pid_def_t *defs, uint8_t n) {
+    memset(sched, 0, sizeof(pid_sched_t));
+    sched->defs = defs;
+    sched->n = n < PID_SCHED_MAX ? n : PID_SCHED_MAX;
+}
+
+// How far past its period a slow PID is, [1/1000 of its period]; never polled counts as most overdue
+static uint32_t overdue(const pid_sched_t *sched, uint8_t i, int64_t now_us) {
+    if (sched->last_us[i] == 0) {
+        return UINT32_MAX;
+    }
+    int64_t since_us = now_us - sched->last_us[i];
+    int64_t period_us = (int64_t)sched->defs[i].period_ms * 1000;
+    if (since_us < period_us) {
+        return 0; // Not due
+    }
+    int64_t permille = since_us * 1000 / period_us;
+    return permille >= UINT32_MAX - 1 ? UINT32_MAX - 2 : (uint32_t)permille; // Below never polled
+}
+
+// Should a go before b: more overdue, then higher priority
+static bool before(const pid_sched_t *sched, uint8_t a, uint32_t a_due, uint8_t b, uint32_t b_due) {
+    if (a_due != b_due) {
+        return a_due > b_due;
+    }
+    return sched->defs[a].priority < sched->defs[b].priority;
+}
+
+uint8_t pid_sched_select(pid_sched_t *sched, int64_t now_us, uint8_t max, uint8_t *out) {
+    uint8_t count = 0;
+    uint32_t due[PID_SCHED_MAX];
+    // Insertion sort into out[]: fast PIDs carry the highest urgency, so they always come first
+    for (uint8_t i = 0; i < sched->n; i++) {
+        const pid_def_t *def = &sched->defs[i];
+        if ((sched->supported && !sched->supported(def->pid)) || (def->wanted && !def->wanted())) {
+            continue;
+        }
+        uint32_t d = def->period_ms == 0 ? UINT32_MAX : overdue(sched, i, now_us);
+        if (d == 0) {
+            continue;
+        }
+        if (def->period_ms != 0 && d == UINT32_MAX) {
+            d = UINT32_MAX - 1; // Never polled, but still after the fast ones
+        }
+        uint8_t pos = count;
+        while (pos > 0 && before(sched, i, d, out[pos - 1], due[pos - 1])) {
+            pos--;
+        }
+        if (pos >= max) {
+            continue;
+        }
+        if (count < max) {
+            count++;
+        }
+        for (uint8_t j = count - 1; j > pos; j--) {
+            out[j] = out[j - 1];
+            due[j] = due[j - 1];
+        }
+        out[pos] = i;
+        due[pos] = d;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        sched->last_us[out[i]] = now_us;
+    }
+    return count;
+}
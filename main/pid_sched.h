@@ -0,0 +1,39 @@
+#ifndef __PID_SCHED_H
+#define __PID_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Polling schedule for a table of OBD PIDs. Fast PIDs (period 0) are polled every cycle; slow ones only once their
+// target period has passed, most overdue first, and only into the slots the fast ones leave free, so they spread
+// out over cycles instead of all landing in the same one. A cycle never asks for more than the caller's limit
+// (one batched request's worth), so slow PIDs add no bus time of their own.
+
+#define PID_SCHED_MAX   16      // PIDs a table can have
+
+// Decodes a PID's data bytes (A, B, ...) into ctx
+typedef void (*pid_decode_t)(const uint8_t *raw, void *ctx);
+
+typedef struct pid_def_t {
+    uint8_t pid;
+    uint8_t len;                // [B] Data bytes in the answer
+    pid_decode_t decode;
+    uint16_t period_ms;         // [ms] Target polling period, 0 = every cycle
+    uint8_t priority;           // 0 = most important: orders the fast PIDs, breaks ties between equally overdue slow ones
+    bool (*wanted)(void);       // NULL = always; returning false skips the PID this cycle
+} pid_def_t;
+
+typedef struct pid_sched_t {
+    const pid_def_t *defs;
+    uint8_t n;
+    int64_t last_us[PID_SCHED_MAX]; // [us] Last polled, 0 = never
+    bool (*supported)(uint8_t pid); // NULL = all; unsupported PIDs are never selected
+} pid_sched_t;
+
+void pid_sched_init(pid_sched_t *sched, const pid_def_t *defs, uint8_t n);
+
+// This cycle's PIDs as indices into defs, at most max of them, fast ones first (by priority), then the due slow
+// ones (most overdue first). They count as polled from now_us on, answered or not. Returns how many
+uint8_t pid_sched_select(pid_sched_t *sched, int64_t now_us, uint8_t max, uint8_t *out);
+
+#endif
@@ -0,0 +1,120 @@
+#include "pid_support.h"
+#include "nvs.h"
+
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "pid_support";
+
+#define PID_SUPPORT_VERSION 1
+
+// Also the NVS layout
+typedef struct __attribute__((packed)){
+    uint8_t version;                // PID_SUPPORT_VERSION
+    uint8_t ecu_id[PID_SUPPORT_ID_LEN];
+    uint8_t map[32];                // Bit per PID 0x01-0x100, MSB first, as the bitmaps come
+} pid_support_store_t;
+
+static pid_support_store_t store;
+static bool cached = false;         // store holds some ECU's bitmaps (from NVS)
+static bool known = false;          // store.map is this ECU's
+static bool confirmed = false;      // ... and was read from it this session, not just taken from the cache
+static bool stale = false;          // A supported PID keeps failing, read the bitmaps again
+static uint8_t dead[32];            // Listed as supported but never answers, this session only
+static uint8_t fails[256];          // Consecutive unanswered polls per PID
+
+static bool map_bit(const uint8_t *map, uint8_t pid) {
+    return pid == 0 || (map[(pid - 1) >> 3] & (0x80 >> ((pid - 1) & 7)));
+}
+
+void pid_support_init(void) {
+    cached = get_fuel_blob("pid_support", &store, sizeof(store)) && store.version == PID_SUPPORT_VERSION;
+}
+
+// Reads the bitmap of PIDs base + 1 to base + 0x20 into the map, false if the ECU didn't answer
+static bool read_bitmap(uint8_t base) {
+    if (!OBD9141_get_current_pid(base, 4)) {
+        return false;
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        store.map[base / 8 + i] = OBD9141_read_uint8_idx(i);
+    }
+    return true;
+}
+
+static bool discover(bool use_cache) {
+    uint8_t id[PID_SUPPORT_ID_LEN];
+    OBD9141_get_ecu_id(id);
+    pid_support_store_t prev = store;
+    memset(store.map, 0, sizeof(store.map));
+    if (!read_bitmap(0x00)) {
+        store = prev;
+        ESP_LOGW(TAG, "ECU doesn't answer PID 0x00, polling every PID");
+        return false;
+    }
+    memcpy(&id[OBD9141_ECU_ID_LEN], store.map, 4); // The first bitmap is part of the identity
+
+    stale = false;
+    memset(fails, 0, sizeof(fails));
+    if (use_cache && cached && memcmp(prev.ecu_id, id, PID_SUPPORT_ID_LEN) == 0) {
+        store = prev;
+        known = true;
+        confirmed = false;
+        ESP_LOGI(TAG, "Supported PIDs of this ECU from the cache");
+        return true;
+    }
+
+    // Each bitmap's last bit says whether the next one exists
+    for (uint16_t base = 0x20; base <= 0xE0 && map_bit(store.map, base); base += 0x20) {
+        if (!read_bitmap(base)) {
+            ESP_LOGW(TAG, "No answer to PID 0x%02X, taking PIDs past it as unsupported", base);
+            break;
+        }
+    }
+    store.version = PID_SUPPORT_VERSION;
+    memcpy(store.ecu_id, id, PID_SUPPORT_ID_LEN);
+    known = true;
+    confirmed = true;
+    uint16_t count = 0;
+    for (uint16_t pid = 1; pid <= 0xFF; pid++) {
+        count += map_bit(store.map, pid) && (pid & 0x1F) != 0; // Not the bitmap PIDs themselves
+    }
+    ESP_LOGI(TAG, "ECU supports %d PIDs", count);
+    cached = set_fuel_blob("pid_support", &store, sizeof(store));
+    return true;
+}
+
+bool pid_support_discover(void) {
+    return discover(true);
+}
+
+bool pid_support_has(uint8_t pid) {
+    return !known || (map_bit(store.map, pid) && !map_bit(dead, pid));
+}
+
+void pid_support_result(uint8_t pid, bool answered) {
+    if (!known) {
+        return;
+    }
+    if (answered) {
+        fails[pid] = 0;
+        return;
+    }
+    if (++fails[pid] < PID_SUPPORT_FAIL_LIMIT) {
+        return;
+    }
+    fails[pid] = 0;
+    if (!confirmed) {
+        ESP_LOGW(TAG, "PID 0x%02X keeps failing, reading the supported PIDs again", pid);
+        stale = true;
+    } else if (pid > 0) {
+        ESP_LOGW(TAG, "PID 0x%02X is listed as supported but never answers, skipping it", pid);
+        dead[(pid - 1) >> 3] |= 0x80 >> ((pid - 1) & 7);
+    }
+}
+
+void pid_support_recheck(void) {
+    if (stale) {
+        discover(false);
+    }
+}
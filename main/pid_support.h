@@ -0,0 +1,35 @@
+#ifndef __PID_SUPPORT_H
+#define __PID_SUPPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "obd9141.h"
+
+// Which mode 0x01 PIDs the ECU supports, from its support bitmaps (PIDs 0x00, 0x20, 0x40, ...), so the polling
+// layer never asks for one it would only time out on. The bitmaps are read once after the KWP init and cached in
+// NVS together with the ECU's identity (address, key bytes and the first bitmap); at the next boot only the first
+// bitmap is read, and if the identity matches the rest comes from the cache.
+// A supported PID that goes unanswered for PID_SUPPORT_FAIL_LIMIT polls in a row (while the ECU answers others)
+// drops the cache and the bitmaps are read again; if a fresh read still lists it, it's skipped until reboot.
+
+#define PID_SUPPORT_FAIL_LIMIT  10      // [-] Consecutive unanswered polls of a supported PID
+#define PID_SUPPORT_ID_LEN      (OBD9141_ECU_ID_LEN + 4) // ECU id and the PID 0x00 bitmap
+
+// Loads the cache (NVS must be up)
+void pid_support_init(void);
+
+// After OBD9141_init_kwp() succeeded, uses the cache if it's this ECU's. False if the ECU didn't answer
+bool pid_support_discover(void);
+
+// True if the PID may be polled; everything is, until the bitmaps are known
+bool pid_support_has(uint8_t pid);
+
+// Outcome of polling a PID, only for cycles in which the ECU answered at all
+void pid_support_result(uint8_t pid, bool answered);
+
+// From the polling task between its polls, outside fuel_data_mutex: reads the bitmaps again (and stores them in NVS)
+// if the cache was dropped
+void pid_support_recheck(void);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __PULSE_RING_H
+#define __PULSE_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "esp_attr.h"
+
+// Wait-free single-producer/single-consumer ring for injector pulses. Each channel has three (fm_tasks.h):
+// ring (injector ISR -> fuel_integrator_task), period_ring (fuel_integrator_task -> fuel_meter_task) and
+// scope_ring (injector ISR -> scope_task). Neither side masks interrupts:
+// the producer publishes an entry with a single release store of head, the consumer frees
+// slots with a single release store of tail. Indices run freely and are masked on access.
+
+#define PULSE_RING_SIZE 256 // Must be a power of 2. @ 7000 RPM one injector fires ~58 times/sec, so this holds > 4 s of pulses
+#define PULSE_RING_MASK (PULSE_RING_SIZE - 1)
+
+_Static_assert((PULSE_RING_SIZE & PULSE_RING_MASK) == 0, "PULSE_RING_SIZE must be a power of 2");
+
+// One injection event as captured by the ISR
+typedef struct injector_pulse_t {
+    uint32_t start_us;              // [us] Pulse start (falling edge), lower 32 bits of esp_timer_get_time()
+    uint32_t width_us;              // [us] Pulse width
+} injector_pulse_t;
+
+typedef struct pulse_ring_t {
+    injector_pulse_t buf[PULSE_RING_SIZE];
+    _Atomic uint32_t head;          // Next slot to write, only stored by the producer
+    _Atomic uint32_t tail;          // Next slot to read, only stored by the consumer
+    volatile uint32_t overflow_cnt; // Pulses dropped because the ring was full (producer-owned)
+    volatile uint32_t high_water;   // Max ring fill level seen (producer-owned)
+} pulse_ring_t;
+
+/* Producer side (ISR) */
+
+static inline IRAM_ATTR __attribute__((always_inline)) bool pulse_ring_push(pulse_ring_t *ring, uint32_t start_us, uint32_t width_us) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t used = head - tail;
+    if (used >= PULSE_RING_SIZE) {
+        ring->overflow_cnt++;
+        return false;
+    }
+    ring->buf[head & PULSE_RING_MASK].start_us = start_us;
+    ring->buf[head & PULSE_RING_MASK].width_us = width_us;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release); // Publish
+    if (used + 1 > ring->high_water) {
+        ring->high_water = used + 1;
+    }
+    return true;
+}
+
+/* Consumer side (task) */
+
+// Number of pulses waiting to be consumed
+static inline uint32_t pulse_ring_count(pulse_ring_t *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+}
+
+static inline bool pulse_ring_pop(pulse_ring_t *ring, injector_pulse_t *pulse) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+        return false; // Empty
+    }
+    *pulse = ring->buf[tail & PULSE_RING_MASK];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release); // Hand the slot back to the producer
+    return true;
+}
+
+#endif
@@ -0,0 +1,150 @@
+#include "pw_stats.h"
+#include <string.h>
+
+/* P² quantile estimator */
+
+static void p2_init(p2_quantile_t *est, float p) {
+    memset(est, 0, sizeof(p2_quantile_t));
+    est->p = p;
+}
+
+static void p2_add(p2_quantile_t *est, float x) {
+    if (est->count < 5) {
+        // Collect the first 5 observations, kept sorted (insertion sort)
+        int32_t i = est->count;
+        while (i > 0 && est->q[i - 1] > x) {
+            est->q[i] = est->q[i - 1];
+            i--;
+        }
+        est->q[i] = x;
+        est->count++;
+        if (est->count == 5) {
+            const float p = est->p;
+            for (int32_t m = 0; m < 5; m++) {est->n[m] = m;}
+            est->np[0] = 0;
+            est->np[1] = 2 * p;
+            est->np[2] = 4 * p;
+            est->np[3] = 2 + 2 * p;
+            est->np[4] = 4;
+        }
+        return;
+    }
+
+    // Find the cell x falls into, stretching the extreme markers if needed
+    int32_t k;
+    if (x < est->q[0]) {
+        est->q[0] = x;
+        k = 0;
+    } else if (x >= est->q[4]) {
+        est->q[4] = x;
+        k = 3;
+    } else {
+        k = 0;
+        while (k < 3 && x >= est->q[k + 1]) {k++;}
+    }
+
+    for (int32_t m = k + 1; m < 5; m++) {est->n[m]++;}
+    const float dn[5] = {0, est->p / 2, est->p, (1 + est->p) / 2, 1};
+    for (int32_t m = 0; m < 5; m++) {est->np[m] += dn[m];}
+    est->count++;
+
+    // Adjust the 3 middle markers towards their desired positions
+    for (int32_t m = 1; m < 4; m++) {
+        float d = est->np[m] - est->n[m];
+        if ((d >= 1 && est->n[m + 1] - est->n[m] > 1) || (d <= -1 && est->n[m - 1] - est->n[m] < -1)) {
+            int32_t ds = d > 0 ? 1 : -1;
+            float n_prev = est->n[m - 1], n_cur = est->n[m], n_next = est->n[m + 1];
+            // Piecewise-parabolic prediction
+            float qp = est->q[m] + ds / (n_next - n_prev) *
+                       ((n_cur - n_prev + ds) * (est->q[m + 1] - est->q[m]) / (n_next - n_cur) +
+                        (n_next - n_cur - ds) * (est->q[m] - est->q[m - 1]) / (n_cur - n_prev));
+            if (est->q[m - 1] < qp && qp < est->q[m + 1]) {
+                est->q[m] = qp;
+            } else { // Fall back to linear prediction
+                est->q[m] += ds * (est->q[m + ds] - est->q[m]) / (est->n[m + ds] - n_cur);
+            }
+            est->n[m] += ds;
+        }
+    }
+}
+
+static float p2_get(const p2_quantile_t *est) {
+    if (est->count == 0) {
+        return 0;
+    }
+    if (est->count < 5) { // Exact, the first observations are still sorted in q
+        uint32_t idx = (uint32_t)(est->p * (est->count - 1) + 0.5f);
+        return est->q[idx];
+    }
+    return est->q[2];
+}
+
+/* Pulse width distributions */
+
+static void pw_dist_init(pw_dist_t *dist) {
+    memset(dist, 0, sizeof(pw_dist_t));
+    p2_init(&dist->p50, 0.50f);
+    p2_init(&dist->p95, 0.95f);
+}
+
+static uint8_t pw_hist_bin(uint32_t width_us) {
+    if (width_us < (1UL << PW_HIST_MIN_EXP)) {
+        return 0;
+    }
+    uint32_t exp = 31 - __builtin_clz(width_us);                                // Octave
+    uint32_t sub = (width_us >> (exp - 2)) & (PW_HIST_SUB_BINS - 1);            // Next 2 bits below the leading one
+    uint32_t bin = (exp - PW_HIST_MIN_EXP) * PW_HIST_SUB_BINS + sub;
+    return bin < PW_HIST_N_BINS ? bin : PW_HIST_N_BINS - 1;
+}
+
+uint32_t pw_hist_bin_edge(uint8_t bin) {
+    uint32_t exp = PW_HIST_MIN_EXP + bin / PW_HIST_SUB_BINS;
+    uint32_t sub = bin % PW_HIST_SUB_BINS;
+    return (PW_HIST_SUB_BINS + sub) << (exp - 2);
+}
+
+void pw_stats_init(pw_stats_t *stats) {
+    for (size_t b = 0; b < PW_N_BANDS; b++) {
+        pw_dist_init(&stats->period[b]);
+        pw_dist_init(&stats->total[b]);
+    }
+}
+
+void pw_stats_begin_period(pw_stats_t *stats) {
+    for (size_t b = 0; b < PW_N_BANDS; b++) {
+        if (stats->period[b].count) {
+            pw_dist_init(&stats->period[b]);
+        }
+    }
+}
+
+uint8_t pw_stats_rpm_band(uint16_t rpm) {
+    return cal_axis_bin(&rpm_axis, rpm); // Last breakpoint <= rpm, the same bins as the calibration tables
+}
+
+static void pw_dist_add(pw_dist_t *dist, uint32_t width_us) {
+    dist->bins[pw_hist_bin(width_us)]++;
+    dist->count++;
+    dist->sum += width_us;
+    if (width_us > dist->max) {
+        dist->max = width_us;
+    }
+    p2_add(&dist->p50, width_us);
+    p2_add(&dist->p95, width_us);
+}
+
+void pw_stats_add(pw_stats_t *stats, uint8_t band, uint32_t width_us) {
+    if (band >= PW_N_BANDS) {
+        band = PW_N_BANDS - 1;
+    }
+    pw_dist_add(&stats->period[band], width_us);
+    pw_dist_add(&stats->total[band], width_us);
+}
+
+void pw_dist_summarise(const pw_dist_t *dist, pw_summary_t *summary) {
+    summary->count = dist->count;
+    summary->avg = dist->count ? (float)dist->sum / dist->count : 0;
+    summary->p50 = p2_get(&dist->p50);
+    summary->p95 = p2_get(&dist->p95);
+    summary->max = dist->max;
+}
@@ -0,0 +1,66 @@
+#ifndef __PW_STATS_H
+#define __PW_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "phys_const.h"
+
+// Constant-memory streaming pulse width distributions for injector characterisation.
+// Every pulse goes into a fixed log-binned histogram and two P² quantile estimators (p50, p95),
+// bucketed by the RPM bands of rpm_bp. Kept both per 600 ms period and cumulatively (since boot).
+// No raw widths are stored.
+
+#define PW_HIST_SUB_BINS        4       // Bins per octave (2^(1/4) ~ 19% wide)
+#define PW_HIST_MIN_EXP         9       // First bin starts at 2^9 = 512 us (anything shorter lands in bin 0)
+#define PW_HIST_N_BINS          24      // 6 octaves, up to 2^15 = 32768 us (anything longer lands in the last bin)
+#define PW_N_BANDS              N_RPM_BINS // Band i covers [rpm_bp[i], rpm_bp[i + 1]), first/last are open-ended
+
+// P² (Jain & Chlamtac) single-quantile estimator, 5 markers
+typedef struct p2_quantile_t {
+    float p;            // Target quantile (0; 1)
+    float q[5];         // Marker heights
+    float np[5];        // Desired marker positions
+    int32_t n[5];       // Actual marker positions
+    uint32_t count;     // Observations so far
+} p2_quantile_t;
+
+typedef struct pw_dist_t {
+    uint32_t bins[PW_HIST_N_BINS];
+    uint32_t count;
+    uint64_t sum;       // [us]
+    uint32_t max;       // [us]
+    p2_quantile_t p50;
+    p2_quantile_t p95;
+} pw_dist_t;
+
+typedef struct pw_stats_t {
+    pw_dist_t period[PW_N_BANDS];   // Reset every 600 ms period
+    pw_dist_t total[PW_N_BANDS];    // Since boot
+} pw_stats_t;
+
+typedef struct pw_summary_t {
+    uint32_t count;
+    float avg;          // [us]
+    float p50;          // [us]
+    float p95;          // [us]
+    uint32_t max;       // [us]
+} pw_summary_t;
+
+void pw_stats_init(pw_stats_t *stats);
+
+// Clears the per-period distributions, call at the start of each 600 ms period
+void pw_stats_begin_period(pw_stats_t *stats);
+
+// RPM band index for the current period
+uint8_t pw_stats_rpm_band(uint16_t rpm);
+
+// Per-pulse update, O(1)
+void pw_stats_add(pw_stats_t *stats, uint8_t band, uint32_t width_us);
+
+void pw_dist_summarise(const pw_dist_t *dist, pw_summary_t *summary);
+
+// Lower edge of histogram bin [us]
+uint32_t pw_hist_bin_edge(uint8_t bin);
+
+#endif
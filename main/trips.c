@@ -0,0 +1,148 @@
+#include "trips.h"
+#include "nvs.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "trips";
+
+#define TRIPS_VERSION 1
+
+// Also the NVS layout
+typedef struct __attribute__((packed)){
+    uint8_t version;            // TRIPS_VERSION
+    uint8_t head;               // Next slot to write; the trip in progress (if any) is the one before it
+    uint8_t count;              // Valid slots
+    uint8_t reserved;
+    uint32_t next_id;
+    trip_t ring[TRIP_RING_SIZE];
+} trips_store_t;
+
+static SemaphoreHandle_t trips_mutex = NULL;
+static trips_store_t store;     // Protected by trips_mutex
+static trip_t *current = NULL;  // Trip in progress, fuel_meter_task only
+static uint32_t quiet_ms = 0;   // [ms] Engine off and stationary since (not yet part of the trip's duration)
+static uint32_t off_ms = 0;     // [ms] ... with the ECU not answering either
+static bool dirty = false;      // Changed since the last save
+static bool ended = false;      // A trip ended since the last save
+static int64_t last_save_us = 0;
+
+void trips_init(void) {
+    if (get_fuel_blob("trips", &store, sizeof(store)) && store.version == TRIPS_VERSION &&
+        store.head < TRIP_RING_SIZE && store.count <= TRIP_RING_SIZE) {
+        for (size_t i = 0; i < TRIP_RING_SIZE; i++) {
+            if (store.ring[i].open) {
+                store.ring[i].open = 0; // Power went before the trip could end, it ends where it was last saved
+                dirty = true;
+                ESP_LOGI(TAG, "Closed trip %lu left open at power loss", store.ring[i].id);
+            }
+        }
+        ESP_LOGI(TAG, "Loaded %d trips", store.count);
+    } else {
+        memset(&store, 0, sizeof(store));
+        store.version = TRIPS_VERSION;
+        store.next_id = 1;
+    }
+    last_save_us = esp_timer_get_time();
+    trips_mutex = xSemaphoreCreateMutex();
+}
+
+static void trip_start(void) {
+    current = &store.ring[store.head];
+    memset(current, 0, sizeof(trip_t));
+    current->id = store.next_id++;
+    current->open = 1;
+    store.head = (store.head + 1) % TRIP_RING_SIZE;
+    if (store.count < TRIP_RING_SIZE) {
+        store.count++;
+    }
+    quiet_ms = 0;
+    off_ms = 0;
+    ESP_LOGI(TAG, "Trip %lu started", current->id);
+}
+
+void trips_update(uint32_t period_ms, uint32_t fuel_nl, uint32_t dist_mm, uint8_t speed, bool engine_running, bool ecu_answering) {
+    if (trips_mutex == NULL) {
+        return;
+    }
+    bool active = engine_running || speed > 0 || dist_mm > 0;
+    if (current == NULL && !active) {
+        return;
+    }
+
+    xSemaphoreTake(trips_mutex, portMAX_DELAY);
+    if (current == NULL) {
+        trip_start();
+    }
+    current->fuel_nl += fuel_nl;
+    current->dist_mm += dist_mm;
+    if (speed > current->max_speed) {
+        current->max_speed = speed;
+    }
+    if (active) {
+        current->duration_ms += quiet_ms + period_ms; // A short stop belongs to the trip after all
+        quiet_ms = 0;
+        off_ms = 0;
+        if (speed == 0 && dist_mm == 0) {
+            current->idle_ms += period_ms;
+            current->idle_fuel_nl += fuel_nl;
+        }
+    } else {
+        quiet_ms += period_ms;
+        off_ms = ecu_answering ? 0 : off_ms + period_ms;
+        if (quiet_ms >= TRIP_END_S * 1000 || off_ms >= TRIP_IGN_OFF_S * 1000) {
+            current->open = 0;
+            ESP_LOGI(TAG, "Trip %lu ended: %.2f km, %.2f L", current->id, current->dist_mm * 1e-6f, current->fuel_nl * 1e-9f);
+            current = NULL;
+            ended = true;
+        }
+    }
+    dirty = true;
+    xSemaphoreGive(trips_mutex);
+}
+
+void trips_save_if_due(void) {
+    if (trips_mutex == NULL || !dirty) {
+        return;
+    }
+    if (!ended && esp_timer_get_time() - last_save_us < (int64_t)TRIP_SAVE_S * 1000000) {
+        return;
+    }
+    trips_store_t *copy = malloc(sizeof(trips_store_t));
+    if (copy == NULL) {
+        ESP_LOGE(TAG, "No memory to save trips");
+        return;
+    }
+    xSemaphoreTake(trips_mutex, portMAX_DELAY);
+    *copy = store;
+    dirty = false;
+    ended = false;
+    xSemaphoreGive(trips_mutex);
+    if (!set_fuel_blob("trips", copy, sizeof(trips_store_t))) {
+        dirty = true; // Try again next time
+    }
+    last_save_us = esp_timer_get_time();
+    free(copy);
+}
+
+size_t trips_list(trip_t *out, size_t max) {
+    if (trips_mutex == NULL) {
+        return 0;
+    }
+    xSemaphoreTake(trips_mutex, portMAX_DELAY);
+    size_t n = store.count < max ? store.count : max;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = store.ring[(store.head + TRIP_RING_SIZE - 1 - i) % TRIP_RING_SIZE];
+    }
+    xSemaphoreGive(trips_mutex);
+    return n;
+}
+
+float trip_cons(const trip_t *trip) {
+    // 1 [nL/mm] = 1 [uL/m] = 1 [mL/km] = 100 [mL/100 km] = 0.1 [L/100 km]
+    return trip->dist_mm < 100 ? -1 : (float)trip->fuel_nl / trip->dist_mm * 0.1f;
+}
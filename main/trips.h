@@ -0,0 +1,46 @@
+#ifndef __TRIPS_H
+#define __TRIPS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Automatic trip segmentation. A trip starts with the first period the engine runs or the car moves, and ends once
+// the car has been standing with the engine off for TRIP_END_S, or as soon as TRIP_IGN_OFF_S pass with the ECU not
+// answering either (ignition off). Shorter stops stay inside the trip. Each trip's summary is updated in O(1) per
+// period and the last TRIP_RING_SIZE trips are kept in a fixed ring, persisted to NVS (on trip end and every
+// TRIP_SAVE_S while one is in progress). A trip still open at power loss is closed at boot as it was last saved.
+
+#define TRIP_RING_SIZE      16
+#define TRIP_END_S          300     // [s] Engine off and stationary (ECU still answering) for this long ends a trip
+#define TRIP_IGN_OFF_S      10      // [s] No injections and no ECU response for this long ends a trip
+#define TRIP_SAVE_S         60      // [s] Minimum time between NVS writes of a trip in progress
+
+typedef struct __attribute__((packed)){
+    uint32_t id;                // [-] Sequential (persisted), 0 = empty slot
+    uint32_t duration_ms;       // [ms] Excluding the trailing stop that ended it
+    uint32_t idle_ms;           // [ms] Engine running while stationary
+    uint64_t fuel_nl;           // [nL]
+    uint64_t idle_fuel_nl;      // [nL] Burnt while stationary
+    uint64_t dist_mm;           // [mm]
+    uint8_t max_speed;          // [km/h]
+    uint8_t open;               // Still in progress
+    uint8_t reserved[2];
+} trip_t;
+
+// Loads the stored ring (NVS must be up)
+void trips_init(void);
+
+// One period. engine_running: injections seen (or the ECU reports RPM); ecu_answering: ignition is on
+void trips_update(uint32_t period_ms, uint32_t fuel_nl, uint32_t dist_mm, uint8_t speed, bool engine_running, bool ecu_answering);
+
+// Saves if a trip ended or the one in progress is due
+void trips_save_if_due(void);
+
+// Copies up to max trips, newest first; returns how many
+size_t trips_list(trip_t *out, size_t max);
+
+// Average over the trip [L/100 km], -1 if it hasn't moved (< 0.1 m)
+float trip_cons(const trip_t *trip);
+
+#endif
@@ -4,6 +4,8 @@
 static char index_html[4096];
 static char response_data[4096];
 static int active_clients = 0;
+static int scope_clients[MAX_SCOPE_CLIENTS];    // fds subscribed to the pulse stream
+static volatile size_t scope_client_count = 0;   // Read by the scope task without locking
 
 httpd_handle_t server = NULL;
 
@@ -95,7 +97,13 @@ esp_err_t static_file_handler(httpd_req_t *req) {
 
     char buffer[512];
     size_t read_bytes;
-    while ((read_bytes = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    while (1) {
+        flash_op_begin(); // SPIFFS reads disable the flash cache
+        read_bytes = fread(buffer, 1, sizeof(buffer), file);
+        flash_op_end();
+        if (read_bytes == 0) {
+            break;
+        }
         httpd_resp_send_chunk(req, buffer, read_bytes);
     }
     fclose(file);
@@ -105,6 +113,36 @@ esp_err_t static_file_handler(httpd_req_t *req) {
     return ESP_OK;
 }
 
+/* Pulse stream subscribers */
+
+bool ws_scope_add_client(int fd) {
+    for (size_t i = 0; i < scope_client_count; i++) {
+        if (scope_clients[i] == fd) {
+            return true;
+        }
+    }
+    if (scope_client_count >= MAX_SCOPE_CLIENTS) {
+        return false;
+    }
+    scope_clients[scope_client_count] = fd;
+    scope_client_count++;
+    return true;
+}
+
+void ws_scope_remove_client(int fd) {
+    for (size_t i = 0; i < scope_client_count; i++) {
+        if (scope_clients[i] == fd) {
+            scope_clients[i] = scope_clients[scope_client_count - 1]; // Order doesn't matter
+            scope_client_count--;
+            return;
+        }
+    }
+}
+
+size_t ws_scope_client_count(void) {
+    return scope_client_count;
+}
+
 static void ws_async_send(void *arg) {
     struct async_resp_arg *resp_arg = (struct async_resp_arg *)arg;
     if (!resp_arg || !resp_arg->message) {
@@ -117,15 +155,22 @@ static void ws_async_send(void *arg) {
 
     httpd_ws_frame_t ws_pkt = {
         .payload = (uint8_t *)resp_arg->message,
-        .len = strlen(resp_arg->message),
-        .type = HTTPD_WS_TYPE_TEXT,
+        .len = resp_arg->len,
+        .type = resp_arg->type,
     };
 
     size_t fds = 16;
     int client_fds[fds];
     memset(client_fds, 0, sizeof(client_fds));
     
-    esp_err_t ret = httpd_get_client_list(server, &fds, client_fds);
+    esp_err_t ret = ESP_OK;
+    if (resp_arg->scope_only) {
+        // Copy, the list shrinks below if a subscriber has gone away
+        fds = scope_client_count;
+        memcpy(client_fds, scope_clients, fds * sizeof(int));
+    } else {
+        ret = httpd_get_client_list(server, &fds, client_fds);
+    }
     if (ret != ESP_OK) {
 #ifdef WS_DEBUG
         printf("Failed to get client list: %s\n", esp_err_to_name(ret));
@@ -151,6 +196,9 @@ static void ws_async_send(void *arg) {
 #ifdef WS_DEBUG
             printf("Skipping non-WebSocket client: %d\n", client_fds[i]);
 #endif
+            if (resp_arg->scope_only) {
+                ws_scope_remove_client(client_fds[i]); // Closed without unsubscribing
+            }
             continue;
         }
 
@@ -212,6 +260,9 @@ esp_err_t trigger_async_send(httpd_handle_t handle, const char *message) {
 
     // Store the WebSocket handle
     resp_arg->hd = handle;
+    resp_arg->len = strlen(resp_arg->message);
+    resp_arg->type = HTTPD_WS_TYPE_TEXT;
+    resp_arg->scope_only = false;
 
     // Queue the async task for sending
     esp_err_t ret = httpd_queue_work(handle, ws_async_send, resp_arg);
@@ -226,6 +277,41 @@ esp_err_t trigger_async_send(httpd_handle_t handle, const char *message) {
     return ret;
 }
 
+esp_err_t trigger_async_send_scope(httpd_handle_t handle, const uint8_t *data, size_t len) {
+    if (data == NULL || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct async_resp_arg *resp_arg = malloc(sizeof(struct async_resp_arg));
+    if (resp_arg == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // One copy per frame, the caller reuses its frame buffer straight away
+    resp_arg->message = malloc(len);
+    if (resp_arg->message == NULL) {
+        free(resp_arg);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(resp_arg->message, data, len);
+
+    resp_arg->hd = handle;
+    resp_arg->len = len;
+    resp_arg->type = HTTPD_WS_TYPE_BINARY;
+    resp_arg->scope_only = true;
+
+    esp_err_t ret = httpd_queue_work(handle, ws_async_send, resp_arg);
+    if (ret != ESP_OK) {
+#ifdef WS_DEBUG
+        printf("Failed to queue scope frame. Err: %s\n", esp_err_to_name(ret));
+#endif
+        free(resp_arg->message);
+        free(resp_arg);
+    }
+
+    return ret;
+}
+
 static esp_err_t handle_ws_req(httpd_req_t *req) {
     if (req->method == HTTP_GET)
     {
@@ -233,6 +319,7 @@ static esp_err_t handle_ws_req(httpd_req_t *req) {
         printf("Handshake done, the new connection was opened\n");
 #endif
         active_clients++;
+        ws_scope_remove_client(httpd_req_to_sockfd(req)); // fd may be reused from a closed subscriber
         return ESP_OK;
     }
 
@@ -300,6 +387,27 @@ static esp_err_t handle_ws_req(httpd_req_t *req) {
     else if (strcmp(cmd_type->valuestring, "delete_fuel_data") == 0) {
         delete_fuel_data();
     }
+    else if (strcmp(cmd_type->valuestring, "scope_subscribe") == 0) {
+        scope_subscribe(root, httpd_req_to_sockfd(req));
+    }
+    else if (strcmp(cmd_type->valuestring, "scope_unsubscribe") == 0) {
+        scope_unsubscribe(httpd_req_to_sockfd(req));
+    }
+    else if (strcmp(cmd_type->valuestring, "profile_list") == 0) {
+        profile_list();
+    }
+    else if (strcmp(cmd_type->valuestring, "profile_select") == 0) {
+        profile_select(root);
+    }
+    else if (strcmp(cmd_type->valuestring, "profile_save") == 0) {
+        profile_save(root);
+    }
+    else if (strcmp(cmd_type->valuestring, "heatmap_clear") == 0) {
+        fuel_heatmap_clear();
+    }
+    else if (strcmp(cmd_type->valuestring, "trip_list") == 0) {
+        trip_list();
+    }
 
     cJSON_Delete(root);
     free(buf);
@@ -307,9 +415,56 @@ static esp_err_t handle_ws_req(httpd_req_t *req) {
     return ESP_OK;
 }
 
+// Calibration upload: the body is the binary set (calib.h), streamed into the inactive flash half
+static esp_err_t calib_upload_handler(httpd_req_t *req) {
+    char msg[96];
+    esp_err_t err = calib_update_begin(req->content_len);
+    if (err != ESP_OK) {
+        snprintf(msg, sizeof(msg), "{\"ok\":false,\"msg\":\"cannot start update (%s)\"}", esp_err_to_name(err));
+        httpd_resp_set_type(req, "application/json");
+        return httpd_resp_sendstr(req, msg);
+    }
+
+    char buf[512];
+    size_t remaining = req->content_len;
+    while (remaining > 0) {
+        int n = httpd_req_recv(req, buf, remaining < sizeof(buf) ? remaining : sizeof(buf));
+        if (n == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (n <= 0 || calib_update_write(buf, n) != ESP_OK) {
+            calib_update_abort();
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Calibration upload failed");
+            return ESP_FAIL;
+        }
+        remaining -= n;
+    }
+
+    char result[64];
+    err = calib_update_commit(result, sizeof(result));
+    snprintf(msg, sizeof(msg), "{\"ok\":%s,\"msg\":\"%s\"}", err == ESP_OK ? "true" : "false", result);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, msg);
+}
+
+// Consumption heatmap as one binary blob (fuel_heatmap.h), formatted by the browser
+static esp_err_t heatmap_get_handler(httpd_req_t *req) {
+    uint8_t *blob = malloc(FUEL_HEATMAP_BLOB_SIZE);
+    if (blob == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    fuel_heatmap_blob(blob);
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    esp_err_t err = httpd_resp_send(req, (const char *)blob, FUEL_HEATMAP_BLOB_SIZE);
+    free(blob);
+    return err;
+}
+
 httpd_handle_t setup_websocket_server(void) {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.max_uri_handlers = 12;
+    config.max_uri_handlers = 14;
     config.stack_size = 8192;
 
     httpd_uri_t uri_get = {
@@ -325,6 +480,18 @@ httpd_handle_t setup_websocket_server(void) {
         .user_ctx = NULL,
         .is_websocket = true};
 
+    httpd_uri_t calib_post = {
+        .uri = "/calib",
+        .method = HTTP_POST,
+        .handler = calib_upload_handler,
+        .user_ctx = NULL};
+
+    httpd_uri_t heatmap_get = {
+        .uri = "/heatmap",
+        .method = HTTP_GET,
+        .handler = heatmap_get_handler,
+        .user_ctx = NULL};
+
     // List of files to make uri handlers for
     const char * filenames[] = {
         "styles.css",
@@ -333,6 +500,7 @@ httpd_handle_t setup_websocket_server(void) {
         "comms.html",
         "debugfuel.html",
         "fuel.html",
+        "injector.html",
         "logs.html"
         };
 
@@ -353,6 +521,8 @@ httpd_handle_t setup_websocket_server(void) {
         }
 
         httpd_register_uri_handler(server, &ws);
+        httpd_register_uri_handler(server, &calib_post);
+        httpd_register_uri_handler(server, &heatmap_get);
     }
     return server;
 }
@@ -365,6 +535,8 @@ void close_websocket_client(httpd_handle_t server, int client_fd) {
         return;
     }
 
+    ws_scope_remove_client(client_fd);
+
     // Attempt to close the client session
     esp_err_t ret = httpd_sess_trigger_close(server, client_fd);
 #ifdef WS_DEBUG
@@ -11,6 +11,9 @@
 #include <esp_http_server.h>
 #include "nvs_flash.h"
 #include "esp_spiffs.h"
+#include "flash_guard.h"
+#include "calib.h"
+#include "fuel_heatmap.h"
 #include "cJSON.h"
 #include <dirent.h>
 #include <sys/stat.h>
@@ -20,10 +23,14 @@
 #define MAX_RETRIES 3       // WebSocket packet retry
 #define SERVER_RESERVED_SOCKETS 3
 #define INDEX_HTML_PATH "/spiffs/index.html"
+#define MAX_SCOPE_CLIENTS 4 // WebSocket clients that can subscribe to the raw pulse stream at once
 
 struct async_resp_arg {
     httpd_handle_t hd;
     char *message;
+    size_t len;             // Payload length (text frames: strlen(message))
+    httpd_ws_type_t type;   // HTTPD_WS_TYPE_TEXT or HTTPD_WS_TYPE_BINARY
+    bool scope_only;        // Send only to clients subscribed to the pulse stream
 };
 
 void initi_web_page_buffer(void);
@@ -38,6 +45,17 @@ esp_err_t static_file_handler(httpd_req_t *req);
 
 esp_err_t trigger_async_send(httpd_handle_t handle, const char *message);
 
+// Binary frame to the pulse stream subscribers only (one copy of the frame per call)
+esp_err_t trigger_async_send_scope(httpd_handle_t handle, const uint8_t *data, size_t len);
+
+/* Pulse stream (scope) subscribers, only modified from the HTTP server task */
+
+bool ws_scope_add_client(int fd);
+
+void ws_scope_remove_client(int fd);
+
+size_t ws_scope_client_count(void);
+
 httpd_handle_t setup_websocket_server(void);
 
 void close_websocket_client(httpd_handle_t server, int client_fd);
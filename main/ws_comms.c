@@ -3,6 +3,7 @@
 extern httpd_handle_t server;
 
 extern TaskHandle_t current_page_task_handle;
+extern TaskHandle_t scope_task_handle;
 
 extern char currently_open_page[32];
 
@@ -13,8 +14,8 @@ const char *TAG = "ws_comms";
 static void send_stored_vals(void) {
     cJSON *root = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "type", "stored_vals");
-    cJSON_AddNumberToObject(root, "fuel", get_fuel_consumed() * 0.000001); // [uL] to [L]
-    cJSON_AddNumberToObject(root, "dist", get_dist_tr() * 0.001);          // [m] to [km]
+    cJSON_AddNumberToObject(root, "fuel", get_fuel_consumed() * 1e-9);     // [nL] to [L]
+    cJSON_AddNumberToObject(root, "dist", get_dist_tr() * 1e-6);           // [mm] to [km]
 
     char *json_str = cJSON_PrintUnformatted(root);
     if (trigger_async_send(server, json_str) != ESP_OK) {
@@ -55,9 +56,35 @@ void send_comms_data_pack(comms_data_pack_t data) {
 #endif
 }
 
+void send_kwp_timing_data_pack(const kwp_timing_data_pack_t *data) {
+    char buf[64 + OBD9141_LAT_SLOTS * 32];
+    int len = snprintf(buf, sizeof(buf), "k|%d|%d|%d|%d|%d|%d|%d|%d|", data->retries, data->recovered,
+                       data->negotiated, data->p2_min, data->p2_max, data->p3_min, data->p4_min, data->n);
+    for(size_t i = 0; i < data->n && len < (int)sizeof(buf); i++){
+        len += snprintf(buf + len, sizeof(buf) - len, "%d|%d|%d|%d|%d|%d|%d|",
+                        data->lat[i].service,
+                        data->lat[i].pid,
+                        data->lat[i].samples,
+                        data->lat[i].lost,
+                        data->lat[i].p50_ms,
+                        data->lat[i].p99_ms,
+                        data->lat[i].timeout_ms
+                        );
+    }
+
+    if (trigger_async_send(server, buf) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send kwp timing.");
+    }
+#ifdef COMMS_DEBUG
+    else{
+        printf("Sent: %s\n", buf);
+    }
+#endif
+}
+
 void send_debug_fuel_data_pack(debug_fuel_data_pack_t data) {
-    char buf[128];
-    snprintf(buf, sizeof(buf), "d|%.1f|%.1f|%.1f|%.2f|%d|%d|%d|%d|%d|%.1f|%.1f|%.1f|",
+    char buf[224];
+    snprintf(buf, sizeof(buf), "d|%.1f|%.1f|%.1f|%.2f|%d|%d|%d|%d|%d|%.1f|%.1f|%.1f|%lu|%d|%d|%d|%.3f|%d|%lu|%d|%lu|%d|%.3f|%.1f|%.1f|%d|%d|",
                      data.inst_fuel,
                      data.avg_fuel,
                      data.dist_tr,
@@ -69,7 +96,22 @@ void send_debug_fuel_data_pack(debug_fuel_data_pack_t data) {
                      data.pdelta,
                      data.avg_pwidth,
                      data.amb_temp,
-                     data.baro_pressure
+                     data.baro_pressure,
+                     data.ring_overflow,
+                     data.ring_high_water,
+                     data.inj_rpm,
+                     data.recon_pcnt,
+                     data.raw_fuel,
+                     data.confidence,
+                     data.lost_edges,
+                     data.flash_periods,
+                     data.flash_lost_edges,
+                     data.lut_rebuilds,
+                     data.lut_err,
+                     data.period_ms,
+                     data.kwp_ms,
+                     data.loop_overruns,
+                     data.late_wakeups
                     );
 
     if (trigger_async_send(server, buf) != ESP_OK) {
@@ -82,15 +124,67 @@ void send_debug_fuel_data_pack(debug_fuel_data_pack_t data) {
 #endif
 }
 
+void send_cyl_fuel_data_pack(cyl_fuel_data_pack_t data) {
+    char buf[64 + N_CYL * 64];
+    int len = snprintf(buf, sizeof(buf), "y|%d|", data.n_channels);
+    for(size_t c = 0; c < data.n_channels && len < (int)sizeof(buf); c++){
+        len += snprintf(buf + len, sizeof(buf) - len, "%d|%d|%.2f|%.1f|%.1f|%lu|",
+                        data.ch[c].cyl,
+                        data.ch[c].pcnt,
+                        data.ch[c].avg_pwidth,
+                        data.ch[c].period_fuel,
+                        data.ch[c].cons_fuel,
+                        data.ch[c].ring_overflow
+                        );
+    }
+
+    if (trigger_async_send(server, buf) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send cyl_fuel.");
+    }
+#ifdef COMMS_DEBUG
+    else{
+        printf("Sent: %s\n", buf);
+    }
+#endif
+}
+
+void send_isr_prof_data_pack(isr_prof_data_pack_t data) {
+    if(!data.enabled){return;} // Nothing recorded, the page keeps showing placeholders
+    char buf[128];
+    snprintf(buf, sizeof(buf), "i|%lu|%.2f|%.2f|%.2f|%.2f|%.2f|%.2f|%.2f|%.2f|%.2f|",
+                     data.samples,
+                     data.dur_min,
+                     data.dur_avg,
+                     data.dur_p99,
+                     data.dur_max,
+                     data.stamp_min,
+                     data.stamp_avg,
+                     data.stamp_p99,
+                     data.stamp_max,
+                     data.width_err_p99
+                    );
+
+    if (trigger_async_send(server, buf) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send isr_prof.");
+    }
+#ifdef COMMS_DEBUG
+    else{
+        printf("Sent: %s\n", buf);
+    }
+#endif
+}
+
 void send_fuel_data_pack(fuel_data_pack_t data) {
     char buf[128];
-    snprintf(buf, sizeof(buf), "f|%.1f|%.1f|%d|%.2f|%.1f|%.0f|",
+    snprintf(buf, sizeof(buf), "f|%.1f|%.1f|%d|%.2f|%.1f|%.0f|%.1f|%.1f|",
                                 data.inst_fuel,
                                 data.avg_fuel,
                                 data.coolant_temp,
                                 data.cons_fuel,
                                 data.fuel_last_6,
-                                data.fuel_last_60
+                                data.fuel_last_60,
+                                data.avg_10m,
+                                data.avg_1h
                                 );
 
     if (trigger_async_send(server, buf) != ESP_OK) {
@@ -103,6 +197,143 @@ void send_fuel_data_pack(fuel_data_pack_t data) {
 #endif
 }
 
+static void add_pw_dist_to_json(cJSON *band_obj, const char *name, const pw_dist_t *dist) {
+    pw_summary_t summary;
+    pw_dist_summarise(dist, &summary);
+    cJSON *obj = cJSON_AddObjectToObject(band_obj, name);
+    cJSON_AddNumberToObject(obj, "n", summary.count);
+    cJSON_AddNumberToObject(obj, "avg", (int)summary.avg);     // [us]
+    cJSON_AddNumberToObject(obj, "p50", (int)summary.p50);     // [us]
+    cJSON_AddNumberToObject(obj, "p95", (int)summary.p95);     // [us]
+    cJSON_AddNumberToObject(obj, "max", summary.max);          // [us]
+    cJSON *hist = cJSON_AddArrayToObject(obj, "hist");
+    for(size_t i = 0; i < PW_HIST_N_BINS; i++){
+        cJSON_AddItemToArray(hist, cJSON_CreateNumber(dist->bins[i]));
+    }
+}
+
+void send_pw_stats_data(const pw_stats_t *stats) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "type", "pw_stats");
+
+    cJSON *edges = cJSON_AddArrayToObject(root, "edges");     // [us] Lower bin edges
+    for(size_t i = 0; i < PW_HIST_N_BINS; i++){
+        cJSON_AddItemToArray(edges, cJSON_CreateNumber(pw_hist_bin_edge(i)));
+    }
+    cJSON *bands = cJSON_AddArrayToObject(root, "bands");
+    for(size_t b = 0; b < PW_N_BANDS; b++){
+        cJSON *band = cJSON_CreateObject();
+        cJSON_AddNumberToObject(band, "rpm", rpm_bp[b]);        // [RPM] Lower band edge
+        add_pw_dist_to_json(band, "period", &stats->period[b]);
+        add_pw_dist_to_json(band, "total", &stats->total[b]);
+        cJSON_AddItemToArray(bands, band);
+    }
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    if (trigger_async_send(server, json_str) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send pw_stats");
+    }
+
+#ifdef COMMS_DEBUG
+    else{
+        printf("Sent: %s\n", json_str);
+    }
+#endif
+
+    free(json_str);
+    cJSON_Delete(root);
+}
+
+void send_scope_frame(const uint8_t *frame, size_t len) {
+    if (trigger_async_send_scope(server, frame, len) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send scope frame");
+    }
+}
+
+static void add_profile_to_json(cJSON *root, const char *name, const engine_profile_t *profile) {
+    cJSON *obj = cJSON_AddObjectToObject(root, name);
+    cJSON_AddStringToObject(obj, "name", profile->name);
+    cJSON_AddNumberToObject(obj, "n_cyl", profile->n_cyl);
+    cJSON_AddNumberToObject(obj, "rail_pressure", profile->rail_pressure);               // [Pa]
+    cJSON_AddNumberToObject(obj, "flow_pressure", profile->static_flow_pressure);        // [Pa]
+    cJSON_AddNumberToObject(obj, "flow", profile->static_flow_ml_min);                   // [mL/min]
+    cJSON_AddNumberToObject(obj, "deadtime", profile->deadtime);                         // [us]
+    cJSON_AddNumberToObject(obj, "opening", profile->full_opening_time);                 // [us]
+    cJSON_AddNumberToObject(obj, "closing", profile->full_closing_time);                 // [us]
+    cJSON_AddNumberToObject(obj, "reset", profile->reset_time);                          // [us]
+}
+
+// Stored profiles, the active slot and the profile in use (may differ from its slot while being tuned)
+static void send_profiles(const char *msg) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "type", "profiles");
+    cJSON_AddNumberToObject(root, "active", get_active_profile_slot());
+    if (msg) {
+        cJSON_AddStringToObject(root, "msg", msg);
+    }
+    engine_profile_t profile;
+    get_engine_profile(&profile);
+    add_profile_to_json(root, "current", &profile);
+    cJSON *slots = cJSON_AddArrayToObject(root, "slots");
+    for (uint8_t i = 0; i < PROFILE_SLOTS; i++) {
+        if (get_engine_profile_slot(i, &profile)) {
+            cJSON *item = cJSON_CreateObject();
+            cJSON_AddNumberToObject(item, "slot", i);
+            cJSON_AddStringToObject(item, "name", profile.name);
+            cJSON_AddItemToArray(slots, item);
+        }
+    }
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    if (trigger_async_send(server, json_str) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send profiles");
+    }
+
+#ifdef COMMS_DEBUG
+    else{
+        printf("Sent: %s\n", json_str);
+    }
+#endif
+
+    free(json_str);
+    cJSON_Delete(root);
+}
+
+// Last trips, newest first
+static void send_trips(void) {
+    trip_t trips[TRIP_RING_SIZE];
+    size_t n = trips_list(trips, TRIP_RING_SIZE);
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "type", "trips");
+    cJSON *arr = cJSON_AddArrayToObject(root, "trips");
+    for (size_t i = 0; i < n; i++) {
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "id", trips[i].id);
+        cJSON_AddBoolToObject(item, "open", trips[i].open);
+        cJSON_AddNumberToObject(item, "dur", trips[i].duration_ms / 1000);       // [s]
+        cJSON_AddNumberToObject(item, "idle", trips[i].idle_ms / 1000);          // [s]
+        cJSON_AddNumberToObject(item, "fuel", trips[i].fuel_nl * 1e-9);          // [L]
+        cJSON_AddNumberToObject(item, "idle_fuel", trips[i].idle_fuel_nl * 1e-9); // [L]
+        cJSON_AddNumberToObject(item, "dist", trips[i].dist_mm * 1e-6);          // [km]
+        cJSON_AddNumberToObject(item, "vmax", trips[i].max_speed);               // [km/h]
+        cJSON_AddNumberToObject(item, "cons", trip_cons(&trips[i]));             // [L/100 km], -1 if it hasn't moved
+        cJSON_AddItemToArray(arr, item);
+    }
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    if (trigger_async_send(server, json_str) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send trips");
+    }
+
+#ifdef COMMS_DEBUG
+    else{
+        printf("Sent: %s\n", json_str);
+    }
+#endif
+
+    free(json_str);
+    cJSON_Delete(root);
+}
 
 /* Receive */
 
@@ -118,34 +349,34 @@ void set_open_page(cJSON *root) {
 }
 
 void load_fuel_data(void) {
-    double fuel_consumed = get_fuel_consumed();
-    double dist_tr = get_dist_tr();
-    float fuel_cons_avg = dist_tr ? fuel_consumed / dist_tr * 0.1 : -1;
-    // 1 [uL/m] = 1 [mL/km] = 100 [mL/100 km] = 0.1 [L/100 km]
+    uint64_t fuel_consumed = get_fuel_consumed();
+    uint64_t dist_tr = get_dist_tr();
+    float fuel_cons_avg = dist_tr ? (float)fuel_consumed / dist_tr * 0.1f : -1;
+    // 1 [nL/mm] = 1 [uL/m] = 1 [mL/km] = 100 [mL/100 km] = 0.1 [L/100 km]
     fuel_stats_t fuel_stats = {
         .fuel_cons_inst = -1,
         .fuel_cons_avg = fuel_cons_avg,
         .fuel_consumed = fuel_consumed,
         .dist_tr = dist_tr,
-        .fuel_cons_last_6 = 0,
-        .fuel_cons_last_60 = 0
     };
     set_stats(&fuel_stats);
 }
 
 void save_ovw_fuel_data(void) {
-    const fuel_stats_t *fuel_stats = get_stats();
-    set_fuel_consumed(fuel_stats->fuel_consumed);
-    set_dist_tr(fuel_stats->dist_tr);
+    fuel_stats_t fuel_stats;
+    get_stats(&fuel_stats);
+    set_fuel_consumed(fuel_stats.fuel_consumed);
+    set_dist_tr(fuel_stats.dist_tr);
     send_stored_vals();
 }
 
 void save_add_fuel_data(void) {
-    const fuel_stats_t *fuel_stats = get_stats();
-    double fuel_consumed = get_fuel_consumed();
-    double dist_tr = get_dist_tr();
-    fuel_consumed += fuel_stats->fuel_consumed;
-    dist_tr += fuel_stats->dist_tr;
+    fuel_stats_t fuel_stats;
+    get_stats(&fuel_stats);
+    uint64_t fuel_consumed = get_fuel_consumed();
+    uint64_t dist_tr = get_dist_tr();
+    fuel_consumed += fuel_stats.fuel_consumed;
+    dist_tr += fuel_stats.dist_tr;
     set_fuel_consumed(fuel_consumed);
     set_dist_tr(dist_tr);
     send_stored_vals();
@@ -157,8 +388,6 @@ void clear_fuel_data(void) {
         .fuel_cons_avg = -1,
         .fuel_consumed = 0,
         .dist_tr = 0,
-        .fuel_cons_last_6 = 0,
-        .fuel_cons_last_60 = 0
     };
     set_stats(&fuel_stats);
 }
@@ -167,4 +396,103 @@ void delete_fuel_data(void) {
     set_fuel_consumed(0);
     set_dist_tr(0);
     send_stored_vals();
-}
\ No newline at end of file
+}
+void scope_subscribe(cJSON *root, int fd) {
+    cJSON *fps = cJSON_GetObjectItem(root, "fps");
+    if(cJSON_IsNumber(fps)){
+        set_scope_fps(fps->valueint);
+    }
+    if(!ws_scope_add_client(fd)){
+        ESP_LOGW(TAG, "Too many scope subscribers, ignoring client %d", fd); return;
+    }
+    ESP_LOGI(TAG, "Client %d subscribed to the pulse stream", fd);
+    if(scope_task_handle){xTaskNotifyGive(scope_task_handle);} // Wake it up to start capturing
+}
+
+void scope_unsubscribe(int fd) {
+    ws_scope_remove_client(fd);
+    ESP_LOGI(TAG, "Client %d unsubscribed from the pulse stream", fd);
+}
+
+void profile_list(void) {
+    send_profiles(NULL);
+}
+
+void profile_select(cJSON *root) {
+    cJSON *slot = cJSON_GetObjectItem(root, "slot");
+    if(!cJSON_IsNumber(slot) || slot->valueint < 0 || slot->valueint >= PROFILE_SLOTS){
+        send_profiles("Invalid slot"); return;
+    }
+    engine_profile_t profile;
+    if(!get_engine_profile_slot(slot->valueint, &profile)){
+        send_profiles("Slot is empty"); return;
+    }
+    char msg[80];
+    if(set_engine_profile(&profile, msg, sizeof(msg))){
+        set_active_profile_slot(slot->valueint);
+    }
+    send_profiles(msg);
+}
+
+// True if the key is there and a whole number 0-max; one that's there but isn't sets *bad to the key
+static bool get_json_uint(cJSON *root, const char *key, uint32_t max, uint32_t *value, const char **bad) {
+    cJSON *item = cJSON_GetObjectItem(root, key);
+    if(!cJSON_IsNumber(item)){return false;}
+    if(!(item->valuedouble >= 0 && item->valuedouble <= max) || item->valuedouble != (uint32_t)item->valuedouble){
+        *bad = key; return false;
+    }
+    *value = (uint32_t)item->valuedouble;
+    return true;
+}
+
+// Fields not in the message keep the current profile's values, so a single one can be tuned live
+void profile_save(cJSON *root) {
+    cJSON *slot = cJSON_GetObjectItem(root, "slot");
+    cJSON *item;
+    if(!cJSON_IsNumber(slot) || slot->valueint < 0 || slot->valueint >= PROFILE_SLOTS){
+        send_profiles("Invalid slot"); return;
+    }
+    engine_profile_t profile;
+    get_engine_profile(&profile);
+    if(cJSON_IsString(item = cJSON_GetObjectItem(root, "name"))){
+        memset(profile.name, 0, PROFILE_NAME_LEN);
+        strncpy(profile.name, item->valuestring, PROFILE_NAME_LEN - 1);
+    }
+    // Range-checked before narrowing, so e.g. 257 cylinders can't wrap around into a valid-looking 1
+    const char *bad = NULL;
+    uint32_t value;
+    if(get_json_uint(root, "n_cyl", UINT8_MAX, &value, &bad)){profile.n_cyl = value;}
+    if(get_json_uint(root, "rail_pressure", UINT32_MAX, &value, &bad)){profile.rail_pressure = value;}
+    if(get_json_uint(root, "flow_pressure", UINT32_MAX, &value, &bad)){profile.static_flow_pressure = value;}
+    if(cJSON_IsNumber(item = cJSON_GetObjectItem(root, "flow"))){profile.static_flow_ml_min = item->valuedouble;}
+    if(get_json_uint(root, "deadtime", UINT16_MAX, &value, &bad)){profile.deadtime = value;}
+    if(get_json_uint(root, "opening", UINT16_MAX, &value, &bad)){profile.full_opening_time = value;}
+    if(get_json_uint(root, "closing", UINT16_MAX, &value, &bad)){profile.full_closing_time = value;}
+    if(get_json_uint(root, "reset", UINT16_MAX, &value, &bad)){profile.reset_time = value;}
+
+    char msg[80];
+    if(bad){
+        snprintf(msg, sizeof(msg), "%s must be a whole number in range", bad);
+        send_profiles(msg); return;
+    }
+    if(!check_engine_profile(&profile, msg, sizeof(msg))){
+        send_profiles(msg); return;
+    }
+    // Saving the active slot tunes the running profile, anything else just stores it.
+    // Applied first, so a profile the fuel meter doesn't take isn't stored as the active one either
+    bool active = slot->valueint == get_active_profile_slot();
+    if(active && !set_engine_profile(&profile, msg, sizeof(msg))){
+        send_profiles(msg); return;
+    }
+    if(!set_engine_profile_slot(slot->valueint, &profile)){
+        send_profiles(active ? "Applied, but failed to save profile" : "Failed to save profile"); return;
+    }
+    if(!active){
+        snprintf(msg, sizeof(msg), "Saved to slot %d", slot->valueint);
+    }
+    send_profiles(msg);
+}
+
+void trip_list(void) {
+    send_trips();
+}
@@ -4,7 +4,10 @@
 #include "websocket.h"
 #include "esp_log.h"
 #include "fm_tasks.h"
+#include "obd9141.h"
 #include "nvs.h"
+#include "phys_const.h"
+#include "pw_stats.h"
 
 // #define COMMS_DEBUG // uncomment to enable WS communications debug
 
@@ -34,9 +37,49 @@ typedef struct __attribute__((packed)){
     float avg_pwidth;       // [ms]
     float amb_temp;         // [°C]
     float baro_pressure;    // [kPa]
-
+    uint32_t ring_overflow; // [-] Pulses dropped by the ISR (since boot)
+    uint16_t ring_high_water; // [-] Max pulse ring fill level (since boot)
+    uint16_t inj_rpm;       // [RPM] Injector-derived RPM, 0 if not available
+    uint16_t recon_pcnt;    // [-] Missed injections reconciled in the last period
+    float raw_fuel;         // [L] Fuel consumed from captured pulses only
+    uint8_t confidence;     // [%] Share of the last period's injections that were captured
+    uint32_t lost_edges;    // [-] Pulses lost to missed edges (since boot)
+    uint16_t flash_periods; // [-] Periods that overlapped a flash operation (since boot)
+    uint32_t flash_lost_edges; // [-] Pulses lost to missed edges in those periods (since boot)
+    uint16_t lut_rebuilds;  // [-] Fuel LUT builds (since boot)
+    float lut_err;          // [%] Fuel LUT max interpolation error
+    float period_ms;        // [ms] Measured length of the last fuel_meter_task period
+    float kwp_ms;           // [ms] Time its KWP requests took
+    uint16_t loop_overruns; // [-] Periods that ran past the next wake time (since boot)
+    uint16_t late_wakeups;  // [-] Late wakeups (since boot)
 } debug_fuel_data_pack_t; // In-depth data for debugging
 
+typedef struct __attribute__((packed)){
+    uint8_t n_channels;     // [-] Injector channels in use
+    struct __attribute__((packed)){
+        uint8_t cyl;            // [-] Cylinder number
+        uint16_t pcnt;          // [-] Pulses captured in the last period
+        float avg_pwidth;       // [ms]
+        float period_fuel;      // [uL] Fuel injected in the last period
+        float cons_fuel;        // [mL] Fuel injected (since boot)
+        uint32_t ring_overflow; // [-] Pulses dropped by this channel's ISR (since boot)
+    } ch[N_CYL];            // Only the first n_channels are used
+} cyl_fuel_data_pack_t; // Per-cylinder injector data
+
+typedef struct __attribute__((packed)){
+    bool enabled;           // False if built without INJECTOR_ISR_PROFILE
+    uint32_t samples;       // [-] ISR invocations recorded
+    float dur_min;          // [us] ISR entry -> exit
+    float dur_avg;          // [us]
+    float dur_p99;          // [us]
+    float dur_max;          // [us]
+    float stamp_min;        // [us] ISR entry -> edge timestamp taken
+    float stamp_avg;        // [us]
+    float stamp_p99;        // [us]
+    float stamp_max;        // [us]
+    float width_err_p99;    // [us] Pulse width error added by the capture path (p99)
+} isr_prof_data_pack_t; // Injector ISR profiling
+
 typedef struct __attribute__((packed)){
     float inst_fuel;        // [L/100 km]
     float avg_fuel;         // [L/100 km]
@@ -44,16 +87,56 @@ typedef struct __attribute__((packed)){
     float cons_fuel;        // [L]
     float fuel_last_6;      // [mL]
     float fuel_last_60;     // [mL]
+    float avg_10m;          // [L/100 km] Over the last 10 minutes, -1 if stationary
+    float avg_1h;           // [L/100 km] Over the last hour, -1 if stationary
 } fuel_data_pack_t; // Brief data, what the whole project is about
 
+typedef struct __attribute__((packed)){
+    uint16_t retries;       // [-] Lost frames sent again (since boot)
+    uint16_t recovered;     // [-] Of those, answered the second time
+    bool negotiated;        // Timing below set with service 0x83, false = ISO 14230 defaults
+    uint8_t p2_min;         // [ms] Earliest ECU answer
+    uint16_t p2_max;        // [ms] Latest ECU answer
+    uint8_t p3_min;         // [ms] Answer end to the next request
+    uint8_t p4_min;         // [ms] Between request bytes
+    uint8_t n;              // [-] Services / PIDs in use
+    OBD9141_lat_info_t lat[OBD9141_LAT_SLOTS]; // Only the first n are used
+} kwp_timing_data_pack_t; // KWP bus timing, learned answer latency and timeouts
+
+// Raw pulse stream (scope) binary frame, little-endian: header followed by hdr.count pulses
+#define SCOPE_FRAME_MAGIC 0x53 // 'S'
+
+typedef struct __attribute__((packed)){
+    uint8_t magic;          // SCOPE_FRAME_MAGIC
+    uint8_t n_channels;     // [-]
+    uint16_t count;         // [-] Pulses in this frame
+    uint32_t dropped;       // [-] Pulses the scope rings dropped (since streaming started)
+} scope_frame_hdr_t;
+
+typedef struct __attribute__((packed)){
+    uint32_t start_us;      // [us] esp_timer time of the falling edge (wraps every ~71 min)
+    uint16_t width_us;      // [us] Saturates at 65535
+    uint8_t ch;             // [-] Capture channel
+} scope_pulse_t;
+
 /* Send */
 
 void send_comms_data_pack(comms_data_pack_t data);
 
 void send_debug_fuel_data_pack(debug_fuel_data_pack_t data);
 
+void send_cyl_fuel_data_pack(cyl_fuel_data_pack_t data);
+
+void send_isr_prof_data_pack(isr_prof_data_pack_t data);
+
+void send_kwp_timing_data_pack(const kwp_timing_data_pack_t *data);
+
 void send_fuel_data_pack(fuel_data_pack_t data);
 
+void send_pw_stats_data(const pw_stats_t *stats);
+
+void send_scope_frame(const uint8_t *frame, size_t len);
+
 /* Receive */
 
 void set_open_page(cJSON *root);
@@ -68,4 +151,16 @@ void clear_fuel_data(void);
 
 void delete_fuel_data(void);
 
+void scope_subscribe(cJSON *root, int fd);
+
+void scope_unsubscribe(int fd);
+
+void profile_list(void);
+
+void profile_select(cJSON *root);
+
+void profile_save(cJSON *root);
+
+void trip_list(void);
+
 #endif
\ No newline at end of file
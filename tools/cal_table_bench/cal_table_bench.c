@@ -0,0 +1,147 @@
+// Calibration table benchmark: the cal_table engine (main/cal_table.c) against get_map() as it was before the
+// engine, a linear bin scan hard-wired to the 8x6 MAP table, plus the engine on a 32x32 table with uniform axes.
+// Every lookup is also checked: the engine must match the old scan on the MAP table to within its 1/1000 fraction
+// rounding, and reproduce the 32x32 table's plane exactly. Times are host ns/lookup, for comparing builds; the engine
+// must not be much slower than the old scan on the shipped table.
+//
+//   make && ./cal_table_bench [repeats]     (exit status 1 if a check fails)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "phys_const.h"
+#include "cal_table.h"
+
+#define MAX_SCAN_DIFF   5       // [Pa] Engine vs old scan on the MAP table, the scan's 1/1000 fractions truncate
+#define MAX_FINE_DIFF   1       // [-] Engine vs the 32x32 plane, rounding only
+#define MAX_SLOWDOWN    1.75    // [-] Engine vs old scan on the shipped MAP table (about 1.45 measured, the engine reads
+                                // its axes through pointers where the scan has them as constants), plus host noise
+#define TIMING_ROUNDS   7
+
+// get_map() before the table engine: linear bin scans, hard-wired to the 8x6 table, fractions in 1/1000
+static uint32_t get_map_scan(uint16_t load, uint16_t rpm) {
+    if (rpm <= rpm_bp[0]) rpm = rpm_bp[0];
+    if (rpm >= rpm_bp[N_RPM_BINS - 1]) rpm = rpm_bp[N_RPM_BINS - 1];
+    if (load >= 100) load = 100;
+
+    int ix = 0;
+    while (ix < N_LOAD_BINS - 2 && load > (ix + 1) * 20) ix++;
+    uint16_t fx = ((load - ix * 20) * 1000) / 20;
+
+    int iy = 0;
+    while (iy < N_RPM_BINS - 2 && rpm > rpm_bp[iy + 1]) iy++;
+    uint16_t dy = rpm_bp[iy + 1] - rpm_bp[iy];
+    uint16_t fy = ((rpm - rpm_bp[iy]) * 1000) / dy;
+
+    const int32_t *row1 = &map_data[iy * N_LOAD_BINS + ix];
+    const int32_t *row2 = row1 + N_LOAD_BINS;
+    uint32_t m1 = row1[0] + ((row1[1] - row1[0]) * fx) / 1000;
+    uint32_t m2 = row2[0] + ((row2[1] - row2[0]) * fx) / 1000;
+    return m1 + ((m2 - m1) * fy) / 1000;
+}
+
+static int32_t fine_data[32 * 32];
+static const cal_axis_t fine_rpm = {.bp = NULL, .n = 32, .min = 0, .step = 250, .step_inv = CAL_STEP_INV(250)};
+static const cal_axis_t fine_load = {.bp = NULL, .n = 32, .min = 0, .step = 3, .step_inv = CAL_STEP_INV(3)};
+static const cal_table_t fine = {"fine", 2, {&fine_rpm, &fine_load, NULL}, fine_data};
+
+// The 32x32 table holds a plane, so the exact bilinear value is the plane itself (inside the axes)
+static double fine_plane(double rpm, double load) {
+    rpm = rpm > 31 * 250 ? 31 * 250 : rpm;
+    load = load > 31 * 3 ? 31 * 3 : load;
+    return 30000 + 61 * (32 * rpm / 250 + load / 3);
+}
+
+// The three lookups behind the same call, so the timing loop is identical for all of them
+typedef int32_t (*lookup_fn_t)(uint16_t rpm, uint16_t load);
+
+static int32_t lookup_scan(uint16_t rpm, uint16_t load) {
+    return get_map_scan(load, rpm);
+}
+
+static int32_t lookup_map(uint16_t rpm, uint16_t load) {
+    return cal_table_2d(&map_table, rpm, load);
+}
+
+static int32_t lookup_fine(uint16_t rpm, uint16_t load) {
+    return cal_table_2d(&fine, rpm, load);
+}
+
+static double wall_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    uint32_t repeats = argc > 1 ? (uint32_t)atoi(argv[1]) : 100;
+    for (size_t i = 0; i < 32 * 32; i++) {
+        fine_data[i] = 30000 + (int32_t)(i * 61);
+    }
+    cal_table_validate(&map_table);
+    cal_table_validate(&fine);
+
+    /* Checks, every lookup of the sweep once */
+    bool ok = true;
+    uint32_t n = 0;
+    int32_t max_scan_diff = 0;  // [Pa]
+    double max_fine_diff = 0;
+    for (uint16_t rpm = 0; rpm <= 8000; rpm += 37) {
+        for (uint16_t load = 0; load <= 100; load += 3) {
+            int32_t a = get_map_scan(load, rpm);
+            int32_t b = cal_table_2d(&map_table, rpm, load);
+            int32_t diff = a > b ? a - b : b - a;
+            if (diff > max_scan_diff) {max_scan_diff = diff;}
+            double fine_diff = cal_table_2d(&fine, rpm, load) - fine_plane(rpm, load);
+            fine_diff = fine_diff < 0 ? -fine_diff : fine_diff;
+            if (fine_diff > max_fine_diff) {max_fine_diff = fine_diff;}
+            n++;
+        }
+    }
+    printf("%u lookups per pass: engine vs scan on the MAP table max %d Pa, engine vs the 32x32 plane max %.2f\n",
+           n, max_scan_diff, max_fine_diff);
+    if (max_scan_diff > MAX_SCAN_DIFF) {
+        printf("  FAIL: MAP table differs from the old scan by more than %d Pa\n", MAX_SCAN_DIFF);
+        ok = false;
+    }
+    if (max_fine_diff > MAX_FINE_DIFF) {
+        printf("  FAIL: 32x32 table off its plane by more than %d\n", MAX_FINE_DIFF);
+        ok = false;
+    }
+
+    /* Timing, the same sweep repeated; best of TIMING_ROUNDS so other load on the host doesn't count, the kernels
+       interleaved so they see the same conditions. The sums keep the lookups from being optimised away */
+    static const lookup_fn_t lookups[3] = {lookup_scan, lookup_map, lookup_fine};
+    double t_best[3] = {1e9, 1e9, 1e9};
+    volatile int64_t sink = 0;
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        for (int which = 0; which < 3; which++) {
+            volatile lookup_fn_t lookup = lookups[which]; // Called through the pointer, never inlined into the loop
+            int64_t sum = 0;
+            double t0 = wall_s();
+            for (uint32_t r = 0; r < repeats; r++) {
+                for (uint16_t rpm = 0; rpm <= 8000; rpm += 37) {
+                    for (uint16_t load = 0; load <= 100; load += 3) {
+                        sum += lookup(rpm, load);
+                    }
+                }
+            }
+            double t = (wall_s() - t0) * 1e9 / ((double)n * repeats);
+            sink += sum;
+            if (t < t_best[which]) {t_best[which] = t;}
+        }
+    }
+    (void)sink;
+    printf("%u passes, best of %d: scan %.1f, engine 8x6 %.1f, engine 32x32 uniform %.1f ns/lookup\n",
+           repeats, TIMING_ROUNDS, t_best[0], t_best[1], t_best[2]);
+    if (t_best[1] > t_best[0] * MAX_SLOWDOWN) {
+        printf("  FAIL: engine on the MAP table more than %.2fx the old scan\n", MAX_SLOWDOWN);
+        ok = false;
+    }
+
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
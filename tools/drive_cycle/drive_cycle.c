@@ -0,0 +1,386 @@
+// Drive-cycle synthesiser: runs the fuel pipeline from main/ on the host, faster than real time.
+// Idle, urban, motorway and WOT segments are turned into an injector pulse stream and the KWP values the ECU would
+// report every period; both go through the same code fuel_meter_task uses (map table lookup, fuel_kernel_init()
+// via the integrator's sample-and-hold inputs, the per-pulse kernel, the 600 ms periods, fuel_hist and the page's
+// rolling window). Each pulse is also integrated with the exact flow model in double, straight from phys_const.h,
+// and the totals are checked against it.
+//
+//   make && ./drive_cycle [repeats]     (exit status 1 if a check fails)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#include "phys_const.h"
+#include "cal_table.h"
+#include "engine_profile.h"
+#include "fuel_kernel.h"
+#include "fuel_integrator.h"
+#include "fuel_history.h"
+
+int64_t host_time_us = 0; // Virtual clock (esp_timer_get_time())
+
+#define PERIOD_US       600000                  // fuel_meter_task period (FUEL_PERIOD_MS)
+#define TICK_US         100000                  // fuel.html's rolling window rate (FUEL_PAGE_RATE_HZ)
+#define WINDOW_LEN      11                      // ... and its window, 1 s (FUEL_PAGE_WINDOW_MS)
+#define TICKS_PER_PERIOD (PERIOD_US / TICK_US)
+#define N_CHANNELS      1                       // One injector stands in for all cylinders (N_INJ_CHANNELS)
+
+#define IDLE_RPM        850
+#define PW_BASE_US      750                     // [us] Pulse width at 0 load (deadtime)
+#define PW_PER_LOAD_US  130                     // [us/%] ~13.8 ms at WOT, ~34 uL per injection
+#define TRICKLE_LOAD    4                       // [%] Light overrun below the fuel cut RPM: partial-ramp pulses
+#define FUEL_CUT_RPM    1400                    // Overrun above this: no injections at all
+
+/* Limits of the checks */
+#define MAX_FUEL_ERR    0.001                   // [-] Total fuel vs the exact model (LUT kernel, Q8 open time)
+#define MAX_WINDOW_ERR  0.01                    // [-] Rolling window consumption vs the exact model
+#define MAX_DIST_ERR    0.01                    // [-] Period distance vs the true (continuous) speed
+
+typedef enum {SEG_IDLE, SEG_URBAN, SEG_MOTORWAY, SEG_WOT, SEG_KINDS} seg_kind_t;
+
+static const char *seg_names[SEG_KINDS] = {"idle", "urban", "motorway", "WOT"};
+
+typedef struct segment_t {
+    seg_kind_t kind;
+    uint32_t duration_s;
+} segment_t;
+
+// One cycle, repeated: ~14 min
+static const segment_t cycle[] = {
+    {SEG_IDLE, 60},
+    {SEG_URBAN, 180},           // 4 x (pull away, 50 km/h, brake, stop)
+    {SEG_MOTORWAY, 300},        // 115 +- 8 km/h
+    {SEG_WOT, 150},             // 3 x (20 -> 140 km/h flat out, overrun back down)
+    {SEG_URBAN, 135},
+    {SEG_IDLE, 30},
+};
+#define CYCLE_SEGS (sizeof(cycle) / sizeof(cycle[0]))
+
+static const double kmh_per_krpm[] = {7.5, 13.5, 20, 27, 34}; // [km/h per 1000 RPM] Gears 1-5
+
+// What the car is doing at a given moment
+typedef struct car_state_t {
+    seg_kind_t kind;
+    double speed;               // [km/h]
+    double accel;               // [km/h/s]
+    double rpm;
+    double load;                // [%]
+    bool fuel_cut;
+} car_state_t;
+
+static uint32_t rng = 0x1234567;
+
+// xorshift32, [-1, 1)
+static double jitter(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return (double)rng / 2147483648.0 - 1;
+}
+
+static void car_state(int64_t t_us, car_state_t *car) {
+    static uint32_t cycle_s = 0;
+    if (cycle_s == 0) {
+        for (size_t i = 0; i < CYCLE_SEGS; i++) {
+            cycle_s += cycle[i].duration_s;
+        }
+    }
+    double t = fmod(t_us * 1e-6, cycle_s);
+    const segment_t *seg = &cycle[0];
+    for (size_t i = 0; i < CYCLE_SEGS && t >= cycle[i].duration_s; i++) {
+        t -= cycle[i].duration_s;
+        seg = &cycle[i + 1];
+    }
+
+    car->kind = seg->kind;
+    car->speed = 0;
+    car->accel = 0;
+    double shift_rpm = 2600;
+    switch (seg->kind) {
+    case SEG_IDLE:
+        break;
+    case SEG_URBAN: {
+        double u = fmod(t, 45);
+        if (u < 10) {                   // Pull away at 5 km/h/s
+            car->speed = 5 * u;
+            car->accel = 5;
+        } else if (u < 25) {            // Cruise
+            car->speed = 50;
+        } else if (u < 33) {            // Brake at 6.25 km/h/s
+            car->speed = 50 - 6.25 * (u - 25);
+            car->accel = -6.25;
+        }                               // Stopped
+        break;
+    }
+    case SEG_MOTORWAY:
+        car->speed = 115 + 8 * sin(2 * M_PI * t / 90);
+        car->accel = 8 * 2 * M_PI / 90 * cos(2 * M_PI * t / 90);
+        break;
+    case SEG_WOT: {
+        double u = fmod(t, 50);
+        shift_rpm = 6000;
+        if (u < 20) {                   // Flat out, 20 -> 140 km/h
+            car->speed = 20 + 6 * u;
+            car->accel = 6;
+        } else {                        // Overrun back down to 20 km/h
+            car->speed = 140 - 4 * (u - 20);
+            car->accel = -4;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    // Lowest gear that stays under the shift point; clutch in below walking pace
+    car->rpm = IDLE_RPM;
+    if (car->speed >= 8) {
+        for (size_t g = 0; g < sizeof(kmh_per_krpm) / sizeof(kmh_per_krpm[0]); g++) {
+            car->rpm = car->speed / kmh_per_krpm[g] * 1000;
+            if (car->rpm <= shift_rpm) {
+                break;
+            }
+        }
+        if (car->rpm < IDLE_RPM) {
+            car->rpm = IDLE_RPM;
+        }
+    }
+
+    car->fuel_cut = false;
+    if (seg->kind == SEG_WOT && car->accel > 0) {
+        car->load = 100;
+    } else if (car->accel < -1) {
+        car->load = TRICKLE_LOAD;
+        car->fuel_cut = car->rpm > FUEL_CUT_RPM;
+    } else {
+        car->load = 18 + 0.25 * car->speed + 6 * car->accel;
+    }
+    if (car->load > 100) {
+        car->load = 100;
+    }
+}
+
+// [uL] Exact flow model for all cylinders, independent of fuel_model_t: trapezoid with partial ramps
+static double exact_fuel(uint32_t width_us, uint32_t baro, uint32_t map) {
+    const double ramp_up = INJECTOR_RAMP_UP_TIME, ramps = INJECTOR_RAMP_UP_TIME + INJECTOR_RAMP_DOWN_TIME;
+    double r = (double)width_us - INJECTOR_DEADTIME;
+    double eff_us = r <= 0 ? 0 : (r >= ramp_up ? r - ramp_up + ramps / 2 : (r / ramp_up) * (r / ramp_up) * ramps / 2);
+    double coeff = STATIC_FLOW_RATE * sqrt((FUEL_RAIL_PRESSURE + (double)baro - map) / STATIC_FLOW_PRESSURE) *
+                   baro / P_BAROMETRIC_BASELINE; // [uL/ms]
+    return N_CYL * coeff * eff_us * 0.001;
+}
+
+static double wall_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    uint32_t repeats = argc > 1 ? (uint32_t)atoi(argv[1]) : 20;
+    uint32_t cycle_s = 0;
+    for (size_t i = 0; i < CYCLE_SEGS; i++) {
+        cycle_s += cycle[i].duration_s;
+    }
+    const int64_t end_us = (int64_t)cycle_s * repeats * 1000000;
+
+    engine_profile_t profile;
+    static fuel_model_t model;
+    engine_profile_default(&profile);
+    fuel_model_init(&model, &profile);
+    fuel_integrator_init(N_CHANNELS, &model);
+    const uint8_t cyl_per_channel = model.n_cyl / N_CHANNELS;
+    static fuel_hist_t hist;
+    fuel_hist_init(&hist, 0);
+    fuel_window_t window;
+    fuel_window_init(&window, WINDOW_LEN);
+
+    // Inputs as the integrator holds them, for the exact model
+    uint32_t held_map = MAP_DEFAULT, held_baro = P_BAROMETRIC_BASELINE, held_max_width = UINT32_MAX;
+    uint8_t held_speed = 0;
+    int64_t held_speed_us = 0;
+
+    // Exact totals
+    double exact_ul = 0;            // [uL]
+    double held_dist_mm = 0;        // [mm] Held KWP speed over time, what the integrator measures distance with
+    double true_dist_mm = 0;        // [mm] The car's actual speed
+    double kind_ul[SEG_KINDS] = {0}, kind_mm[SEG_KINDS] = {0}, kind_s[SEG_KINDS] = {0};
+    struct {double ul, mm;} exact_win[WINDOW_LEN];
+    uint32_t win_idx = 0, win_count = 0;
+
+    // Pipeline totals
+    uint64_t period_nl = 0;         // [nL] What the 600 ms periods handed out
+    uint64_t period_mm = 0;         // [mm] Trapezoidal distance, as fuel_meter_task
+    uint64_t dist_rem = 0;
+    uint8_t last_speed = 0;
+    int64_t last_speed_us = 0;
+    uint32_t pulses = 0, invalid = 0, periods = 0, ticks = 0;
+    double max_win_err = 0;
+
+    double t0 = wall_s();
+    int64_t next_tick = TICK_US;
+    int64_t next_start = 0;         // [us] Next injection starts here
+    car_state_t car;
+    while (1) {
+        car_state(next_start, &car);
+        uint32_t cycle_us = (uint32_t)(120e6 / car.rpm);
+        uint32_t width = 0;
+        if (!car.fuel_cut) {
+            width = (uint32_t)((PW_BASE_US + PW_PER_LOAD_US * car.load) * (1 + 0.02 * jitter()));
+            uint32_t max_width = cycle_us - model.reset_time; // The ECU never overlaps injections
+            if (held_max_width < max_width) {
+                max_width = held_max_width; // Nor may the pipeline see one it has to throw away
+            }
+            if (width >= max_width) {
+                width = max_width - 1;
+            }
+        }
+        int64_t pulse_end = next_start + width;
+
+        // Ticks due before this pulse ends: page samples and, every TICKS_PER_PERIOD, a fuel_meter_task period
+        while (next_tick <= pulse_end && next_tick <= end_us) {
+            host_time_us = next_tick;
+            car_state_t now;
+            car_state(next_tick, &now);
+            true_dist_mm += now.speed * TICK_US / 3600.0;
+            kind_mm[now.kind] += now.speed * TICK_US / 3600.0;
+            kind_s[now.kind] += TICK_US * 1e-6;
+            ticks++;
+
+            if (ticks % TICKS_PER_PERIOD == 0) {
+                // KWP values, MAP from the calibration table, the integrator's inputs (update_fuel_inputs())
+                uint8_t speed = (uint8_t)(now.speed + 0.5);
+                uint16_t rpm = (uint16_t)(now.rpm + 0.5);
+                uint8_t load = (uint8_t)(now.fuel_cut ? 0 : now.load + 0.5);
+                uint32_t map = (uint32_t)cal_table_2d(&map_table, rpm, load);
+                uint32_t baro = (uint32_t)(P_BAROMETRIC_BASELINE + 400 * sin(2 * M_PI * next_tick * 1e-6 / 600));
+                fuel_integrator_set_baro(baro);
+                fuel_integrator_set_map(map);
+                fuel_integrator_set_speed(speed);
+                uint32_t us_per_cycle = rpm < 300 ? 400 * 1000 : 120000 * 1000 / rpm;
+                fuel_integrator_set_max_width(us_per_cycle - model.reset_time);
+                held_dist_mm += held_speed * (double)(next_tick - held_speed_us) / 3600;
+                held_map = map;
+                held_baro = baro;
+                held_speed = speed;
+                held_speed_us = next_tick;
+                held_max_width = us_per_cycle - model.reset_time;
+
+                fuel_period_t period;
+                fuel_integrator_take_period(&period);
+                uint32_t period_fuel = 0;
+                for (size_t c = 0; c < N_CHANNELS; c++) {
+                    period_fuel += (period.fuel_nl[c] + period.recon_nl[c]) * cyl_per_channel;
+                }
+                uint32_t dist_tr_mm = 0;
+                if (last_speed_us) {
+                    uint64_t dist_kmh_us = (uint64_t)(last_speed + speed) * (uint64_t)(next_tick - last_speed_us) + dist_rem;
+                    dist_tr_mm = dist_kmh_us / 7200;
+                    dist_rem = dist_kmh_us % 7200;
+                }
+                last_speed = speed;
+                last_speed_us = next_tick;
+                period_nl += period_fuel;
+                period_mm += dist_tr_mm;
+                fuel_hist_add(&hist, next_tick, period_fuel, dist_tr_mm);
+                periods++;
+            }
+
+            // Rolling window, against the exact fuel over the same samples
+            fuel_sample_t sample;
+            fuel_integrator_sample(&sample);
+            float cons = fuel_window_update(&window, &sample);
+            double dist_now = held_dist_mm + held_speed * (double)(next_tick - held_speed_us) / 3600;
+            exact_win[win_idx].ul = exact_ul;
+            exact_win[win_idx].mm = dist_now;
+            win_idx = (win_idx + 1) % WINDOW_LEN;
+            if (win_count < WINDOW_LEN) {
+                win_count++;
+            }
+            uint32_t oldest = win_count == WINDOW_LEN ? win_idx : 0;
+            double win_mm = dist_now - exact_win[oldest].mm;
+            if (cons >= 0 && win_mm >= 100) {
+                double exact_cons = (exact_ul - exact_win[oldest].ul) / win_mm * 100; // 1 [uL/mm] = 1 [L/km] = 100 [L/100 km]
+                double err = fabs(cons - exact_cons) / exact_cons;
+                if (err > max_win_err) {
+                    max_win_err = err;
+                }
+            }
+            next_tick += TICK_US;
+        }
+        if (pulse_end > end_us) {
+            break;
+        }
+
+        if (width) {
+            host_time_us = pulse_end; // fuel_integrator_task sees the pulse once it has ended
+            if (fuel_integrator_pulse(0, width)) {
+                double ul = exact_fuel(width, held_baro, held_map);
+                exact_ul += ul;
+                kind_ul[car.kind] += ul;
+            } else {
+                invalid++;
+            }
+            pulses++;
+        }
+        next_start += cycle_us;
+    }
+    double elapsed = wall_s() - t0;
+
+    fuel_sample_t sample;
+    fuel_integrator_sample(&sample);
+    fuel_hist_span_t span;
+    fuel_hist_last(&hist, (uint32_t)(end_us / 1000000) + 1, &span);
+
+    printf("Drive cycle: %lu s x %lu = %.1f h simulated\n", (unsigned long)cycle_s, (unsigned long)repeats, end_us / 3.6e9);
+    printf("  %-9s %9s %9s %9s %11s\n", "segment", "time [s]", "dist [km]", "fuel [L]", "[L/100 km]");
+    for (size_t k = 0; k < SEG_KINDS; k++) {
+        printf("  %-9s %9.0f %9.2f %9.3f %11.2f\n", seg_names[k], kind_s[k], kind_mm[k] * 1e-6, kind_ul[k] * 1e-6,
+               kind_mm[k] > 0 ? kind_ul[k] / kind_mm[k] * 100 : 0.0);
+    }
+    printf("Throughput: %.3f s wall, %.0f pulses/s, %.0f periods/s, %.0fx real time\n",
+           elapsed, pulses / elapsed, periods / elapsed, end_us * 1e-6 / elapsed);
+    printf("  %lu pulses (%lu invalid), %lu periods, %lu window samples\n",
+           (unsigned long)pulses, (unsigned long)invalid, (unsigned long)periods, (unsigned long)ticks);
+
+    bool ok = true;
+    double exact_nl = exact_ul * 1000;
+    double fuel_err = fabs(sample.fuel_pl * 1e-3 - exact_nl) / exact_nl;
+    printf("Fuel:     integrator %.6f L, exact %.6f L, error %.5f%%\n", sample.fuel_pl * 1e-12, exact_ul * 1e-6, fuel_err * 100);
+    if (fuel_err > MAX_FUEL_ERR) {
+        printf("  FAIL: more than %.3f%% off the exact model\n", MAX_FUEL_ERR * 100);
+        ok = false;
+    }
+    // Periods hand out whole nL, the remainder (< 1 nL per channel) is still in the integrator
+    int64_t carried = (int64_t)(sample.fuel_pl / 1000) - (int64_t)period_nl;
+    printf("          periods %llu nL, %lld nL carried over\n", (unsigned long long)period_nl, (long long)carried);
+    if (carried < 0 || carried > N_CHANNELS * cyl_per_channel) {
+        printf("  FAIL: periods don't add up to the integrator's total\n");
+        ok = false;
+    }
+    printf("          history %llu nL over %.1f h\n", (unsigned long long)span.fuel_nl, span.span_ms / 3.6e6);
+    if (span.span_ms >= end_us / 1000 && (span.fuel_nl != period_nl || span.dist_mm != period_mm)) { // Reaches back to the start
+        printf("  FAIL: history totals don't match the periods'\n");
+        ok = false;
+    }
+    printf("Window:   max error %.4f%% (1 s window at 10 Hz)\n", max_win_err * 100);
+    if (max_win_err > MAX_WINDOW_ERR) {
+        printf("  FAIL: more than %.2f%% off the exact model\n", MAX_WINDOW_ERR * 100);
+        ok = false;
+    }
+    double held_err = fabs(sample.dist_um * 1e-3 - (held_dist_mm + held_speed * (double)(end_us - held_speed_us) / 3600));
+    double dist_err = fabs((double)period_mm - true_dist_mm) / true_dist_mm;
+    printf("Distance: periods %.3f km, true %.3f km, error %.3f%%; integrator off its held speed by %.1f mm\n",
+           period_mm * 1e-6, true_dist_mm * 1e-6, dist_err * 100, held_err);
+    if (dist_err > MAX_DIST_ERR || held_err > 1) {
+        printf("  FAIL: distance\n");
+        ok = false;
+    }
+    printf("Avg: %.2f L/100 km\n", span.cons);
+    printf(ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
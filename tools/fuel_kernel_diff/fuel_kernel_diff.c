@@ -0,0 +1,117 @@
+// Fuel kernel differential test: the fixed-point per-pulse kernel (fuel_pulse_q16()) against the double reference
+// (fuel_pulse_double()), both from main/fuel_kernel.c, for every microsecond of pulse width from 0 to 400 ms over the
+// whole ambient/MAP pressure range, for the built-in profile and profiles at the edges engine_profile_validate()
+// allows. Fails if any pulse is off by more than FUEL_FIXED_MAX_ERR_UL, or FUEL_FIXED_MAX_ERR_REL above
+// FUEL_FIXED_REL_MIN_UL (fuel_kernel.h).
+//
+//   make && ./fuel_kernel_diff [width step, us]     (exit status 1 if a check fails)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "engine_profile.h"
+#include "fuel_kernel.h"
+
+#define MAX_WIDTH_US    400000                  // [us] Longest pulse swept
+#define BARO_MIN        50000                   // [Pa] Ambient pressure range (~5500 m to a deep low)
+#define BARO_MAX        110000
+#define MAP_MIN         10000                   // [Pa] MAP range (overrun vacuum to above ambient)
+#define MAP_MAX         110000
+#define PRESSURE_STEP   5000                    // [Pa]
+
+typedef struct profile_case_t {
+    const char *name;
+    void (*edit)(engine_profile_t *profile);
+} profile_case_t;
+
+static void edit_none(engine_profile_t *profile) {}
+
+static void edit_big_fast(engine_profile_t *profile) {
+    profile->static_flow_ml_min = 2000;                 // Largest injector allowed
+    profile->rail_pressure = 1000000;                   // Highest rail pressure allowed
+    profile->static_flow_pressure = 100000;             // Tested at the lowest pressure: largest delta-P factor
+    profile->deadtime = 200;
+    profile->full_opening_time = 200 + FUEL_LUT_MAX_RAMP_US; // Longest ramp-up allowed
+    profile->full_closing_time = 5000;
+}
+
+static void edit_small_slow(engine_profile_t *profile) {
+    profile->static_flow_ml_min = 10;                   // Smallest injector allowed
+    profile->rail_pressure = 100000;                    // Lowest rail pressure allowed
+    profile->static_flow_pressure = 1000000;
+    profile->deadtime = 2000;
+    profile->full_opening_time = 2001;                  // Shortest ramp-up
+    profile->full_closing_time = 0;
+}
+
+static const profile_case_t profiles[] = {
+    {"built-in", edit_none},
+    {"2000 mL/min, 10 bar, long ramp", edit_big_fast},
+    {"10 mL/min, 1 bar, 1 us ramp", edit_small_slow},
+};
+
+int main(int argc, char **argv) {
+    uint32_t step = argc > 1 ? (uint32_t)atoi(argv[1]) : 1;
+    bool ok = true;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint64_t n_total = 0;
+
+    printf("Pulse widths 0-%d ms every %lu us, ambient %d-%d kPa, MAP %d-%d kPa every %d kPa\n",
+           MAX_WIDTH_US / 1000, (unsigned long)step, BARO_MIN / 1000, BARO_MAX / 1000, MAP_MIN / 1000, MAP_MAX / 1000,
+           PRESSURE_STEP / 1000);
+    printf("  %-32s %14s %14s\n", "profile", "max err [uL]", "max err [%]");
+    for (size_t p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+        engine_profile_t profile;
+        engine_profile_default(&profile);
+        profiles[p].edit(&profile);
+        char msg[64];
+        if (!engine_profile_validate(&profile, msg, sizeof(msg))) {
+            printf("  %-32s FAIL: invalid profile, %s\n", profiles[p].name, msg);
+            ok = false;
+            continue;
+        }
+        static fuel_model_t model;
+        fuel_model_init(&model, &profile);
+
+        double max_abs = 0, max_rel = 0;
+        uint32_t worst_w = 0, worst_baro = 0, worst_map = 0;
+        for (uint32_t baro = BARO_MIN; baro <= BARO_MAX; baro += PRESSURE_STEP) {
+            for (uint32_t map = MAP_MIN; map <= MAP_MAX; map += PRESSURE_STEP) {
+                fuel_kernel_t kernel;
+                fuel_kernel_init(&kernel, &model, baro, map);
+                for (uint32_t w = 0; w <= MAX_WIDTH_US; w += step) {
+                    double ref = fuel_pulse_double(&kernel, w);
+                    double err = fabs(ref - (double)fuel_pulse_q16(&kernel, w) / FUEL_Q16_ONE);
+                    if (err > max_abs) {
+                        max_abs = err;
+                        worst_w = w;
+                        worst_baro = baro;
+                        worst_map = map;
+                    }
+                    if (ref > FUEL_FIXED_REL_MIN_UL && err / ref > max_rel) {
+                        max_rel = err / ref;
+                    }
+                    n_total++;
+                }
+            }
+        }
+        printf("  %-32s %14.6f %14.5f\n", profiles[p].name, max_abs, max_rel * 100);
+        if (max_abs > FUEL_FIXED_MAX_ERR_UL || max_rel > FUEL_FIXED_MAX_ERR_REL) {
+            printf("    FAIL: fixed point off by more than %.3f uL / %.2f%% (worst at %lu us, ambient %lu Pa, MAP %lu Pa)\n",
+                   FUEL_FIXED_MAX_ERR_UL, FUEL_FIXED_MAX_ERR_REL * 100, (unsigned long)worst_w,
+                   (unsigned long)worst_baro, (unsigned long)worst_map);
+            ok = false;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("%llu pulses compared in %.1f s\n", (unsigned long long)n_total, s);
+    printf(ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
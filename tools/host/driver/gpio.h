@@ -0,0 +1,17 @@
+#ifndef __GPIO_H
+#define __GPIO_H
+
+#include "esp_err.h"
+
+// Host build: pins go nowhere
+typedef int gpio_num_t;
+#define GPIO_NUM_16 16
+#define GPIO_NUM_17 17
+#define GPIO_MODE_INPUT  1
+#define GPIO_MODE_OUTPUT 2
+
+static inline esp_err_t gpio_set_direction(int pin, int mode) {(void)pin; (void)mode; return ESP_OK;}
+static inline esp_err_t gpio_set_level(int pin, int level) {(void)pin; (void)level; return ESP_OK;}
+static inline esp_err_t gpio_reset_pin(int pin) {(void)pin; return ESP_OK;}
+
+#endif
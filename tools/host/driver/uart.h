@@ -0,0 +1,37 @@
+#ifndef __UART_H
+#define __UART_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Host build: the tool provides the bus (uart_write_bytes()/uart_read_bytes()) on its virtual clock
+typedef int uart_port_t;
+#define UART_NUM_2 2
+#define UART_PIN_NO_CHANGE (-1)
+#define UART_DATA_8_BITS 3
+#define UART_PARITY_DISABLE 0
+#define UART_STOP_BITS_1 1
+#define UART_HW_FLOWCTRL_DISABLE 0
+
+typedef struct uart_config_t {
+    int baud_rate;
+    int data_bits;
+    int parity;
+    int stop_bits;
+    int flow_ctrl;
+    int rx_flow_ctrl_thresh;
+} uart_config_t;
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config);
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts);
+esp_err_t uart_driver_install(uart_port_t port, int rx_size, int tx_size, int queue_size, QueueHandle_t *queue, int flags);
+esp_err_t uart_driver_delete(uart_port_t port);
+bool uart_is_driver_installed(uart_port_t port);
+int uart_write_bytes(uart_port_t port, const void *src, size_t size);
+int uart_read_bytes(uart_port_t port, void *buf, uint32_t length, TickType_t ticks_to_wait);
+esp_err_t uart_flush_input(uart_port_t port);
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef __ESP_ATTR_H
+#define __ESP_ATTR_H
+
+// Host build: no IRAM, code placement attributes do nothing
+#define IRAM_ATTR
+
+#endif
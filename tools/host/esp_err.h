@@ -0,0 +1,8 @@
+#ifndef __ESP_ERR_H
+#define __ESP_ERR_H
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_ERROR_CHECK(x) ((void)(x))
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef __ESP_TIMER_H
+#define __ESP_TIMER_H
+
+#include <stdint.h>
+
+// Host build: virtual clock, advanced by the drive cycle instead of the hardware timer
+extern int64_t host_time_us;
+
+static inline int64_t esp_timer_get_time(void) {
+    return host_time_us;
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef __FREERTOS_H
+#define __FREERTOS_H
+
+#include <stdint.h>
+
+// Host build: single-threaded, critical sections are no-ops; 1 tick = 1 ms (CONFIG_FREERTOS_HZ=1000)
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+
+typedef uint32_t TickType_t;
+typedef void *QueueHandle_t;
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif
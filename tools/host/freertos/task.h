@@ -0,0 +1,14 @@
+#ifndef __TASK_H
+#define __TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+#define taskENTER_CRITICAL(mux) ((void)(mux))
+#define taskEXIT_CRITICAL(mux)  ((void)(mux))
+
+// Provided by the tool, on its virtual clock
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+void vTaskDelayUntil(TickType_t *prev_wake, TickType_t increment);
+
+#endif
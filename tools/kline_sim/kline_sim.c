@@ -0,0 +1,401 @@
+// K-line / ECU simulator: runs main/obd9141.c on the host against a simulated KWP2000 ECU on a virtual clock, and
+// benchmarks reading get_car_data()'s PIDs one request per PID against OBD9141_get_current_pids() batches.
+// The bus is 10400 baud with the transceiver echo; the ECU answers P2 (with some jitter) after a request with P1
+// between its bytes. One ECU drops answers, to show lost frames being detected and sent again. Batches are also
+// timed after OBD9141_access_timing(): the ECUs that take service 0x83 can answer after ECU_PROC_US instead of P2min.
+//
+//   make && ./kline_sim [cycles]     (exit status 1 if a check fails)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "obd9141.h"
+
+int64_t host_time_us = 0; // Virtual clock
+
+#define BYTE_US         962                     // [us] 10 bits at 10400 baud
+#define ECU_P1_US       1000                    // [us] ECU inter-byte time
+#define ECU_P2_US       25000                   // [us] Request end to answer (ISO 14230 P2 min)
+#define ECU_P2_JITTER_US 4000                   // [us] Added to ECU_P2_US, uniform
+#define ECU_PROC_US     8000                    // [us] Shortest time the ECU needs to answer, whatever P2min is
+#define ECU_FRAME_GAP_US 20000                  // [us] A longer pause starts a new request (P1/P4 max)
+#define RX_QUEUE_SIZE   256
+
+/* Simulated ECU */
+
+typedef enum {ECU_MULTI, ECU_REJECT, ECU_IGNORE} ecu_multi_t;
+
+typedef struct ecu_t {
+    const char *name;
+    ecu_multi_t multi;          // What it does with multi-PID requests
+    uint8_t unsupported;        // PID it doesn't answer at all (0 = none)
+    uint8_t drop_every;         // Every n-th mode 0x01 answer is lost (0 = none)
+    bool timing;                // Takes AccessTimingParameters (service 0x83)
+} ecu_t;
+
+static const ecu_t ecus[] = {
+    {"multi-PID", ECU_MULTI, 0, 0, true},
+    {"multi-PID, no MAF", ECU_MULTI, 0x10, 0, true},
+    {"rejects multi-PID (7F)", ECU_REJECT, 0, 0, true},
+    {"ignores multi-PID", ECU_IGNORE, 0, 0, true},
+    {"multi-PID, drops 1 in 10", ECU_MULTI, 0, 10, true},
+    {"multi-PID, no 0x83 (7F)", ECU_MULTI, 0, 0, false},
+};
+
+// Timing limits it reports: P2min, P2max, P3min, P3max, P4min (0.5, 25, 0.5, 250, 0.5 ms steps)
+static const uint8_t ecu_timing_limits[5] = {0x00, 0x14, 0x00, 0xFF, 0x00};
+
+typedef struct pid_val_t {
+    uint8_t pid;
+    uint8_t len;
+    uint8_t data[2];
+} pid_val_t;
+
+// get_car_data()'s PIDs in its order, with the values the ECU reports
+static const pid_val_t pid_vals[] = {
+    {0x04, 1, {0x80}},          // Load
+    {0x0D, 1, {0x32}},          // Vehicle Speed
+    {0x0C, 2, {0x0C, 0x4C}},    // RPM
+    {0x11, 1, {0x40}},          // Throttle
+    {0x10, 2, {0x01, 0x90}},    // Mass Air Flow
+    {0x05, 1, {0x5A}},          // Engine Coolant Temperature
+    {0x0F, 1, {0x3C}},          // Intake Air Temperature
+};
+#define N_PIDS (sizeof(pid_vals) / sizeof(pid_vals[0]))
+
+static const ecu_t *ecu;
+static uint8_t ecu_frame[OBD9141_BUFFER_SIZE];
+static uint8_t ecu_frame_len = 0;
+static int64_t ecu_last_rx_us = 0;
+static uint32_t ecu_requests = 0;       // Requests received
+static uint32_t ecu_answers = 0;        // Mode 0x01 answers (sent or dropped)
+static uint32_t ecu_dropped = 0;        // Of those, lost
+static uint32_t ecu_rand = 1;           // LCG state for the P2 jitter
+static int64_t ecu_p2_min_us = ECU_P2_US; // [us] P2min in use
+
+// Tester side of the bus: echo and answer bytes, in arrival order
+static struct {uint8_t b; int64_t t_us;} rx_queue[RX_QUEUE_SIZE];
+static uint32_t rx_head = 0, rx_tail = 0;
+static int64_t tx_free_us = 0;          // [us] Line is busy sending until then
+static bool uart_installed = false;
+
+static void rx_push(uint8_t b, int64_t t_us) {
+    uint32_t i = rx_tail++ % RX_QUEUE_SIZE;
+    rx_queue[i].b = b;
+    rx_queue[i].t_us = t_us;
+}
+
+static const pid_val_t *find_pid(uint8_t pid) {
+    for (size_t i = 0; i < N_PIDS; i++) {
+        if (pid_vals[i].pid == pid && pid != ecu->unsupported) {
+            return &pid_vals[i];
+        }
+    }
+    return NULL;
+}
+
+static void ecu_answer(const uint8_t *payload, uint8_t len, int64_t req_end_us) {
+    uint8_t frame[OBD9141_BUFFER_SIZE];
+    frame[0] = 0x80 | len;
+    frame[1] = 0xF1;
+    frame[2] = 0x11;
+    memcpy(&frame[3], payload, len);
+    frame[3 + len] = OBD9141_checksum(frame, 3 + len);
+    ecu_rand = ecu_rand * 1103515245u + 12345u;
+    int64_t t = req_end_us + (ecu_p2_min_us > ECU_PROC_US ? ecu_p2_min_us : ECU_PROC_US) + (ecu_rand >> 16) % (ECU_P2_JITTER_US + 1);
+    for (uint8_t i = 0; i < 4 + len; i++) {
+        t += BYTE_US;
+        rx_push(frame[i], t);
+        t += ECU_P1_US;
+    }
+    tx_free_us = t;
+}
+
+static void ecu_request(const uint8_t *frame, uint8_t len, int64_t end_us) {
+    ecu_requests++;
+    if (OBD9141_checksum((void *)frame, len - 1) != frame[len - 1]) {
+        return;
+    }
+    const uint8_t *req = &frame[3];
+    uint8_t req_len = len - 4;
+    uint8_t payload[64];
+    uint8_t n = 0;
+    if (req[0] == 0x81) { // startCommunication
+        static const uint8_t start[] = {0xC1, 0xEF, 0x8F};
+        ecu_p2_min_us = ECU_P2_US; // back to the default timing
+        ecu_answer(start, sizeof(start), end_us);
+    } else if (req[0] == 0x83 && req_len >= 2) { // accessTimingParameters
+        if (!ecu->timing) {
+            static const uint8_t neg[] = {0x7F, 0x83, 0x11}; // serviceNotSupported
+            ecu_answer(neg, sizeof(neg), end_us);
+        } else if (req[1] == 0x00) {
+            payload[n++] = 0xC3;
+            payload[n++] = 0x00;
+            memcpy(&payload[n], ecu_timing_limits, sizeof(ecu_timing_limits));
+            n += sizeof(ecu_timing_limits);
+            ecu_answer(payload, n, end_us);
+        } else if (req[1] == 0x03 && req_len == 7 && req[2] >= ecu_timing_limits[0] && req[6] >= ecu_timing_limits[4]) {
+            static const uint8_t pos[] = {0xC3, 0x03};
+            ecu_answer(pos, sizeof(pos), end_us); // still with the old timing
+            ecu_p2_min_us = req[2] * 500;
+        } else {
+            static const uint8_t neg[] = {0x7F, 0x83, 0x31}; // requestOutOfRange
+            ecu_answer(neg, sizeof(neg), end_us);
+        }
+    } else if (req[0] == 0x01 && req_len >= 2) {
+        if (req_len > 2 && ecu->multi != ECU_MULTI) {
+            if (ecu->multi == ECU_REJECT) {
+                static const uint8_t neg[] = {0x7F, 0x01, 0x12}; // subFunctionNotSupported-invalidFormat
+                ecu_answer(neg, sizeof(neg), end_us);
+            }
+            return;
+        }
+        payload[n++] = 0x41;
+        for (uint8_t i = 1; i < req_len; i++) {
+            const pid_val_t *v = find_pid(req[i]);
+            if (v) {
+                payload[n++] = v->pid;
+                memcpy(&payload[n], v->data, v->len);
+                n += v->len;
+            }
+        }
+        if (n > 1) {
+            if (ecu->drop_every && ++ecu_answers % ecu->drop_every == 0) {
+                ecu_dropped++;
+                return;
+            }
+            ecu_answer(payload, n, end_us);
+        } // Nothing it supports: no answer
+    }
+}
+
+static void ecu_receive(uint8_t b, int64_t t_us) {
+    if (ecu_frame_len && t_us - ecu_last_rx_us > ECU_FRAME_GAP_US) {
+        ecu_frame_len = 0;
+    }
+    ecu_last_rx_us = t_us;
+    if (ecu_frame_len < sizeof(ecu_frame)) {
+        ecu_frame[ecu_frame_len++] = b;
+    }
+    if (ecu_frame_len == 4 + (ecu_frame[0] & 0x3F)) {
+        ecu_request(ecu_frame, ecu_frame_len, t_us);
+        ecu_frame_len = 0;
+    }
+}
+
+/* Host shims on the virtual clock */
+
+void vTaskDelay(TickType_t ticks) {
+    host_time_us += (int64_t)ticks * 1000;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(host_time_us / 1000);
+}
+
+void vTaskDelayUntil(TickType_t *prev_wake, TickType_t increment) {
+    *prev_wake += increment;
+    if (host_time_us < (int64_t)*prev_wake * 1000) {
+        host_time_us = (int64_t)*prev_wake * 1000;
+    }
+}
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config) {return ESP_OK;}
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts) {return ESP_OK;}
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_size, int tx_size, int queue_size, QueueHandle_t *queue, int flags) {
+    uart_installed = true;
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_delete(uart_port_t port) {
+    uart_installed = false;
+    return ESP_OK;
+}
+
+bool uart_is_driver_installed(uart_port_t port) {
+    return uart_installed;
+}
+
+int uart_write_bytes(uart_port_t port, const void *src, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        int64_t end = (host_time_us > tx_free_us ? host_time_us : tx_free_us) + BYTE_US;
+        tx_free_us = end;
+        uint8_t b = ((const uint8_t *)src)[i];
+        rx_push(b, end); // Echo
+        ecu_receive(b, end);
+    }
+    return (int)size;
+}
+
+int uart_read_bytes(uart_port_t port, void *buf, uint32_t length, TickType_t ticks_to_wait) {
+    int64_t deadline = host_time_us + (int64_t)ticks_to_wait * 1000;
+    uint32_t n = 0;
+    int64_t last = host_time_us;
+    while (n < length && rx_head != rx_tail && rx_queue[rx_head % RX_QUEUE_SIZE].t_us <= deadline) {
+        ((uint8_t *)buf)[n++] = rx_queue[rx_head % RX_QUEUE_SIZE].b;
+        if (rx_queue[rx_head % RX_QUEUE_SIZE].t_us > last) {
+            last = rx_queue[rx_head % RX_QUEUE_SIZE].t_us;
+        }
+        rx_head++;
+    }
+    host_time_us = n == length ? last : deadline;
+    return (int)n;
+}
+
+esp_err_t uart_flush_input(uart_port_t port) {
+    while (rx_head != rx_tail && rx_queue[rx_head % RX_QUEUE_SIZE].t_us <= host_time_us) {
+        rx_head++;
+    }
+    return ESP_OK;
+}
+
+/* Benchmark */
+
+typedef struct bench_t {
+    double ms;                  // [ms] Bus time per cycle
+    double requests;            // Requests per cycle
+    double answered;            // PIDs answered per cycle
+    double dropped;             // Answers the ECU lost per cycle
+    bool values_ok;             // Every answer decoded to what the ECU sent
+    bool negotiated;            // OBD9141_access_timing() succeeded
+} bench_t;
+
+static bool check_value(uint8_t pid, const uint8_t *data) {
+    const pid_val_t *v = find_pid(pid);
+    return v && memcmp(v->data, data, v->len) == 0;
+}
+
+// Previous get_car_data(): one request per PID
+static uint32_t cycle_single(bool *values_ok) {
+    uint32_t answered = 0;
+    for (size_t i = 0; i < N_PIDS; i++) {
+        if (OBD9141_get_current_pid(pid_vals[i].pid, pid_vals[i].len)) {
+            answered++;
+            uint8_t data[2] = {OBD9141_read_uint8_idx(0), OBD9141_read_uint8_idx(1)};
+            *values_ok &= check_value(pid_vals[i].pid, data);
+        }
+    }
+    return answered;
+}
+
+// get_car_data(): OBD9141_MAX_BATCH_PIDS per request
+static uint32_t cycle_batch(bool *values_ok) {
+    OBD9141_pid_req_t req[N_PIDS];
+    for (size_t i = 0; i < N_PIDS; i++) {
+        req[i] = (OBD9141_pid_req_t){.pid = pid_vals[i].pid, .len = pid_vals[i].len};
+    }
+    for (uint8_t i = 0; i < N_PIDS; i += OBD9141_MAX_BATCH_PIDS) {
+        OBD9141_get_current_pids(&req[i], N_PIDS - i < OBD9141_MAX_BATCH_PIDS ? N_PIDS - i : OBD9141_MAX_BATCH_PIDS);
+    }
+    uint32_t answered = 0;
+    for (size_t i = 0; i < N_PIDS; i++) {
+        if (req[i].ok) {
+            answered++;
+            *values_ok &= check_value(req[i].pid, req[i].data);
+        }
+    }
+    return answered;
+}
+
+static bool run(uint32_t (*cycle)(bool *), uint32_t cycles, bool negotiate, bench_t *bench) {
+    rx_head = rx_tail = 0;
+    if (!OBD9141_init_kwp()) {
+        return false;
+    }
+    bench->negotiated = negotiate && OBD9141_access_timing();
+    bench->values_ok = true;
+    uint32_t requests = ecu_requests, dropped = ecu_dropped, answered = 0;
+    int64_t start = host_time_us;
+    for (uint32_t c = 0; c < cycles; c++) {
+        answered += cycle(&bench->values_ok);
+    }
+    bench->ms = (host_time_us - start) * 1e-3 / cycles;
+    bench->requests = (double)(ecu_requests - requests) / cycles;
+    bench->answered = (double)answered / cycles;
+    bench->dropped = (double)(ecu_dropped - dropped) / cycles;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint32_t cycles = argc > 1 ? (uint32_t)atoi(argv[1]) : 100;
+    bool ok = true;
+    double clean_ms = 0;
+    OBD9141_begin();
+
+    printf("%zu PIDs per cycle, %lu cycles, bus time per cycle:\n", N_PIDS, (unsigned long)cycles);
+    printf("  %-26s %21s %21s %8s %25s\n", "ECU", "one PID per request", "batched", "speed-up", "batched, 0x83 timing");
+    for (size_t e = 0; e < sizeof(ecus) / sizeof(ecus[0]); e++) {
+        ecu = &ecus[e];
+        bench_t single, batch, fast;
+        if (!run(cycle_single, cycles, false, &single) || !run(cycle_batch, cycles, false, &batch) ||
+            !run(cycle_batch, cycles, true, &fast)) {
+            printf("  %-26s init failed\n", ecu->name);
+            ok = false;
+            continue;
+        }
+        printf("  %-26s %6.1f ms %4.1f req %s %6.1f ms %4.1f req %s %7.2fx %6.1f ms %s %4.0f PIDs/s\n", ecu->name,
+               single.ms, single.requests, single.values_ok ? "  " : "!!",
+               batch.ms, batch.requests, batch.values_ok ? "  " : "!!", single.ms / batch.ms,
+               fast.ms, fast.negotiated ? "set    " : "refused", fast.answered * 1e3 / fast.ms);
+        if (!fast.values_ok || fast.answered != batch.answered) {
+            printf("    FAIL: with 0x83 timing answered %.1f/%.1f PIDs per cycle, values %s\n", fast.answered, batch.answered,
+                   fast.values_ok ? "ok" : "wrong");
+            ok = false;
+        }
+        if (fast.negotiated != ecu->timing) {
+            printf("    FAIL: timing %s\n", fast.negotiated ? "set on an ECU without 0x83" : "not set");
+            ok = false;
+        }
+        if (ecu->timing ? fast.ms > batch.ms * 0.8 : fast.ms > batch.ms * 1.05) {
+            printf("    FAIL: 0x83 timing %s\n", ecu->timing ? "saves less than 20%" : "refused, still slower");
+            ok = false;
+        }
+        if (!single.values_ok || !batch.values_ok || batch.answered != single.answered) {
+            printf("    FAIL: answered %.1f/%.1f PIDs per cycle, values %s\n", batch.answered, single.answered,
+                   batch.values_ok && single.values_ok ? "ok" : "wrong");
+            ok = false;
+        }
+        if (ecu->multi == ECU_MULTI && batch.requests > (N_PIDS + OBD9141_MAX_BATCH_PIDS - 1) / OBD9141_MAX_BATCH_PIDS + batch.dropped) {
+            printf("    FAIL: more requests than batches\n");
+            ok = false;
+        }
+        if (ecu->multi != ECU_MULTI && batch.ms > single.ms * 1.1) {
+            printf("    FAIL: fallback costs more than %d rejected batches\n", OBD9141_BATCH_MAX_FAILS);
+            ok = false;
+        }
+        if (e == 0) {
+            clean_ms = batch.ms;
+        }
+        if (ecu->drop_every) {
+            printf("    %.2f answers lost per cycle, %.1f ms each to recover (default timeout: %d ms wasted, data lost)\n",
+                   batch.dropped, (batch.ms - clean_ms) / batch.dropped,
+                   OBD9141_REQUEST_ANSWER_MS_PER_BYTE + OBD9141_WAIT_FOR_REQUEST_ANSWER_TIMEOUT);
+            if (single.answered != N_PIDS || batch.answered != N_PIDS) {
+                printf("    FAIL: lost frames not recovered\n");
+                ok = false;
+            }
+        }
+    }
+
+    OBD9141_lat_info_t lat[OBD9141_LAT_SLOTS];
+    uint16_t retries, recovered;
+    uint8_t n_lat = OBD9141_get_latency(lat, OBD9141_LAT_SLOTS, &retries, &recovered);
+    printf("Learned answer latency, %u lost frames sent again, %u recovered:\n", retries, recovered);
+    printf("  %-8s %8s %6s %6s %6s %8s\n", "key", "samples", "lost", "p50", "p99", "timeout");
+    for (uint8_t i = 0; i < n_lat; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), lat[i].service == 0x01 ? "%02X/%02X" : "%02X", lat[i].service, lat[i].pid);
+        printf("  %-8s %8u %6u %3u ms %3u ms %5u ms\n", key, lat[i].samples, lat[i].lost,
+               lat[i].p50_ms, lat[i].p99_ms, lat[i].timeout_ms);
+        if (lat[i].service == 0x01 && lat[i].timeout_ms >= OBD9141_WAIT_FOR_REQUEST_ANSWER_TIMEOUT) {
+            printf("    FAIL: nothing learned\n");
+            ok = false;
+        }
+    }
+    printf(ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
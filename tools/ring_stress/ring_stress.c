@@ -0,0 +1,133 @@
+// Pulse ring stress test: main/pulse_ring.h with the producer (the injector ISR's side) and the consumer
+// (fuel_meter_task's side) on two threads. Every pulse carries its sequence number, so the consumer can tell a
+// lost, duplicated, reordered or torn entry. The consumer stalls now and then to make the ring overflow; the
+// producer keeps a bitmap of the pulses the ring refused, which has to match overflow_cnt and the gaps seen.
+//
+//   make && ./ring_stress [pulses]     (exit status 1 if a check fails)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sched.h>
+
+#include "pulse_ring.h"
+
+#define STALL_EVERY     100000          // Pulses popped between consumer stalls
+#define PRODUCER_BURST  64              // Pushes between producer yields, so the consumer keeps up unless it stalls
+#define STALL_US        2000            // [us] Stall length, the producer fills the ring meanwhile
+
+static pulse_ring_t ring;
+static uint32_t n_pulses;
+static uint8_t *refused;                // Bit per pulse, set by the producer if the push failed
+static uint32_t n_refused = 0;
+static atomic_bool producer_done = false;
+
+static void *producer(void *arg) {
+    for (uint32_t seq = 0; seq < n_pulses; seq++) {
+        if (!pulse_ring_push(&ring, seq, ~seq)) {
+            refused[seq / 8] |= 1 << (seq % 8);
+            n_refused++;
+        }
+        if (seq % PRODUCER_BURST == PRODUCER_BURST - 1) {
+            sched_yield(); // Lets the consumer run on a single core too
+        }
+    }
+    atomic_store_explicit(&producer_done, true, memory_order_release);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    n_pulses = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000000;
+    refused = calloc(n_pulses / 8 + 1, 1);
+    bool ok = true;
+
+    pthread_t thread;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_create(&thread, NULL, producer, NULL);
+
+    uint32_t popped = 0, stalls = 0, bad_entry = 0, bad_order = 0, max_count = 0;
+    int64_t last_seq = -1;
+    uint64_t skipped = 0;                   // Sequence numbers jumped over, i.e. lost
+    while (true) {
+        bool done = atomic_load_explicit(&producer_done, memory_order_acquire);
+        uint32_t count = pulse_ring_count(&ring);
+        if (count > max_count) {
+            max_count = count;
+        }
+        injector_pulse_t pulse;
+        if (!pulse_ring_pop(&ring, &pulse)) {
+            if (done) {
+                break; // The producer finished before this empty check, so nothing is left
+            }
+            sched_yield();
+            continue;
+        }
+        popped++;
+        if (pulse.width_us != ~pulse.start_us) {
+            bad_entry++;
+        }
+        if ((int64_t)pulse.start_us <= last_seq) {
+            bad_order++; // Duplicated or reordered
+        }
+        else {
+            skipped += pulse.start_us - last_seq - 1;
+            for (int64_t s = last_seq + 1; s < pulse.start_us; s++) {
+                if (!(refused[s / 8] & (1 << (s % 8)))) {
+                    bad_order++; // Lost without the producer being told
+                    break;
+                }
+            }
+            last_seq = pulse.start_us;
+        }
+        if (popped % STALL_EVERY == 0) {
+            struct timespec stall = {0, STALL_US * 1000};
+            nanosleep(&stall, NULL);
+            stalls++;
+        }
+    }
+    pthread_join(thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    skipped += n_pulses - 1 - last_seq; // Refused at the very end
+
+    double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("%lu pulses in %.2f s (%.1f M/s), %lu popped, %lu refused, %lu consumer stalls\n",
+           (unsigned long)n_pulses, s, n_pulses / s * 1e-6, (unsigned long)popped, (unsigned long)n_refused,
+           (unsigned long)stalls);
+    printf("overflow_cnt %lu, high_water %lu (max count seen %lu of %d)\n", (unsigned long)ring.overflow_cnt,
+           (unsigned long)ring.high_water, (unsigned long)max_count, PULSE_RING_SIZE);
+
+    if (bad_entry) {
+        printf("FAIL: %lu torn entries\n", (unsigned long)bad_entry);
+        ok = false;
+    }
+    if (bad_order) {
+        printf("FAIL: %lu pulses duplicated, reordered or lost unreported\n", (unsigned long)bad_order);
+        ok = false;
+    }
+    if (popped + n_refused != n_pulses || skipped != n_refused) {
+        printf("FAIL: %lu popped + %lu refused != %lu pushed (%llu skipped)\n", (unsigned long)popped,
+               (unsigned long)n_refused, (unsigned long)n_pulses, (unsigned long long)skipped);
+        ok = false;
+    }
+    if (ring.overflow_cnt != n_refused) {
+        printf("FAIL: overflow_cnt %lu, the producer was refused %lu times\n", (unsigned long)ring.overflow_cnt,
+               (unsigned long)n_refused);
+        ok = false;
+    }
+    if (ring.high_water > PULSE_RING_SIZE || ring.high_water < max_count || (n_refused && ring.high_water != PULSE_RING_SIZE)) {
+        printf("FAIL: high_water %lu, max count seen %lu\n", (unsigned long)ring.high_water, (unsigned long)max_count);
+        ok = false;
+    }
+    if (!n_refused && stalls) {
+        printf("FAIL: the stalls never filled the ring, overflow untested\n");
+        ok = false;
+    }
+    printf(ok ? "PASS\n" : "FAIL\n");
+    free(refused);
+    return ok ? 0 : 1;
+}
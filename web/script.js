@@ -15,6 +15,8 @@ let latestFuelParsed = {
     cfl: 0.0,
     fl6: 0.0,
     fl60: 0.0,
+    a10m: NaN,
+    a1h: NaN,
     disttr: 0.0,
     barop: 0.0,
 };
@@ -30,18 +32,27 @@ function updateFuelDisplay() {
         cell.querySelector('.unit').textContent = unitText;
     }
 
+    // Window averages are -1 while stationary
+    function consText(value, digits) {
+        return (isNaN(value) || value < 0) ? "-" : value.toFixed(digits);
+    }
+
     if (inCurrency) {
         setCell("inst-fuel", (latestFuelParsed.ifl * price).toFixed(2), "BGN/100 km");
         setCell("avg-fuel", (latestFuelParsed.afl * price).toFixed(2), "BGN/100 km");
         setCell("cons-fuel", (latestFuelParsed.cfl * price).toFixed(2), "BGN");
         setCell("fuel-last-6", (latestFuelParsed.fl6 * 0.001 * price).toFixed(2), "BGN");
         setCell("fuel-last-60", (latestFuelParsed.fl60 * 0.001 * price).toFixed(2), "BGN");
+        setCell("avg-10m", consText(latestFuelParsed.a10m * price, 2), "BGN/100 km");
+        setCell("avg-1h", consText(latestFuelParsed.a1h * price, 2), "BGN/100 km");
     } else {
         setCell("inst-fuel", latestFuelParsed.ifl.toFixed(1), "L/100 km");
         setCell("avg-fuel", latestFuelParsed.afl.toFixed(1), "L/100 km");
         setCell("cons-fuel", latestFuelParsed.cfl.toFixed(2), "L");
         setCell("fuel-last-6", latestFuelParsed.fl6.toFixed(1), "mL");
         setCell("fuel-last-60", latestFuelParsed.fl60.toFixed(0), "mL");
+        setCell("avg-10m", consText(latestFuelParsed.a10m, 1), "L/100 km");
+        setCell("avg-1h", consText(latestFuelParsed.a1h, 1), "L/100 km");
     }
 
     // temperature always same
@@ -58,6 +69,15 @@ window.addEventListener("DOMContentLoaded", () => {
         toggleCurrency.addEventListener('change', updateFuelDisplay);
         priceInput.addEventListener('input', updateFuelDisplay);
         updateFuelDisplay();
+        document.getElementById('btnHeatmap').addEventListener('click', loadHeatmap);
+        document.getElementById('heatmapMode').addEventListener('change', renderHeatmap);
+        document.getElementById('btnHeatmapClear').addEventListener('click', () => {
+            if (!confirm("Clear the stored heatmap?")) return;
+            ws.send(JSON.stringify({ type: "heatmap_clear" }));
+            setTimeout(loadHeatmap, 500);
+        });
+        loadHeatmap();
+        document.getElementById('btnTrips').addEventListener('click', () => ws.send(JSON.stringify({ type: "trip_list" })));
     }
 
     // Restore any saved ESP logs
@@ -86,6 +106,8 @@ window.addEventListener("DOMContentLoaded", () => {
 function trySendPageOpen() {
     if (wsReady && domReady) {
         ws.send(JSON.stringify({ type: "page_open", page: pageName }));
+        if (pageName === "debugfuel.html") ws.send(JSON.stringify({ type: "profile_list" }));
+        if (pageName === "fuel.html") ws.send(JSON.stringify({ type: "trip_list" }));
     }
 }
 
@@ -96,6 +118,12 @@ ws.onopen = () => {
 };
 
 ws.onmessage = (event) => {
+    // Binary frames are the raw pulse stream
+    if (event.data instanceof ArrayBuffer) {
+        handleScopeFrame(event.data);
+        return;
+    }
+
     const msg = event.data.trim();
 
     // Handle text packets first
@@ -128,7 +156,7 @@ ws.onmessage = (event) => {
             return;
         }
 
-        else if (type === 'd' && parts.length >= 13) {
+        else if (type === 'd' && parts.length >= 16) {
             // Debug fuel packet
             const parsed = {
                 ifl: parseFloat(parts[1]),
@@ -143,6 +171,21 @@ ws.onmessage = (event) => {
                 pdpc: parseFloat(parts[10]),
                 cabtmp: parseFloat(parts[11]),
                 barop: parseFloat(parts[12]),
+                rovf: +parts[13],
+                rhw: +parts[14],
+                irpm: +parts[15],
+                recon: parts.length >= 19 ? +parts[16] : 0,
+                rawfl: parts.length >= 19 ? parseFloat(parts[17]) : NaN,
+                conf: parts.length >= 19 ? +parts[18] : 100,
+                lost: parts.length >= 22 ? +parts[19] : 0,
+                flp: parts.length >= 22 ? +parts[20] : 0,
+                fllost: parts.length >= 22 ? +parts[21] : 0,
+                lutrb: parts.length >= 24 ? +parts[22] : 0,
+                luterr: parts.length >= 24 ? parseFloat(parts[23]) : NaN,
+                perms: parts.length >= 28 ? parseFloat(parts[24]) : NaN,
+                kwpms: parts.length >= 28 ? parseFloat(parts[25]) : NaN,
+                ovr: parts.length >= 28 ? +parts[26] : 0,
+                late: parts.length >= 28 ? +parts[27] : 0,
             };
 
             document.querySelector('#inst-fuel .value').textContent      = parsed.ifl.toFixed(1);
@@ -157,6 +200,63 @@ ws.onmessage = (event) => {
             document.querySelector('#avg-pwidth .value').textContent     = parsed.pdpc.toFixed(1);
             document.querySelector('#cabtmp .value').textContent         = parsed.cabtmp.toFixed(1);
             document.querySelector('#barop .value').textContent          = parsed.barop.toFixed(1);
+            document.querySelector('#ring-ovf .value').textContent       = parsed.rovf;
+            document.querySelector('#ring-hw .value').textContent        = parsed.rhw;
+            document.querySelector('#inj-rpm .value').textContent        = parsed.irpm ? parsed.irpm : "-";
+            document.querySelector('#recon-pcnt .value').textContent     = parsed.recon;
+            document.querySelector('#raw-fuel .value').textContent       = isNaN(parsed.rawfl) ? "-" : parsed.rawfl.toFixed(2);
+            document.querySelector('#confidence .value').textContent     = parsed.conf;
+            document.querySelector('#lost-edges .value').textContent     = parsed.lost;
+            document.querySelector('#flash-periods .value').textContent  = `${parsed.flp} / ${parsed.fllost}`;
+            document.querySelector('#fuel-lut .value').textContent       = isNaN(parsed.luterr) ? "-" : `${parsed.lutrb} / ${parsed.luterr.toFixed(3)}`;
+            document.querySelector('#loop-period .value').textContent    = isNaN(parsed.perms) ? "-" : `${parsed.perms.toFixed(0)} / ${parsed.kwpms.toFixed(0)}`;
+            document.querySelector('#loop-overruns .value').textContent  = `${parsed.ovr} / ${parsed.late}`;
+            return;
+        }
+
+        else if (type === 'k' && parts.length >= 9) {
+            // KWP timing packet: retries, recovered, negotiated, P2min, P2max, P3min, P4min, count, then 7 fields per service / PID
+            const tbody = document.querySelector('#kwp-timing-table tbody');
+            if (!tbody) return;
+            document.querySelector('#kwp-retries .value').textContent = `${parts[2]}/${parts[1]}`;
+            document.querySelector('#kwp-timing .value').textContent  = `${parts[4]}-${parts[5]} / ${parts[6]} / ${parts[7]}`;
+            document.querySelector('#kwp-timing .unit').textContent   = +parts[3] ? "ms, negotiated" : "ms, defaults";
+            const hex = (v) => (+v).toString(16).toUpperCase().padStart(2, "0");
+            const n = +parts[8];
+            let html = "";
+            for (let i = 0; i < n; i++) {
+                const f = parts.slice(9 + i * 7, 16 + i * 7);
+                if (f.length < 7) break;
+                const key = +f[0] === 0x01 ? `${hex(f[0])} / ${hex(f[1])}` : hex(f[0]);
+                html += `<tr><td>${key}</td><td>${f[2]}</td><td>${f[3]}</td><td>${f[4]}</td><td>${f[5]}</td><td>${f[6]}</td></tr>`;
+            }
+            tbody.innerHTML = html;
+            return;
+        }
+
+        else if (type === 'y' && parts.length >= 2) {
+            // Per-cylinder packet: count, then 6 fields per channel
+            const grid = document.getElementById('cyl-grid');
+            if (!grid) return;
+            const n = +parts[1];
+            let html = "";
+            for (let c = 0; c < n; c++) {
+                const f = parts.slice(2 + c * 6, 8 + c * 6);
+                if (f.length < 6) break;
+                html += `<div class="cell"><div class="name">Cylinder ${f[0]}</div>` +
+                        `<div class="value">${(+f[4]).toFixed(1)}</div><div class="unit">mL</div>` +
+                        `<div class="unit">${f[1]} pulses, ${(+f[2]).toFixed(2)} ms avg, ${(+f[3]).toFixed(1)} uL/period, ${f[5]} dropped</div></div>`;
+            }
+            grid.innerHTML = html;
+            return;
+        }
+
+        else if (type === 'i' && parts.length >= 11) {
+            // Injector ISR profiling packet
+            const p = parts.slice(1, 11).map(parseFloat);
+            document.querySelector('#isr-dur .value').textContent   = `${p[1].toFixed(1)}/${p[2].toFixed(1)}/${p[3].toFixed(1)}/${p[4].toFixed(1)}`;
+            document.querySelector('#isr-stamp .value').textContent = `${p[5].toFixed(1)}/${p[6].toFixed(1)}/${p[7].toFixed(1)}/${p[8].toFixed(1)}`;
+            document.querySelector('#isr-werr .value').textContent  = p[9].toFixed(2);
             return;
         }
 
@@ -169,6 +269,8 @@ ws.onmessage = (event) => {
                 cfl: parseFloat(parts[4]),
                 fl6: parseFloat(parts[5]),
                 fl60: parseFloat(parts[6]),
+                a10m: parts.length >= 9 ? parseFloat(parts[7]) : NaN,
+                a1h: parts.length >= 9 ? parseFloat(parts[8]) : NaN,
             };
             if (pageName === "fuel.html") updateFuelDisplay();
             return;
@@ -187,6 +289,16 @@ ws.onmessage = (event) => {
         document.getElementById('fuelValue').textContent = Number(parsed.fuel).toFixed(2);
         document.getElementById('distanceValue').textContent = Number(parsed.dist).toFixed(1);
 
+    } else if (parsed && parsed.type === "pw_stats") {
+        renderPwStats(parsed);
+        return; // Sent every period, keep it out of the log
+
+    } else if (parsed && parsed.type === "profiles") {
+        renderProfiles(parsed);
+
+    } else if (parsed && parsed.type === "trips") {
+        renderTrips(parsed.trips);
+
     } else if (parsed && parsed.type === "filler2") {
         // Do other stuff
 
@@ -212,6 +324,277 @@ ws.onmessage = (event) => {
     }
 };
 
+/* Injector characterisation (injector.html only) */
+let pwSelectedBand = -1; // -1 = all bands
+
+function renderPwStats(stats) {
+    const tbody = document.querySelector('#pw-table tbody');
+    if (!tbody) return;
+    const ms = (us) => (us * 0.001).toFixed(2);
+
+    tbody.innerHTML = "";
+    stats.bands.forEach((band, i) => {
+        const row = document.createElement("tr");
+        if (i === pwSelectedBand) row.classList.add("selected");
+        const upper = i + 1 < stats.bands.length ? `-${stats.bands[i + 1].rpm}` : "+";
+        const p = band.period, t = band.total;
+        row.innerHTML = `<td>${band.rpm}${upper}</td><td>${p.n}</td><td>${ms(p.p50)}</td><td>${ms(p.p95)}</td><td>${ms(p.max)}</td>` +
+                        `<td>${t.n}</td><td>${ms(t.avg)}</td><td>${ms(t.p50)}</td><td>${ms(t.p95)}</td><td>${ms(t.max)}</td>`;
+        row.addEventListener("click", () => { pwSelectedBand = (pwSelectedBand === i) ? -1 : i; renderPwStats(stats); });
+        tbody.appendChild(row);
+    });
+
+    // Histogram of the selected band, or all bands summed
+    const hist = new Array(stats.edges.length).fill(0);
+    stats.bands.forEach((band, i) => {
+        if (pwSelectedBand !== -1 && i !== pwSelectedBand) return;
+        band.total.hist.forEach((n, b) => hist[b] += n);
+    });
+    const peak = Math.max(1, ...hist);
+    const histDiv = document.getElementById('pw-hist');
+    histDiv.innerHTML = "";
+    hist.forEach((n, b) => {
+        const row = document.createElement("div");
+        row.className = "hist-row";
+        row.innerHTML = `<span class="label">${ms(stats.edges[b])}</span><span class="bar" style="width:${(n / peak * 300).toFixed(0)}px"></span><span>${n}</span>`;
+        histDiv.appendChild(row);
+    });
+    document.getElementById('pw-hist-band').textContent = pwSelectedBand === -1 ? "all bands" : `${stats.bands[pwSelectedBand].rpm} RPM band`;
+}
+
+/* Raw pulse stream (injector.html only) */
+const SCOPE_FRAME_MAGIC = 0x53;
+const SCOPE_HDR_LEN = 8, SCOPE_PULSE_LEN = 7;
+/* Trips (fuel.html), newest first */
+
+function renderTrips(trips) {
+    const tbody = document.querySelector('#trip-table tbody');
+    if (!tbody) return;
+    const hms = (s) => `${Math.floor(s / 3600)}:${String(Math.floor(s / 60) % 60).padStart(2, "0")}:${String(s % 60).padStart(2, "0")}`;
+    tbody.innerHTML = "";
+    trips.forEach(t => {
+        const row = document.createElement("tr");
+        row.innerHTML = `<td>${t.id}${t.open ? " (now)" : ""}</td><td>${hms(t.dur)}</td><td>${t.dist.toFixed(1)}</td>` +
+                        `<td>${t.fuel.toFixed(2)}</td><td>${t.cons < 0 ? "-" : t.cons.toFixed(1)}</td><td>${t.vmax}</td>` +
+                        `<td>${hms(t.idle)}</td><td>${t.idle_fuel.toFixed(2)}</td>`;
+        tbody.appendChild(row);
+    });
+}
+
+/* Consumption heatmap (fuel.html), GET /heatmap: header, x/y breakpoints, then rows of {fuel [nL], dist [mm], time [ms]} (u64 each) */
+
+const HEATMAP_MAGIC = 0x48, HEATMAP_HDR_LEN = 8, HEATMAP_CELL_LEN = 24;
+let heatmap = null;
+
+async function loadHeatmap() {
+    try {
+        const resp = await fetch("/heatmap", { cache: "no-store" });
+        const buf = await resp.arrayBuffer();
+        const view = new DataView(buf);
+        if (buf.byteLength < HEATMAP_HDR_LEN || view.getUint8(0) !== HEATMAP_MAGIC) return;
+        const xKind = view.getUint8(2), nx = view.getUint8(3), ny = view.getUint8(4);
+        let off = HEATMAP_HDR_LEN;
+        const xs = [], ys = [], cells = [];
+        for (let i = 0; i < nx; i++, off += 4) xs.push(view.getInt32(off, true));
+        for (let i = 0; i < ny; i++, off += 4) ys.push(view.getInt32(off, true));
+        for (let i = 0; i < nx * ny; i++, off += HEATMAP_CELL_LEN) {
+            if (off + HEATMAP_CELL_LEN > buf.byteLength) return;
+            cells.push({
+                fuel: Number(view.getBigUint64(off, true)) * 1e-9,         // [nL] to [L]
+                dist: Number(view.getBigUint64(off + 8, true)) * 1e-6,     // [mm] to [km]
+                time: Number(view.getBigUint64(off + 16, true)) / 60000,   // [ms] to [min]
+            });
+        }
+        heatmap = { xKind, xs, ys, cells };
+        renderHeatmap();
+    } catch (e) {
+        console.log("Heatmap load failed", e);
+    }
+}
+
+function renderHeatmap() {
+    const table = document.getElementById('heatmap');
+    if (!table || !heatmap) return;
+    const mode = document.getElementById('heatmapMode').value;
+    const { xKind, xs, ys, cells } = heatmap;
+    const nx = xs.length;
+    const totalFuel = cells.reduce((sum, c) => sum + c.fuel, 0);
+    const peakFuel = Math.max(1e-12, ...cells.map(c => c.fuel));
+    const range = (bp, i) => i + 1 < bp.length ? `${bp[i]}-${bp[i + 1]}` : `${bp[i]}+`;
+
+    let html = `<tr><th>RPM \\ ${xKind ? "Load [%]" : "Speed [km/h]"}</th>` + xs.map((x, i) => `<th>${range(xs, i)}</th>`).join("") + "</tr>";
+    for (let y = ys.length - 1; y >= 0; y--) { // High RPM on top
+        html += `<tr><th>${range(ys, y)}</th>`;
+        for (let x = 0; x < nx; x++) {
+            const c = cells[y * nx + x];
+            let text = "";
+            if (c.fuel > 0 || c.time > 0) {
+                if (mode === "cons") text = c.dist >= 0.1 ? (c.fuel / c.dist * 100).toFixed(1) : "-";
+                else if (mode === "time") text = c.time.toFixed(0);
+                else text = (c.fuel / totalFuel * 100).toFixed(1);
+            }
+            const shade = (c.fuel / peakFuel * 0.8).toFixed(2);
+            html += `<td style="background:rgba(255,170,0,${shade})" title="${c.fuel.toFixed(2)} L, ${c.dist.toFixed(1)} km, ${c.time.toFixed(0)} min">${text}</td>`;
+        }
+        html += "</tr>";
+    }
+    table.innerHTML = html;
+    document.getElementById('heatmapTotal').textContent = `${totalFuel.toFixed(2)} L in total`;
+}
+
+const scopeColours = ["#fa0", "#0af", "#0f6", "#f06"];
+let scopePulses = [];   // {start, width, ch} with start in [us], unwrapped
+let scopeLastRaw = 0, scopeWrapOffset = 0;
+let scopeFrames = 0, scopeDropped = 0;
+
+function handleScopeFrame(buf) {
+    const view = new DataView(buf);
+    if (buf.byteLength < SCOPE_HDR_LEN || view.getUint8(0) !== SCOPE_FRAME_MAGIC) return;
+    const count = view.getUint16(2, true);
+    scopeDropped = view.getUint32(4, true);
+    scopeFrames++;
+    for (let i = 0; i < count; i++) {
+        const off = SCOPE_HDR_LEN + i * SCOPE_PULSE_LEN;
+        if (off + SCOPE_PULSE_LEN > buf.byteLength) break;
+        const raw = view.getUint32(off, true);
+        if (raw < scopeLastRaw && scopeLastRaw - raw > 0x80000000) scopeWrapOffset += 0x100000000; // 32-bit us timer wrapped
+        scopeLastRaw = raw;
+        scopePulses.push({ start: raw + scopeWrapOffset, width: view.getUint16(off + 4, true), ch: view.getUint8(off + 6) });
+    }
+    drawScope();
+}
+
+function drawScope() {
+    const canvas = document.getElementById('scope');
+    if (!canvas) return;
+    const windowUs = (parseInt(document.getElementById('scopeWindow').value) || 1000) * 1000;
+    const end = scopePulses.length ? scopePulses[scopePulses.length - 1].start : 0;
+    scopePulses = scopePulses.filter(p => p.start + p.width >= end - windowUs);
+
+    const ctx = canvas.getContext('2d');
+    ctx.fillStyle = "#111";
+    ctx.fillRect(0, 0, canvas.width, canvas.height);
+    const nCh = Math.max(1, ...scopePulses.map(p => p.ch + 1));
+    const laneH = canvas.height / nCh;
+    const x = (us) => (us - (end - windowUs)) / windowUs * canvas.width;
+    scopePulses.forEach(p => {
+        ctx.fillStyle = scopeColours[p.ch % scopeColours.length];
+        ctx.fillRect(x(p.start), p.ch * laneH + 4, Math.max(1, p.width / windowUs * canvas.width), laneH - 8);
+    });
+
+    const last = scopePulses[scopePulses.length - 1];
+    document.getElementById('scope-info').textContent =
+        `frames: ${scopeFrames}, pulses shown: ${scopePulses.length}, dropped: ${scopeDropped}` +
+        (last ? `, last width: ${(last.width * 0.001).toFixed(2)} ms` : "");
+}
+
+const btnScope = document.getElementById("btnScope");
+if (btnScope) {
+    let scopeOn = false;
+    btnScope.addEventListener("click", () => {
+        scopeOn = !scopeOn;
+        if (scopeOn) {
+            scopePulses = []; scopeLastRaw = 0; scopeWrapOffset = 0; scopeFrames = 0;
+            ws.send(JSON.stringify({ type: "scope_subscribe", fps: parseInt(document.getElementById('scopeFps').value) || 20 }));
+        } else {
+            ws.send(JSON.stringify({ type: "scope_unsubscribe" }));
+        }
+        btnScope.textContent = scopeOn ? "Stop" : "Start";
+    });
+}
+
+/* Engine profiles (debugfuel.html only) */
+
+const profFields = ["name", "n_cyl", "rail_pressure", "flow_pressure", "flow", "deadtime", "opening", "closing", "reset"];
+
+function renderProfiles(p) {
+    const sel = document.getElementById("profSlot");
+    if (!sel) return;
+    sel.innerHTML = "";
+    for (let i = 0; i < 4; i++) {
+        const stored = p.slots.find(s => s.slot === i);
+        const opt = document.createElement("option");
+        opt.value = i;
+        opt.textContent = `${i}: ${stored ? stored.name : "(empty)"}${i === p.active ? " *" : ""}`;
+        sel.appendChild(opt);
+    }
+    sel.value = p.active;
+    profFields.forEach(f => { document.getElementById("prof-" + f).value = p.current[f]; });
+    document.getElementById("prof-status").textContent = p.msg || `Active: ${p.current.name} (slot ${p.active})`;
+}
+
+const btnProfUse = document.getElementById("btnProfUse");
+if (btnProfUse) {
+    btnProfUse.addEventListener("click", () => {
+        ws.send(JSON.stringify({ type: "profile_select", slot: parseInt(document.getElementById("profSlot").value) }));
+    });
+    document.getElementById("btnProfSave").addEventListener("click", () => {
+        const msg = { type: "profile_save", slot: parseInt(document.getElementById("profSlot").value) };
+        profFields.forEach(f => {
+            const v = document.getElementById("prof-" + f).value;
+            msg[f] = f === "name" ? v : Number(v);
+        });
+        ws.send(JSON.stringify(msg));
+    });
+}
+
+/* Calibration upload */
+
+function crc32(bytes) {
+    let crc = 0xFFFFFFFF;
+    for (let i = 0; i < bytes.length; i++) {
+        crc ^= bytes[i];
+        for (let k = 0; k < 8; k++) crc = (crc >>> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return (crc ^ 0xFFFFFFFF) >>> 0;
+}
+
+// Packs {tables: [{name, axes: [{min, step, n} | {bp: [...]}], data: [...]}]} into the calib.h binary format
+function packCalib(json) {
+    const bytes = [];   // Records after the header, all 4-byte multiples
+    json.tables.forEach(t => {
+        const rec = new DataView(new ArrayBuffer(16));
+        for (let i = 0; i < 8; i++) rec.setUint8(i, i < t.name.length ? t.name.charCodeAt(i) : 0);
+        rec.setUint8(8, t.axes.length);
+        let mask = 0;
+        t.axes.forEach((a, d) => { if (!a.bp) mask |= 1 << d; });
+        rec.setUint8(9, mask);
+        for (let d = 0; d < 3; d++) rec.setUint16(10 + 2 * d, d < t.axes.length ? (a => a.bp ? a.bp.length : a.n)(t.axes[d]) : 1, true);
+        bytes.push(new Uint8Array(rec.buffer));
+        t.axes.forEach(a => bytes.push(new Uint8Array(Int32Array.from(a.bp ? a.bp : [a.min, a.step]).buffer)));
+        bytes.push(new Uint8Array(Int32Array.from(t.data.flat(2)).buffer));
+    });
+    const len = bytes.reduce((sum, b) => sum + b.length, 0);
+    const out = new Uint8Array(32 + len);
+    let off = 32;
+    bytes.forEach(b => { out.set(b, off); off += b.length; });
+    const hdr = new DataView(out.buffer);
+    hdr.setUint32(0, 0x424C4143, true);   // "CALB"
+    hdr.setUint16(4, 1, true);
+    hdr.setUint16(6, json.tables.length, true);
+    hdr.setUint32(12, out.length, true);
+    hdr.setUint32(16, crc32(out.subarray(32)), true);
+    return out;
+}
+
+const btnCalib = document.getElementById("btnCalib");
+if (btnCalib) {
+    btnCalib.addEventListener("click", async () => {
+        const status = document.getElementById("calib-status");
+        const file = document.getElementById("calibFile").files[0];
+        if (!file) { status.textContent = "No file selected"; return; }
+        try {
+            const body = file.name.endsWith(".json") ? packCalib(JSON.parse(await file.text())) : await file.arrayBuffer();
+            status.textContent = "Uploading...";
+            const resp = await fetch("/calib", { method: "POST", body: body });
+            const res = await resp.json();
+            status.textContent = (res.ok ? "OK: " : "Rejected: ") + res.msg;
+        } catch (e) {
+            status.textContent = "Upload failed: " + e;
+        }
+    });
+}
+
 ws.onclose = () => console.log("WebSocket connection closed");
 ws.onerror = (error) => console.error("WebSocket error:", error);
 